@@ -0,0 +1,118 @@
+#version 430 core
+layout (local_size_x = 16, local_size_y = 16) in;
+
+// Position based cloth on a resolution x resolution particle grid, one pass per dispatch (see Cloth.h).
+// Passes read the current positions and write the outputs, which become the next input, so
+// particles never see a half updated neighbour.
+#define PASS_INTEGRATE 0
+#define PASS_CONSTRAIN 1
+#define PASS_NORMALS 2
+
+// xyz - position, w - inverse mass, 0 pins the particle
+layout (std430) readonly buffer ClothPositions {
+    vec4 positions[];
+};
+layout (std430) buffer ClothPrevious {
+    vec4 previous[];
+};
+// positions, or normals in the normal pass
+layout (std430) writeonly buffer ClothOutput {
+    vec4 outputs[];
+};
+
+uniform int pass;
+uniform int resolution;
+// rest distance of neighbouring particles
+uniform float spacing;
+uniform float timeStep;
+uniform float damping;
+uniform vec3 gravity;
+uniform vec3 wind;
+uniform float turbulence;
+uniform float drag;
+uniform float time;
+// over-relaxation of the averaged corrections, bending constraints are scaled down further
+uniform float stiffness;
+uniform float bendStiffness;
+
+// structural, shear, then bending neighbours
+const ivec2 neighbours[12] = ivec2[](
+    ivec2(1, 0), ivec2(-1, 0), ivec2(0, 1), ivec2(0, -1),
+    ivec2(1, 1), ivec2(-1, -1), ivec2(1, -1), ivec2(-1, 1),
+    ivec2(2, 0), ivec2(-2, 0), ivec2(0, 2), ivec2(0, -2));
+
+int indexOf(ivec2 cell)
+{
+    return cell.y * resolution + cell.x;
+}
+
+// same orientation as tessEval.tes, cross of the derivatives along u (x) and v (y)
+vec3 gridNormal(ivec2 cell)
+{
+    ivec2 last = ivec2(resolution - 1);
+    vec3 du = positions[indexOf(min(cell + ivec2(1, 0), last))].xyz - positions[indexOf(max(cell - ivec2(1, 0), ivec2(0)))].xyz;
+    vec3 dv = positions[indexOf(min(cell + ivec2(0, 1), last))].xyz - positions[indexOf(max(cell - ivec2(0, 1), ivec2(0)))].xyz;
+    vec3 normal = cross(du, dv);
+    float area = length(normal);
+    return area > 1e-12 ? normal / area : vec3(0.0, 0.0, 1.0);
+}
+
+// Verlet step with gravity and the wind pushing along the normal, relative to the particle's velocity
+vec4 integrate(ivec2 cell, int index)
+{
+    vec4 current = positions[index];
+    vec3 last = previous[index].xyz;
+    previous[index] = current;
+    if (current.w == 0.0)
+        return current;
+
+    vec3 velocity = (current.xyz - last) / timeStep;
+    float gust = 1.0 + turbulence * sin(time * 2.3 + current.x * 0.9 + current.y * 0.7) * sin(time * 1.7 + current.z * 1.3);
+    vec3 normal = gridNormal(cell);
+    vec3 acceleration = gravity + drag * dot(normal, wind * gust - velocity) * normal;
+    vec3 next = current.xyz + (current.xyz - last) * (1.0 - damping) + acceleration * timeStep * timeStep;
+    return vec4(next, current.w);
+}
+
+// Jacobi iteration, every particle moves by the average of its share of all distance corrections
+vec4 constrain(ivec2 cell, int index)
+{
+    vec4 current = positions[index];
+    if (current.w == 0.0)
+        return current;
+
+    vec3 correction = vec3(0.0);
+    int count = 0;
+    for (int k = 0; k < 12; k++)
+    {
+        ivec2 other = cell + neighbours[k];
+        if (any(lessThan(other, ivec2(0))) || any(greaterThanEqual(other, ivec2(resolution))))
+            continue;
+
+        vec4 neighbour = positions[indexOf(other)];
+        vec3 delta = neighbour.xyz - current.xyz;
+        float separation = length(delta);
+        if (separation < 1e-6)
+            continue;
+        float rest = spacing * length(vec2(neighbours[k]));
+        float weight = current.w / (current.w + neighbour.w) * (k < 8 ? 1.0 : bendStiffness);
+        correction += weight * (separation - rest) / separation * delta;
+        count++;
+    }
+    return vec4(current.xyz + stiffness * correction / float(max(count, 1)), current.w);
+}
+
+void main()
+{
+    ivec2 cell = ivec2(gl_GlobalInvocationID.xy);
+    if (cell.x >= resolution || cell.y >= resolution)
+        return;
+    int index = indexOf(cell);
+
+    if (pass == PASS_INTEGRATE)
+        outputs[index] = integrate(cell, index);
+    else if (pass == PASS_CONSTRAIN)
+        outputs[index] = constrain(cell, index);
+    else
+        outputs[index] = vec4(gridNormal(cell), 0.0);
+}
\ No newline at end of file
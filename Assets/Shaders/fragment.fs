@@ -1,11 +1,28 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+#ifdef IMPOSTOR_BAKE
+// second target of the impostor atlases (ImpostorBaker.h)
+layout (location = 1) out vec4 BakedNormalDepth;
+#endif
 
+#ifdef BINDLESS
+// Textures are resident bindless handles (BINDLESS_SHADER_HEADER in Material.h), MaterialIndex is not
+// dynamically uniform in a batch, GL_NV_gpu_shader5 allows samplers built from it
 struct Material {
-    sampler2D diffuse;
-    sampler2D specular;
-    float shininess;
-}; 
+    uvec2 diffuse;
+    uvec2 specular;
+    vec4 params;    // x - shininess
+};
+#else
+// Has to match MAX_MATERIALS in Material.h
+#define MAX_MATERIALS 256
+
+// Textures are layers of the arrays bound to diffuseMaps/specularMaps
+struct Material {
+    ivec4 layers;   // x - diffuse layer, y - specular layer
+    vec4 params;    // x - shininess
+};
+#endif
 
 struct DirLight {
     vec3 direction;
@@ -47,38 +64,152 @@ struct SpotLight {
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+flat in uint MaterialIndex;
+#ifdef GOURAUD
+// per vertex lighting (gouraud.vs), the material colours are still applied per fragment
+in vec3 LightDiffuse;
+in vec3 LightSpecular;
+#endif
+
+#ifdef BINDLESS
+layout (std430) buffer MaterialBuffer {
+    Material materials[];
+};
+#else
+layout (std140) uniform MaterialBlock {
+    Material materials[MAX_MATERIALS];
+};
+uniform sampler2DArray diffuseMaps;
+uniform sampler2DArray specularMaps;
+#endif
 
 uniform vec3 viewPos;
 uniform DirLight dirLight;
 uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform SpotLight spotLight;
-uniform Material material;
 uniform bool blinn;
 uniform vec3 skyColor;
 uniform float fogDistance;
+// single sheet geometry drawn without culling (grass), the back faces are lit from their own side
+uniform bool twoSided;
+
+#ifdef IMPOSTOR
+// baked frames of the model (ImpostorBaker.h)
+uniform sampler2D impostorAlbedo;
+uniform sampler2D impostorNormalDepth;
+uniform int impostorFrames;
+uniform vec4 boundingSphere;
+uniform mat4 view;
+uniform mat4 projection;
+flat in vec2 FrameCoords;
+flat in mat3 NormalToWorld;
+flat in vec3 ViewAxis;
+
+bool SampleImpostor(out vec3 normal, out vec3 fragPos);
+#endif
 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcFog(vec3 color);
+float CalcFogFactor(vec3 fragPos);
+
+// Material inputs, sampled once per fragment and shared by all lights
+vec3 diffuseColor;
+vec3 specularColor;
+float shininess;
 
 void main()
 {
+#ifdef IMPOSTOR
+    vec3 norm;
+    vec3 fragPos;
+    if (!SampleImpostor(norm, fragPos))
+        discard;
+#else
+    Material material = materials[MaterialIndex];
+#ifdef BINDLESS
+    diffuseColor = texture(sampler2D(material.diffuse), TexCoords).rgb;
+    specularColor = texture(sampler2D(material.specular), TexCoords).rgb;
+#else
+    diffuseColor = texture(diffuseMaps, vec3(TexCoords, material.layers.x)).rgb;
+    specularColor = texture(specularMaps, vec3(TexCoords, material.layers.y)).rgb;
+#endif
+    shininess = material.params.x;
+
     vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    if (twoSided && !gl_FrontFacing)
+        norm = -norm;
+    vec3 fragPos = FragPos;
+#endif
+#ifdef IMPOSTOR_BAKE
+    // unlit, in object space, the impostor is lit when it is drawn
+    FragColor = vec4(diffuseColor, 1.0);
+    BakedNormalDepth = vec4(norm, gl_FragCoord.z);
+    return;
+#endif
+    // fully fogged fragments are the sky colour whatever the lights do
+    float fogFactor = CalcFogFactor(fragPos);
+    if (fogFactor == 0.0)
+    {
+        FragColor = vec4(skyColor, 1.0);
+        return;
+    }
+
+#ifdef GOURAUD
+    vec3 result = LightDiffuse * diffuseColor + LightSpecular * specularColor;
+#else
+    vec3 viewDir = normalize(viewPos - fragPos);
     
     vec3 result = CalcDirLight(dirLight, norm, viewDir);
 
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
+        result += CalcPointLight(pointLights[i], norm, fragPos, viewDir);    
 
-    result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
+    result += CalcSpotLight(spotLight, norm, fragPos, viewDir);    
+#endif
     
-    result = CalcFog(result);
+    result = mix(skyColor, result, fogFactor);
 
     FragColor = vec4(result, 1.0);
 }
 
+#ifdef IMPOSTOR
+// Bilinear blend of the four frames around the view direction. Empty texels are zero, so the sums are
+// premultiplied by coverage and dividing by it drops the background of frames that miss this pixel.
+bool SampleImpostor(out vec3 normal, out vec3 fragPos)
+{
+    vec2 inset = 0.5 * float(impostorFrames) / vec2(textureSize(impostorAlbedo, 0));
+    vec2 uv = clamp(TexCoords, inset, 1.0 - inset);
+    vec2 base = floor(FrameCoords);
+    vec2 blend = FrameCoords - base;
+    vec4 albedo = vec4(0.0);
+    vec4 normalDepth = vec4(0.0);
+    for (int i = 0; i < 4; i++)
+    {
+        vec2 corner = vec2(float(i & 1), float(i >> 1));
+        vec2 frame = clamp(base + corner, 0.0, float(impostorFrames - 1));
+        vec2 weights = mix(1.0 - blend, blend, corner);
+        vec2 atlasUV = (frame + uv) / float(impostorFrames);
+        albedo += weights.x * weights.y * texture(impostorAlbedo, atlasUV);
+        normalDepth += weights.x * weights.y * texture(impostorNormalDepth, atlasUV);
+    }
+    normal = vec3(0.0, 1.0, 0.0);
+    fragPos = FragPos;
+    if (albedo.a < 0.5)
+        return false;
+
+    diffuseColor = albedo.rgb / albedo.a;
+    specularColor = vec3(0.0);
+    shininess = 32.0;
+    normal = normalize(NormalToWorld * (normalDepth.xyz / albedo.a));
+    // depth 0..1 runs from the near to the far side of the bounding sphere, the quad is through its center
+    fragPos = FragPos - ViewAxis * ((normalDepth.w / albedo.a * 2.0 - 1.0) * boundingSphere.w);
+    vec4 clipPos = projection * view * vec4(fragPos, 1.0);
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+    return true;
+}
+#endif
+
 // calculates the color when using a directional light.
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 {
@@ -90,17 +221,17 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     if (blinn)
     {
         vec3 halfwayDir = normalize(lightDir + viewDir);  
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+        spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
     }
     else
     {
         vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+        spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
     }
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     return (ambient + diffuse + specular);
 }
 
@@ -115,20 +246,20 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     if (blinn)
     {
         vec3 halfwayDir = normalize(lightDir + viewDir);  
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+        spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
     }
     else
     {
         vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+        spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
     }
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -146,12 +277,12 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     if (blinn)
     {
         vec3 halfwayDir = normalize(lightDir + viewDir);  
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+        spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
     }
     else
     {
         vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+        spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
     }
     // attenuation
     float distance = length(light.position - fragPos);
@@ -161,19 +292,19 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
     return (ambient + diffuse + specular);
 }
 
-vec3 CalcFog(vec3 color)
+// 1 - no fog, 0 - only the sky colour
+float CalcFogFactor(vec3 fragPos)
 {
-    float distance = length(FragPos - viewPos);
+    float distance = length(fragPos - viewPos);
     float fogFactor = (fogDistance - distance) / fogDistance;
-    fogFactor = clamp(fogFactor, 0.0, 1.0);
-    return mix(skyColor, color, fogFactor);
+    return clamp(fogFactor, 0.0, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+#version 330 core
+// Shading LOD for objects small on screen (Scene::drawObjects): the light loop of fragment.fs runs per vertex
+// and is interpolated, fragment.fs with GOURAUD only applies the material and the fog
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 7) in uint aMaterial;
+#ifdef INSTANCED
+// rows of the instance's 3x4 world matrix
+layout (location = 8) in vec4 aModelRow0;
+layout (location = 9) in vec4 aModelRow1;
+layout (location = 10) in vec4 aModelRow2;
+#endif
+
+#ifdef BINDLESS
+// same blocks as fragment.fs, only the shininess is read here
+struct Material {
+    uvec2 diffuse;
+    uvec2 specular;
+    vec4 params;    // x - shininess
+};
+#else
+// Has to match MAX_MATERIALS in Material.h
+#define MAX_MATERIALS 256
+
+struct Material {
+    ivec4 layers;   // x - diffuse layer, y - specular layer
+    vec4 params;    // x - shininess
+};
+#endif
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+#define NR_POINT_LIGHTS 4
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out uint MaterialIndex;
+// the lights without the material colours, those are sampled per fragment
+out vec3 LightDiffuse;  // ambient and diffuse
+out vec3 LightSpecular;
+
+#ifdef BINDLESS
+layout (std430) buffer MaterialBuffer {
+    Material materials[];
+};
+#else
+layout (std140) uniform MaterialBlock {
+    Material materials[MAX_MATERIALS];
+};
+#endif
+
+#ifndef INSTANCED
+uniform mat4 model;
+// inverse transpose of mat3(model), only set when the scale is not uniform (see Shader::setModelMatrix)
+uniform mat3 normalMatrix;
+uniform bool uniformScale;
+#endif
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform vec3 viewPos;
+uniform DirLight dirLight;
+uniform PointLight pointLights[NR_POINT_LIGHTS];
+uniform SpotLight spotLight;
+uniform bool blinn;
+
+float shininess;
+
+// one light as in the Calc*Light functions of fragment.fs, scale is its attenuation and spot intensity
+void AddLight(vec3 ambient, vec3 diffuse, vec3 specular, vec3 lightDir, vec3 normal, vec3 viewDir, float scale)
+{
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = 0.0;
+    if (blinn)
+    {
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+    }
+    else
+    {
+        vec3 reflectDir = reflect(-lightDir, normal);
+        spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    }
+    LightDiffuse += (ambient + diffuse * diff) * scale;
+    LightSpecular += specular * spec * scale;
+}
+
+float Attenuation(vec3 lightPos, float constant, float linear, float quadratic)
+{
+    float separation = length(lightPos - FragPos);
+    return 1.0 / (constant + linear * separation + quadratic * (separation * separation));
+}
+
+void main()
+{
+#ifdef INSTANCED
+    mat4 model = transpose(mat4(aModelRow0, aModelRow1, aModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+#endif
+    FragPos = vec3(model * vec4(aPos, 1.0));
+#ifdef INSTANCED
+    // instances are translation * rotation * scale, so the inverse transpose of mat3(model)
+    // is every column divided by its squared length
+    mat3 linear = mat3(model);
+    mat3 normalMatrix = mat3(linear[0] / dot(linear[0], linear[0]),
+                             linear[1] / dot(linear[1], linear[1]),
+                             linear[2] / dot(linear[2], linear[2]));
+    Normal = normalMatrix * aNormal;
+#else
+    Normal = uniformScale ? mat3(model) * aNormal : normalMatrix * aNormal;
+#endif
+    TexCoords = aTexCoords;
+    MaterialIndex = aMaterial;
+    shininess = materials[aMaterial].params.x;
+
+    vec3 norm = normalize(Normal);
+    vec3 viewDir = normalize(viewPos - FragPos);
+    LightDiffuse = vec3(0.0);
+    LightSpecular = vec3(0.0);
+
+    AddLight(dirLight.ambient, dirLight.diffuse, dirLight.specular, normalize(-dirLight.direction), norm, viewDir, 1.0);
+
+    for (int i = 0; i < NR_POINT_LIGHTS; i++)
+    {
+        PointLight light = pointLights[i];
+        float attenuation = Attenuation(light.position, light.constant, light.linear, light.quadratic);
+        AddLight(light.ambient, light.diffuse, light.specular, normalize(light.position - FragPos), norm, viewDir, attenuation);
+    }
+
+    vec3 spotDir = normalize(spotLight.position - FragPos);
+    float theta = dot(spotDir, normalize(-spotLight.direction));
+    float epsilon = spotLight.cutOff - spotLight.outerCutOff;
+    float intensity = clamp((theta - spotLight.outerCutOff) / epsilon, 0.0, 1.0);
+    float attenuation = Attenuation(spotLight.position, spotLight.constant, spotLight.linear, spotLight.quadratic);
+    AddLight(spotLight.ambient, spotLight.diffuse, spotLight.specular, spotDir, norm, viewDir, attenuation * intensity);
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
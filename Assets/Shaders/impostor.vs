@@ -0,0 +1,72 @@
+#version 330 core
+// Far field impostor of a whole model (ImpostorBaker.h): one camera facing quad per instance through the
+// model's bounding sphere, fragment.fs with IMPOSTOR blends the baked frames closest to the view direction
+// rows of the instance's 3x4 world matrix
+layout (location = 8) in vec4 aModelRow0;
+layout (location = 9) in vec4 aModelRow1;
+layout (location = 10) in vec4 aModelRow2;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out uint MaterialIndex;
+// view direction on the frame grid, frame (x, y) is centered at (x, y)
+flat out vec2 FrameCoords;
+// object to world for the baked normals
+flat out mat3 NormalToWorld;
+// object space view direction in world space, the baked depth moves the quad along it
+flat out vec3 ViewAxis;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 viewPos;
+// object space, the frames were fitted to it
+uniform vec4 boundingSphere;
+uniform int impostorFrames;
+
+const vec2 corners[4] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0));
+
+// octahedral mapping of a unit direction to [-1, 1]^2, y is the up axis (ImpostorBaker::octahedralDecode)
+vec2 octahedralEncode(vec3 direction)
+{
+    vec2 p = direction.xz / (abs(direction.x) + abs(direction.y) + abs(direction.z));
+    if (direction.y < 0.0)
+    {
+        vec2 signs = vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+        p = (1.0 - abs(p.yx)) * signs;
+    }
+    return p;
+}
+
+// ImpostorBaker::getFrameBasis
+void frameBasis(vec3 direction, out vec3 right, out vec3 up)
+{
+    vec3 reference = abs(direction.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+    right = normalize(cross(reference, direction));
+    up = cross(direction, right);
+}
+
+void main()
+{
+    mat4 model = transpose(mat4(aModelRow0, aModelRow1, aModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+    mat3 linear = mat3(model);
+    vec3 center = vec3(model * vec4(boundingSphere.xyz, 1.0));
+    vec3 direction = normalize(inverse(linear) * (viewPos - center));
+
+    vec3 right, up;
+    frameBasis(direction, right, up);
+    vec2 corner = corners[gl_VertexID];
+    FragPos = vec3(model * vec4(boundingSphere.xyz + (right * corner.x + up * corner.y) * boundingSphere.w, 1.0));
+
+    // same normal matrix as the instanced vertex.vs
+    NormalToWorld = mat3(linear[0] / dot(linear[0], linear[0]),
+                         linear[1] / dot(linear[1], linear[1]),
+                         linear[2] / dot(linear[2], linear[2]));
+    Normal = NormalToWorld * direction;
+    ViewAxis = linear * direction;
+    FrameCoords = (octahedralEncode(direction) * 0.5 + 0.5) * float(impostorFrames) - 0.5;
+    TexCoords = corner * 0.5 + 0.5;
+    MaterialIndex = 0u;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
@@ -1,25 +1,40 @@
 #version 330 core
 out vec4 FragColor;
 
-in vec3 FragPos;
+// view space, from lightImpostor.vs
+in vec3 QuadPos;
+flat in vec3 SphereCenter;
+flat in float SphereRadius;
+flat in vec3 LightColor;
 
-uniform vec3 viewPos;
+uniform mat4 projection;
 uniform vec3 skyColor;
 uniform float fogDistance;
-uniform vec3 lightColor;
 
-vec3 CalcFog(vec3 color);
+vec3 CalcFog(vec3 color, float distance);
 
 void main()
 {
-    vec3 result = CalcFog(lightColor);
+    // ray from the camera, the view space origin, through this pixel of the quad
+    vec3 direction = normalize(QuadPos);
+    float b = dot(direction, SphereCenter);
+    float c = dot(SphereCenter, SphereCenter) - SphereRadius * SphereRadius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0)
+        discard;
+
+    // nearest hit, its depth replaces the depth of the quad
+    float t = b - sqrt(discriminant);
+    vec4 clip = projection * vec4(direction * t, 1.0);
+    gl_FragDepth = (clip.z / clip.w) * 0.5 + 0.5;
+
+    vec3 result = CalcFog(LightColor, t);
 
     FragColor = vec4(result, 1.0);
 }
 
-vec3 CalcFog(vec3 color)
+vec3 CalcFog(vec3 color, float distance)
 {
-    float distance = length(FragPos - viewPos);
     float fogFactor = (fogDistance - distance) / fogDistance;
     fogFactor = clamp(fogFactor, 0.0, 1.0);
     return mix(skyColor, color, fogFactor);
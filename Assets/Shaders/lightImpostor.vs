@@ -0,0 +1,44 @@
+#version 330 core
+// one instance per light (see LightGizmos.h), xyz - position, w - radius
+layout (location = 0) in vec4 aSphere;
+layout (location = 1) in vec3 aColor;
+
+// view space, lightFragment.fs traces the sphere through every pixel of the quad
+out vec3 QuadPos;
+flat out vec3 SphereCenter;
+flat out float SphereRadius;
+flat out vec3 LightColor;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    // triangle strip corners, no vertex buffer needed
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+    vec3 center = vec3(view * vec4(aSphere.xyz, 1.0));
+    float radius = aSphere.w;
+    float distance = length(center);
+    SphereCenter = center;
+    SphereRadius = radius;
+    LightColor = aColor;
+
+    // the camera is inside the sphere, the quad collapses and nothing is drawn
+    if (distance <= radius)
+    {
+        QuadPos = vec3(0.0);
+        gl_Position = vec4(0.0);
+        return;
+    }
+
+    // quad through the center, perpendicular to the ray towards it and just covering the silhouette,
+    // the cone of rays touching the sphere opens by radius / sqrt(distance^2 - radius^2)
+    vec3 axis = center / distance;
+    vec3 right = normalize(cross(axis, abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 up = cross(right, axis);
+    float halfSize = radius * distance / sqrt(distance * distance - radius * radius);
+
+    QuadPos = center + (corner.x * right + corner.y * up) * halfSize;
+    gl_Position = projection * vec4(QuadPos, 1.0);
+}
\ No newline at end of file
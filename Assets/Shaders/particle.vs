@@ -0,0 +1,53 @@
+#version 430 core
+// One camera facing quad per live particle (see ParticleSystem.h), drawn with an indirect instanced strip.
+// The instance picks the particle from the alive list, or from the sorted entries when blending needs them.
+struct Particle
+{
+    vec4 position; // xyz, w - age in seconds
+    vec4 velocity; // xyz, w - lifetime in seconds
+    vec4 color;    // rgb, a - opacity, 0 blends additively
+    vec4 shape;    // x - start size, y - end size, z - gravity scale, w - drag
+};
+
+layout (std430) readonly buffer ParticlePool {
+    Particle particles[];
+};
+layout (std430) readonly buffer ParticleLists {
+    uint alive[];
+};
+layout (std430) readonly buffer ParticleSort {
+    uvec2 entries[];
+};
+
+// view space, particleFragment.fs fogs by the distance
+out vec3 QuadPos;
+out vec2 Corner;
+// premultiplied colour, alpha 0 for additive particles
+flat out vec4 ParticleColor;
+
+uniform mat4 view;
+uniform mat4 projection;
+// first entry of the alive list to draw
+uniform uint listOffset;
+uniform bool sorted;
+
+void main()
+{
+    // triangle strip corners, no vertex buffer needed
+    Corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+    uint index = sorted ? entries[gl_InstanceID].y : alive[listOffset + uint(gl_InstanceID)];
+    Particle particle = particles[index];
+    float age = clamp(particle.position.w / particle.velocity.w, 0.0, 1.0);
+    float size = mix(particle.shape.x, particle.shape.y, age);
+
+    // blended particles fade out, additive ones cool down
+    float fade = (1.0 - age) * (1.0 - age);
+    ParticleColor = particle.color.a > 0.0
+        ? vec4(particle.color.rgb * particle.color.a * fade, particle.color.a * fade)
+        : vec4(particle.color.rgb * fade, 0.0);
+
+    vec3 center = vec3(view * vec4(particle.position.xyz, 1.0));
+    QuadPos = center + vec3(Corner * size, 0.0);
+    gl_Position = projection * vec4(QuadPos, 1.0);
+}
\ No newline at end of file
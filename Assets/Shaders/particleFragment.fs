@@ -0,0 +1,30 @@
+#version 330 core
+out vec4 FragColor;
+
+// view space, from particle.vs
+in vec3 QuadPos;
+in vec2 Corner;
+flat in vec4 ParticleColor;
+
+uniform vec3 skyColor;
+uniform float fogDistance;
+
+vec4 CalcFog(vec4 color, float distance);
+
+void main()
+{
+    // round soft sprite
+    float falloff = 1.0 - dot(Corner, Corner);
+    if (falloff <= 0.0)
+        discard;
+
+    FragColor = CalcFog(ParticleColor * falloff, length(QuadPos));
+}
+
+// same fog as lightFragment.fs on premultiplied colours: blended particles turn into the sky, additive ones fade
+vec4 CalcFog(vec4 color, float distance)
+{
+    float fogFactor = (fogDistance - distance) / fogDistance;
+    fogFactor = clamp(fogFactor, 0.0, 1.0);
+    return vec4(color.rgb * fogFactor + skyColor * color.a * (1.0 - fogFactor), color.a);
+}
\ No newline at end of file
@@ -0,0 +1,261 @@
+#version 430 core
+layout (local_size_x = 256) in;
+
+// GPU particles, one pass per dispatch (see ParticleSystem.h). Particles live in a fixed pool, the free ones on
+// a dead stack and the live ones on two alive lists which swap every frame: the simulation reads the current
+// list and compacts the survivors into the next one, then the emission pops dead particles onto it too.
+// The counters and the indirect dispatch and draw arguments stay in ParticleState, so the CPU never sees a particle.
+#define PASS_RESET 0
+#define PASS_PREPARE 1
+#define PASS_SIMULATE 2
+#define PASS_EMIT 3
+#define PASS_FINISH 4
+#define PASS_SORT_KEYS 5
+#define PASS_SORT_GLOBAL 6
+#define PASS_SORT_LOCAL 7
+
+#define MAX_EMITTERS 16
+#define GROUP_SIZE 256
+
+struct Particle
+{
+    vec4 position; // xyz, w - age in seconds
+    vec4 velocity; // xyz, w - lifetime in seconds
+    vec4 color;    // rgb, a - opacity, 0 blends additively
+    vec4 shape;    // x - start size, y - end size, z - gravity scale, w - drag
+};
+
+layout (std430) buffer ParticlePool {
+    Particle particles[];
+};
+// alive list 0 followed by alive list 1, capacity entries each
+layout (std430) buffer ParticleLists {
+    uint alive[];
+};
+layout (std430) buffer ParticleDead {
+    uint dead[];
+};
+layout (std430) buffer ParticleState {
+    uint aliveCount[2];
+    uint deadCount;
+    uint emitCount;
+    uvec4 emitDispatch;     // xyz - group counts
+    uvec4 simulateDispatch;
+    uvec4 drawArgs;         // vertex count, instance count, first vertex, base instance
+    uvec4 sortDispatch;     // xyz - group counts, w - sorted entries, the alive count rounded up to a power of two
+};
+// x - sort key, y - particle, in back to front order once sorted
+layout (std430) buffer ParticleSort {
+    uvec2 entries[];
+};
+
+uniform int pass;
+uniform uint capacity;
+// alive list read this frame, the survivors and new particles go to the other one
+uniform uint current;
+uniform float deltaTime;
+uniform uint seed;
+uniform vec3 gravity;
+uniform vec3 wind;
+uniform vec3 viewPos;
+
+// emitters of this frame, emitterFirst holds the running sum of their emitted particles
+uniform int emitterCount;
+uniform uint emitterFirst[MAX_EMITTERS + 1];
+uniform vec4 emitterPosition[MAX_EMITTERS]; // xyz, w - radius of the spawn sphere
+uniform vec4 emitterVelocity[MAX_EMITTERS]; // xyz, w - random speed added in any direction
+uniform vec4 emitterColor[MAX_EMITTERS];
+uniform vec4 emitterShape[MAX_EMITTERS];
+uniform vec2 emitterLife[MAX_EMITTERS];     // shortest and longest lifetime
+
+// bitonic sort step, size of the sorted sequences and distance of the compared entries. Steps for sequences
+// longer than sortDispatch.w have nothing to do
+uniform uint sortSequence;
+uniform uint sortDistance;
+
+shared uvec2 localEntries[GROUP_SIZE];
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state) / 4294967295.0;
+}
+
+vec3 randomDirection(inout uint state)
+{
+    float z = random(state) * 2.0 - 1.0;
+    float angle = random(state) * 6.2831853;
+    float r = sqrt(max(1.0 - z * z, 0.0));
+    return vec3(r * cos(angle), r * sin(angle), z);
+}
+
+void simulate(uint i)
+{
+    uint index = alive[current * capacity + i];
+    Particle particle = particles[index];
+    particle.position.w += deltaTime;
+    if (particle.position.w >= particle.velocity.w)
+    {
+        dead[atomicAdd(deadCount, 1u)] = index;
+        return;
+    }
+
+    vec3 velocity = particle.velocity.xyz + (gravity * particle.shape.z + wind * particle.shape.w) * deltaTime;
+    velocity *= exp(-particle.shape.w * deltaTime);
+    vec3 position = particle.position.xyz + velocity * deltaTime;
+    // the floor is at y = 0, sparks bounce off it
+    if (position.y < 0.0 && velocity.y < 0.0)
+    {
+        position.y = 0.0;
+        velocity.y *= -0.4;
+        velocity.xz *= 0.7;
+    }
+    particle.position.xyz = position;
+    particle.velocity.xyz = velocity;
+    particles[index] = particle;
+
+    uint next = 1u - current;
+    alive[next * capacity + atomicAdd(aliveCount[next], 1u)] = index;
+}
+
+void emit(uint i)
+{
+    int emitter = 0;
+    while (emitter + 1 < emitterCount && i >= emitterFirst[emitter + 1])
+        emitter++;
+
+    uint state = hash(i ^ hash(seed));
+    Particle particle;
+    vec3 offset = randomDirection(state) * emitterPosition[emitter].w * random(state);
+    particle.position = vec4(emitterPosition[emitter].xyz + offset, 0.0);
+    vec3 velocity = emitterVelocity[emitter].xyz + randomDirection(state) * emitterVelocity[emitter].w * random(state);
+    particle.velocity = vec4(velocity, mix(emitterLife[emitter].x, emitterLife[emitter].y, random(state)));
+    particle.color = emitterColor[emitter];
+    particle.shape = emitterShape[emitter];
+
+    // emitCount is at most the dead particles left by the previous frame
+    uint index = dead[atomicAdd(deadCount, 0xffffffffu) - 1u];
+    particles[index] = particle;
+    uint next = 1u - current;
+    alive[next * capacity + atomicAdd(aliveCount[next], 1u)] = index;
+}
+
+void compareExchange(uint i, uint distance, uint sequence)
+{
+    uint other = i ^ distance;
+    if (other <= i)
+        return;
+    uvec2 a = entries[i];
+    uvec2 b = entries[other];
+    bool ascending = (i & sequence) == 0u;
+    if ((a.x > b.x) == ascending)
+    {
+        entries[i] = b;
+        entries[other] = a;
+    }
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+
+    if (pass == PASS_RESET)
+    {
+        if (i < capacity)
+            dead[i] = i;
+        if (i == 0u)
+        {
+            aliveCount[0] = 0u;
+            aliveCount[1] = 0u;
+            deadCount = capacity;
+            drawArgs = uvec4(4u, 0u, 0u, 0u);
+            sortDispatch = uvec4(1u, 1u, 1u, GROUP_SIZE);
+        }
+    }
+    else if (pass == PASS_PREPARE)
+    {
+        if (i == 0u)
+        {
+            emitCount = min(emitterFirst[emitterCount], deadCount);
+            emitDispatch = uvec4((emitCount + GROUP_SIZE - 1u) / GROUP_SIZE, 1u, 1u, 0u);
+            simulateDispatch = uvec4((aliveCount[current] + GROUP_SIZE - 1u) / GROUP_SIZE, 1u, 1u, 0u);
+            aliveCount[1u - current] = 0u;
+        }
+    }
+    else if (pass == PASS_SIMULATE)
+    {
+        if (i < aliveCount[current])
+            simulate(i);
+    }
+    else if (pass == PASS_EMIT)
+    {
+        if (i < emitCount)
+            emit(i);
+    }
+    else if (pass == PASS_FINISH)
+    {
+        if (i == 0u)
+        {
+            uint count = aliveCount[1u - current];
+            drawArgs.y = count;
+            // the local sort pass needs whole groups
+            uint sortSize = GROUP_SIZE;
+            while (sortSize < count)
+                sortSize <<= 1;
+            sortDispatch = uvec4(sortSize / GROUP_SIZE, 1u, 1u, sortSize);
+        }
+    }
+    else if (pass == PASS_SORT_KEYS)
+    {
+        // back to front is ascending inverted distance, the unused entries go last
+        uint next = 1u - current;
+        if (i < aliveCount[next])
+        {
+            uint index = alive[next * capacity + i];
+            entries[i] = uvec2(~floatBitsToUint(distance(particles[index].position.xyz, viewPos)), index);
+        }
+        else
+            entries[i] = uvec2(0xffffffffu, 0u);
+    }
+    else if (pass == PASS_SORT_GLOBAL)
+    {
+        if (sortSequence <= sortDispatch.w)
+            compareExchange(i, sortDistance, sortSequence);
+    }
+    else if (pass == PASS_SORT_LOCAL)
+    {
+        // every step from sortDistance down stays inside the group, so they all run in shared memory
+        if (sortSequence > sortDispatch.w)
+            return;
+        uint local = gl_LocalInvocationID.x;
+        localEntries[local] = entries[i];
+        for (uint distance = sortDistance; distance > 0u; distance >>= 1)
+        {
+            barrier();
+            uint other = local ^ distance;
+            if (other > local)
+            {
+                uvec2 a = localEntries[local];
+                uvec2 b = localEntries[other];
+                bool ascending = (i & sortSequence) == 0u;
+                if ((a.x > b.x) == ascending)
+                {
+                    localEntries[local] = b;
+                    localEntries[other] = a;
+                }
+            }
+        }
+        barrier();
+        entries[i] = localEntries[local];
+    }
+}
\ No newline at end of file
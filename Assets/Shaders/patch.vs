@@ -0,0 +1,13 @@
+#version 400 core
+layout (location = 0) in vec3 aPos;
+
+// object space, tessControl.tcs (PATCH_OBJECTS) places the control points of every patch
+out vec3 FragPos;
+flat out uint MaterialIndex;
+
+void main()
+{
+    FragPos = aPos;
+    MaterialIndex = 0u;
+    gl_Position = vec4(aPos, 1.0);
+}
\ No newline at end of file
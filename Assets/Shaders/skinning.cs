@@ -0,0 +1,76 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+// Linear blend skinning of a model's merged vertices (see SkinningSystem.h). Vertices are read and written as
+// raw floats in the layout of the C++ Vertex struct, so the output is drawn with the model's own vertex layout
+// and every pass reuses it.
+#define VERTEX_FLOATS 22
+#define POSITION 0
+#define NORMAL 3
+#define TEX_COORDS 6
+#define TANGENT 8
+#define BITANGENT 11
+#define BONE_IDS 14
+#define WEIGHTS 18
+
+layout (std430) readonly buffer SkinSource {
+    float source[];
+};
+// skinning matrices of all instances, this dispatch uses the ones from paletteOffset on
+layout (std430) readonly buffer SkinPalette {
+    mat4 bones[];
+};
+layout (std430) writeonly buffer SkinOutput {
+    float outputs[];
+};
+
+uniform int vertexCount;
+uniform int paletteOffset;
+uniform int boneCount;
+
+vec3 readVec3(int base)
+{
+    return vec3(source[base], source[base + 1], source[base + 2]);
+}
+
+void writeVec3(int base, vec3 value)
+{
+    outputs[base] = value.x;
+    outputs[base + 1] = value.y;
+    outputs[base + 2] = value.z;
+}
+
+void main()
+{
+    int index = int(gl_GlobalInvocationID.x);
+    if (index >= vertexCount)
+        return;
+    int base = index * VERTEX_FLOATS;
+
+    mat4 skin = mat4(0.0);
+    float total = 0.0;
+    for (int k = 0; k < 4; k++)
+    {
+        int bone = floatBitsToInt(source[base + BONE_IDS + k]);
+        float weight = source[base + WEIGHTS + k];
+        if (bone < 0 || bone >= boneCount)
+            continue;
+        skin += bones[paletteOffset + bone] * weight;
+        total += weight;
+    }
+    // vertices without bones follow the model
+    if (total <= 0.0)
+        skin = mat4(1.0);
+    else
+        skin /= total;
+    mat3 linear = mat3(skin);
+
+    writeVec3(base + POSITION, vec3(skin * vec4(readVec3(base + POSITION), 1.0)));
+    writeVec3(base + NORMAL, normalize(linear * readVec3(base + NORMAL)));
+    writeVec3(base + TANGENT, linear * readVec3(base + TANGENT));
+    writeVec3(base + BITANGENT, linear * readVec3(base + BITANGENT));
+    for (int k = TEX_COORDS; k < TANGENT; k++)
+        outputs[base + k] = source[base + k];
+    for (int k = BONE_IDS; k < VERTEX_FLOATS; k++)
+        outputs[base + k] = source[base + k];
+}
\ No newline at end of file
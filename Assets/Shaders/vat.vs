@@ -0,0 +1,58 @@
+#version 330 core
+// Crowd instances animated from vertex animation textures (see VertexAnimationBaker.h), the rest pose
+// attributes only give the texture coordinates and gl_VertexID picks the vertex in the textures
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 7) in uint aMaterial;
+// rows of the instance's 3x4 world matrix
+layout (location = 8) in vec4 aModelRow0;
+layout (location = 9) in vec4 aModelRow1;
+layout (location = 10) in vec4 aModelRow2;
+// x - time offset in seconds, y - playback speed
+layout (location = 11) in vec2 aAnimation;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out uint MaterialIndex;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform sampler2D vatPositions;
+uniform sampler2D vatNormals;
+uniform int vatWidth;
+uniform int vatRowsPerFrame;
+uniform int vatFrames;
+uniform float vatFrameRate;
+uniform float animationTime;
+
+ivec2 texelOf(int vertex, int frame)
+{
+    return ivec2(vertex % vatWidth, frame * vatRowsPerFrame + vertex / vatWidth);
+}
+
+void main()
+{
+    // the clip loops, so the last frame blends into the first
+    float frame = mod((animationTime * aAnimation.y + aAnimation.x) * vatFrameRate, float(vatFrames));
+    int frame0 = min(int(frame), vatFrames - 1);
+    int frame1 = (frame0 + 1) % vatFrames;
+    float blend = frame - float(frame0);
+    vec3 position = mix(texelFetch(vatPositions, texelOf(gl_VertexID, frame0), 0).xyz,
+                        texelFetch(vatPositions, texelOf(gl_VertexID, frame1), 0).xyz, blend);
+    vec3 normal = mix(texelFetch(vatNormals, texelOf(gl_VertexID, frame0), 0).xyz,
+                      texelFetch(vatNormals, texelOf(gl_VertexID, frame1), 0).xyz, blend);
+
+    mat4 model = transpose(mat4(aModelRow0, aModelRow1, aModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+    FragPos = vec3(model * vec4(position, 1.0));
+    // same normal matrix as the instanced path of vertex.vs
+    mat3 linear = mat3(model);
+    mat3 normalMatrix = mat3(linear[0] / dot(linear[0], linear[0]),
+                             linear[1] / dot(linear[1], linear[1]),
+                             linear[2] / dot(linear[2], linear[2]));
+    Normal = normalMatrix * normal;
+    TexCoords = aTexCoords;
+    MaterialIndex = aMaterial;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,154 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+// Scatters one vegetation layer over the floor (see VegetationScatter.h). A work group is one tile of the floor:
+// its candidates are generated from a hash of the tile and their index, so a tile always grows the same plants
+// wherever the camera is. The tile is culled as a whole first, then every candidate by distance and frustum,
+// and the survivors are appended to the instance buffer. The first draw command counts them, FINISH copies
+// the count to the commands of the other meshes.
+#define PASS_RESET 0
+#define PASS_SCATTER 1
+#define PASS_FINISH 2
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+// AffineRecord rows, three per instance
+layout (std430) buffer VegetationInstances {
+    vec4 rows[];
+};
+layout (std430) buffer VegetationCommands {
+    DrawCommand commands[];
+};
+
+uniform int pass;
+uniform int commandCount;
+uniform uint maxInstances;
+uniform uint seed;
+
+// tiles of the scattered area, the dispatch covers tilesX columns starting at tile (firstTileX, firstTileZ)
+uniform vec2 areaMin;
+uniform vec2 areaMax;
+uniform float tileSize;
+uniform int firstTileX;
+uniform int firstTileZ;
+uniform int tilesX;
+uniform int instancesPerTile;
+uniform float groundHeight;
+
+// planes of the culling frustum, xyz inward normal, w distance
+uniform vec4 frustumPlanes[6];
+uniform vec3 viewPos;
+// candidates thin out from fadeStart to maxDistance so the edge of the layer does not pop
+uniform float maxDistance;
+uniform float fadeStart;
+
+uniform vec2 scaleRange;      // uniform scale, smallest and largest
+uniform vec2 heightRange;     // y scale relative to the uniform scale, smallest and largest
+uniform float maxTilt;        // radians away from the up axis
+uniform vec4 bounds;          // model space bounding sphere at scale 1
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state) / 4294967295.0;
+}
+
+bool insideFrustum(vec3 center, float radius)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if (dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w < -radius)
+            return false;
+    }
+    return true;
+}
+
+// translation * yaw * tilt * scale
+mat4 instanceMatrix(vec3 position, float yaw, float tilt, vec3 scale)
+{
+    float cy = cos(yaw), sy = sin(yaw);
+    float ct = cos(tilt), st = sin(tilt);
+    mat3 rotationY = mat3(cy, 0.0, -sy, 0.0, 1.0, 0.0, sy, 0.0, cy);
+    mat3 rotationX = mat3(1.0, 0.0, 0.0, 0.0, ct, st, 0.0, -st, ct);
+    mat3 linear = rotationY * rotationX;
+    return mat4(vec4(linear[0] * scale.x, 0.0), vec4(linear[1] * scale.y, 0.0), vec4(linear[2] * scale.z, 0.0), vec4(position, 1.0));
+}
+
+void scatter()
+{
+    ivec2 tile = ivec2(firstTileX, firstTileZ) + ivec2(int(gl_WorkGroupID.x) % tilesX, int(gl_WorkGroupID.x) / tilesX);
+    vec2 tileMin = vec2(tile) * tileSize;
+    // every invocation of the group reaches the same verdict for the tile
+    float largest = scaleRange.y * max(heightRange.y, 1.0);
+    float plantRadius = (length(bounds.xyz) + bounds.w) * largest;
+    vec3 tileCenter = vec3(tileMin.x + 0.5 * tileSize, groundHeight + plantRadius * 0.5, tileMin.y + 0.5 * tileSize);
+    float tileRadius = length(vec2(0.5 * tileSize)) + plantRadius;
+    if (length(tileCenter - viewPos) - tileRadius > maxDistance || !insideFrustum(tileCenter, tileRadius))
+        return;
+
+    uint tileSeed = hash(uint(tile.x) * 73856093u ^ uint(tile.y) * 19349663u ^ seed);
+    for (int i = int(gl_LocalInvocationID.x); i < instancesPerTile; i += int(gl_WorkGroupSize.x))
+    {
+        uint state = hash(tileSeed + uint(i));
+        vec2 ground = tileMin + vec2(random(state), random(state)) * tileSize;
+        float keep = random(state);
+        if (any(lessThan(ground, areaMin)) || any(greaterThanEqual(ground, areaMax)))
+            continue;
+        vec3 position = vec3(ground.x, groundHeight, ground.y);
+        float distanceToView = length(position - viewPos);
+        if (keep >= 1.0 - smoothstep(fadeStart * maxDistance, maxDistance, distanceToView))
+            continue;
+
+        float size = mix(scaleRange.x, scaleRange.y, random(state));
+        vec3 scale = vec3(size, size * mix(heightRange.x, heightRange.y, random(state)), size);
+        float yaw = random(state) * 6.2831853;
+        float tilt = random(state) * maxTilt;
+        mat4 model = instanceMatrix(position, yaw, tilt, scale);
+        vec3 center = vec3(model * vec4(bounds.xyz, 1.0));
+        if (!insideFrustum(center, bounds.w * max(scale.x, scale.y)))
+            continue;
+
+        uint slot = atomicAdd(commands[0].instanceCount, 1u);
+        if (slot >= maxInstances)
+            continue;
+        for (int row = 0; row < 3; row++)
+            rows[slot * 3u + uint(row)] = vec4(model[0][row], model[1][row], model[2][row], model[3][row]);
+    }
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+
+    if (pass == PASS_RESET)
+    {
+        if (i < uint(commandCount))
+            commands[i].instanceCount = 0u;
+    }
+    else if (pass == PASS_SCATTER)
+        scatter();
+    else if (pass == PASS_FINISH)
+    {
+        // the counter ran past the buffer when it was full
+        uint count = min(commands[0].instanceCount, maxInstances);
+        if (i < uint(commandCount))
+            commands[i].instanceCount = count;
+    }
+}
\ No newline at end of file
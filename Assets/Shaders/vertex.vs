@@ -2,20 +2,47 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 7) in uint aMaterial;
+#ifdef INSTANCED
+// rows of the instance's 3x4 world matrix
+layout (location = 8) in vec4 aModelRow0;
+layout (location = 9) in vec4 aModelRow1;
+layout (location = 10) in vec4 aModelRow2;
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+flat out uint MaterialIndex;
 
+#ifndef INSTANCED
 uniform mat4 model;
+// inverse transpose of mat3(model), only set when the scale is not uniform (see Shader::setModelMatrix)
+uniform mat3 normalMatrix;
+uniform bool uniformScale;
+#endif
 uniform mat4 view;
 uniform mat4 projection;
 
 void main()
 {
+#ifdef INSTANCED
+    mat4 model = transpose(mat4(aModelRow0, aModelRow1, aModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+#endif
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+#ifdef INSTANCED
+    // instances are translation * rotation * scale, so the inverse transpose of mat3(model)
+    // is every column divided by its squared length
+    mat3 linear = mat3(model);
+    mat3 normalMatrix = mat3(linear[0] / dot(linear[0], linear[0]),
+                             linear[1] / dot(linear[1], linear[1]),
+                             linear[2] / dot(linear[2], linear[2]));
+    Normal = normalMatrix * aNormal;
+#else
+    Normal = uniformScale ? mat3(model) * aNormal : normalMatrix * aNormal;
+#endif
     TexCoords = aTexCoords;
+    MaterialIndex = aMaterial;
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,177 @@
+// Checks the cloth solvers (ClothSolver.h, cloth.cs) and times them at 128x128 particles.
+// Build with -DBUILD_BENCHMARKS=ON, run the ClothBenchmark target in Release from the repository root so
+// Assets/Shaders/cloth.cs is found. Without a 4.3 context the GPU checks are skipped. Returns 1 if a check fails.
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "../Source/Cloth.h"
+#include "../Source/ClothSolver.h"
+#include "../Source/ComputeShader.h"
+#include "../Source/GLExtensions.h"
+#include "../Source/JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const int RESOLUTION = 128;
+const float CLOTH_SIZE = 3.0f;
+const glm::vec3 ORIGIN = glm::vec3(-7.0f, 2.0f, 9.0f);
+const float FRAME_TIME = 1.0f / 60.0f;
+const int SETTLE_FRAMES = 120;
+const int REPEATS = 10;
+// the solvers only differ in rounding and in the shader's sin, a few frames must stay this close
+const int AGREEMENT_FRAMES = 10;
+const float AGREEMENT_TOLERANCE = 1e-3f * CLOTH_SIZE;
+const float GPU_BUDGET_MS = 1.0f;
+
+int failures = 0;
+
+void check(const std::string& name, bool passed, const std::string& detail)
+{
+    std::cout << (passed ? "PASS " : "FAIL ") << name << ": " << detail << std::endl;
+    if (!passed)
+        failures++;
+}
+
+template <typename Fn>
+double measureMs(Fn fn)
+{
+    double best = 1e30;
+    for (int i = 0; i < REPEATS; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        best = std::min(best, ms);
+    }
+    return best;
+}
+
+float maxDifference(const std::vector<glm::vec4>& a, const std::vector<glm::vec4>& b)
+{
+    float difference = 0.0f;
+    for (size_t i = 0; i < a.size() && i < b.size(); i++)
+        difference = std::max(difference, glm::length(glm::vec3(a[i]) - glm::vec3(b[i])));
+    return difference;
+}
+
+void checkCpu(const ClothSettings& settings)
+{
+    ClothSolver solver;
+    solver.create(RESOLUTION, CLOTH_SIZE, ORIGIN);
+    const std::vector<glm::vec4> rest = solver.getPositions();
+    const float timeStep = FRAME_TIME / (float)settings.substeps;
+    for (int frame = 0; frame < SETTLE_FRAMES; frame++)
+        solver.simulate(settings, timeStep);
+
+    // the column at x = 0 must not have moved at all
+    const std::vector<glm::vec4>& positions = solver.getPositions();
+    float pinnedDrift = 0.0f;
+    for (int y = 0; y < RESOLUTION; y++)
+    {
+        const size_t index = (size_t)y * RESOLUTION;
+        pinnedDrift = std::max(pinnedDrift, glm::length(glm::vec3(positions[index]) - glm::vec3(rest[index])));
+    }
+    check("pinned column", pinnedDrift == 0.0f, "drift " + std::to_string(pinnedDrift));
+
+    // one substep of the settled cloth, the iterations have to take out what the integration stretched
+    solver.integrate(settings, timeStep);
+    const float integrated = solver.constraintResidual();
+    float last = integrated;
+    std::string residuals = std::to_string(integrated);
+    for (int i = 0; i < settings.iterations; i++)
+    {
+        solver.constrain(settings);
+        last = solver.constraintResidual();
+        residuals += " " + std::to_string(last);
+    }
+    check("constraint residual", last < integrated, residuals);
+
+    solver.reset();
+    for (int frame = 0; frame < SETTLE_FRAMES; frame++)
+        solver.simulate(settings, timeStep);
+    const double cpuMs = measureMs([&] { solver.simulate(settings, timeStep); });
+    std::cout << "CPU solver: " << cpuMs << " ms per frame on " << JobSystem::instance().getThreadCount() << " threads" << std::endl;
+}
+
+// hidden window for a 4.3 context, null if there is none
+GLFWwindow* createContext()
+{
+    if (!glfwInit())
+        return nullptr;
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "ClothBenchmark", NULL, NULL);
+    if (!window)
+        return nullptr;
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        return nullptr;
+    GLCaps::instance().load((GLADloadproc)glfwGetProcAddress);
+    return window;
+}
+
+void checkGpu(const ClothSettings& settings)
+{
+    GLFWwindow* window = createContext();
+    if (!window || !Cloth::supportsGpu())
+    {
+        std::cout << "SKIP GPU checks: no 4.3 context with compute shaders" << std::endl;
+        glfwTerminate();
+        return;
+    }
+
+    {
+        ComputeShader computeShader("Assets/Shaders/cloth.cs");
+        Cloth::setupShader(computeShader);
+        Cloth cloth;
+        cloth.settings = settings;
+        cloth.create(RESOLUTION, CLOTH_SIZE, ORIGIN);
+
+        ClothSolver solver;
+        solver.create(RESOLUTION, CLOTH_SIZE, ORIGIN);
+        const float timeStep = FRAME_TIME / (float)settings.substeps;
+        std::vector<glm::vec4> gpuPositions;
+        float difference = 0.0f;
+        for (int frame = 0; frame < AGREEMENT_FRAMES; frame++)
+        {
+            cloth.simulate(&computeShader, FRAME_TIME);
+            solver.simulate(settings, timeStep);
+            cloth.readPositions(gpuPositions);
+            difference = std::max(difference, maxDifference(gpuPositions, solver.getPositions()));
+        }
+        check("CPU and GPU agree", difference <= AGREEMENT_TOLERANCE, "max difference " + std::to_string(difference));
+
+        // the cloth reads its query a frame late, finishing every frame makes it available
+        float gpuMs = 1e30f;
+        for (int frame = 0; frame <= REPEATS; frame++)
+        {
+            cloth.simulate(&computeShader, FRAME_TIME);
+            glFinish();
+            if (frame > 0)
+                gpuMs = std::min(gpuMs, cloth.lastGpuMs);
+        }
+        check("GPU solver under " + std::to_string(GPU_BUDGET_MS) + " ms", gpuMs < GPU_BUDGET_MS,
+            std::to_string(gpuMs) + " ms per frame");
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+}
+
+int main()
+{
+    const ClothSettings settings;
+    std::cout << RESOLUTION << "x" << RESOLUTION << " particles, " << settings.substeps << " substeps, "
+        << settings.iterations << " iterations" << std::endl;
+    checkCpu(settings);
+    checkGpu(settings);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+// Checks that the patches of SubdivisionSurface meet without cracks and times buildPatches per level.
+// Build with -DBUILD_BENCHMARKS=ON, run the SubdivisionBenchmark target in Release from the repository root so
+// Assets/Objects/cages/box.obj is found. Returns 1 if a check fails.
+
+#include <glm/glm.hpp>
+
+#include "../Source/SubdivisionSurface.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const int MAX_LEVEL = 5;
+const int REPEATS = 10;
+// boundary curves whose end points are this close are taken to be the same edge
+const float MATCH_DISTANCE = 1e-4f;
+
+int failures = 0;
+
+void check(const std::string& name, bool passed, const std::string& detail)
+{
+    std::cout << (passed ? "PASS " : "FAIL ") << name << ": " << detail << std::endl;
+    if (!passed)
+        failures++;
+}
+
+template <typename Fn>
+double measureMs(Fn fn)
+{
+    double best = 1e30;
+    for (int i = 0; i < REPEATS; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        best = std::min(best, ms);
+    }
+    return best;
+}
+
+struct Curve
+{
+    glm::vec3 points[4];
+};
+
+// the four boundary rows of every patch, in the layout of BezierSurface::indices
+std::vector<Curve> getBoundaryCurves(const BezierSurface& surface)
+{
+    std::vector<Curve> curves;
+    for (size_t patch = 0; patch < surface.getPatchCount(); patch++)
+    {
+        auto at = [&](int a, int b) { return surface.controlPoints[surface.indices[patch * 16 + a * 4 + b]]; };
+        Curve u0, u3, v0, v3;
+        for (int i = 0; i < 4; i++)
+        {
+            u0.points[i] = at(i, 0);
+            u3.points[i] = at(i, 3);
+            v0.points[i] = at(0, i);
+            v3.points[i] = at(3, i);
+        }
+        curves.insert(curves.end(), { u0, u3, v0, v3 });
+    }
+    return curves;
+}
+
+// Largest distance between the control points of boundary curves shared by two patches, the curves are the
+// same edge when their end points are. Edges on the open boundary, and the halved edges where a level meets
+// the next, have no partner and are counted separately.
+float measureGap(const BezierSurface& surface, size_t& shared, size_t& unmatched)
+{
+    const std::vector<Curve> curves = getBoundaryCurves(surface);
+    float gap = 0.0f;
+    shared = unmatched = 0;
+    for (size_t i = 0; i < curves.size(); i++)
+    {
+        bool found = false;
+        for (size_t j = 0; j < curves.size(); j++)
+        {
+            if (j == i)
+                continue;
+            const Curve& a = curves[i];
+            const Curve& b = curves[j];
+            const bool same = glm::length(a.points[0] - b.points[0]) < MATCH_DISTANCE && glm::length(a.points[3] - b.points[3]) < MATCH_DISTANCE;
+            const bool reversed = glm::length(a.points[0] - b.points[3]) < MATCH_DISTANCE && glm::length(a.points[3] - b.points[0]) < MATCH_DISTANCE;
+            if (!same && !reversed)
+                continue;
+            for (int k = 0; k < 4; k++)
+                gap = std::max(gap, glm::length(a.points[k] - b.points[same ? k : 3 - k]));
+            found = true;
+        }
+        if (found)
+            shared++;
+        else
+            unmatched++;
+    }
+    return gap;
+}
+
+// n x n quads on the unit square with the centre vertex pulled up, the boundary keeps the faces along it irregular
+SubdivisionSurface makeOpenGrid(int n)
+{
+    SubdivisionSurface surface;
+    for (int y = 0; y <= n; y++)
+    {
+        for (int x = 0; x <= n; x++)
+        {
+            const float height = (x == n / 2 && y == n / 2) ? 0.5f : 0.0f;
+            surface.points.push_back(glm::vec3((float)x / n, height, (float)y / n));
+        }
+    }
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            const int v = y * (n + 1) + x;
+            surface.faces.push_back({ v, v + n + 1, v + n + 2, v + 1 });
+        }
+    }
+    return surface;
+}
+
+void checkSurface(const std::string& name, const SubdivisionSurface& cage)
+{
+    for (int level = 1; level <= MAX_LEVEL; level++)
+    {
+        SubdivisionSurface::Stats stats;
+        const BezierSurface surface = cage.buildPatches(level, &stats);
+        size_t shared = 0, unmatched = 0;
+        const float gap = measureGap(surface, shared, unmatched);
+        const double ms = measureMs([&] { cage.buildPatches(level); });
+        check(name + " level " + std::to_string(level) + " gap", gap == 0.0f,
+            std::to_string(gap) + " over " + std::to_string(shared) + " shared edges (" + std::to_string(unmatched) + " unmatched), "
+            + std::to_string(stats.regularPatches) + " regular and " + std::to_string(stats.endCapPatches) + " end caps in "
+            + std::to_string(ms) + " ms");
+    }
+}
+
+int main()
+{
+    SubdivisionSurface box;
+    if (box.loadObj("Assets/Objects/cages/box.obj"))
+        checkSurface("box.obj", box);
+    else
+        check("box.obj", false, "not found, run from the repository root");
+    checkSurface("open grid", makeOpenGrid(6));
+    return failures > 0 ? 1 : 0;
+}
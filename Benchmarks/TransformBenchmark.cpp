@@ -0,0 +1,125 @@
+// Compares the batched quaternion kernel (TransformKernel.h) against Transform::getModelMatrix.
+// Build with -DBUILD_BENCHMARKS=ON, run the TransformBenchmark target in Release. Returns 1 if a check fails.
+
+#include <glm/glm.hpp>
+
+#include "../Source/JobSystem.h"
+#include "../Source/Transform.h"
+#include "../Source/TransformKernel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+const size_t TRANSFORM_COUNT = 1000000;
+const int REPEATS = 10;
+// the kernel composes from quaternions, the matrices only differ in rounding
+const float MAX_ERROR = 1e-4f;
+
+int failures = 0;
+
+void check(const std::string& name, bool passed, const std::string& detail)
+{
+    std::cout << (passed ? "PASS " : "FAIL ") << name << ": " << detail << std::endl;
+    if (!passed)
+        failures++;
+}
+
+template <typename Fn>
+double measureMs(Fn fn)
+{
+    double best = 1e30;
+    for (int i = 0; i < REPEATS; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        fn();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        best = std::min(best, ms);
+    }
+    return best;
+}
+
+void report(const std::string& name, double ms, double baselineMs)
+{
+    std::cout << name << ": " << ms << " ms, " << ms * 1e6 / TRANSFORM_COUNT << " ns per transform, "
+        << baselineMs / ms << "x" << std::endl;
+}
+
+int main()
+{
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> positionRange(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> angleRange(0.0f, 360.0f);
+    std::uniform_real_distribution<float> scaleRange(0.5f, 2.0f);
+
+    std::vector<Transform> transforms(TRANSFORM_COUNT);
+    std::vector<glm::vec3> positions(TRANSFORM_COUNT);
+    std::vector<glm::quat> rotations(TRANSFORM_COUNT);
+    std::vector<glm::vec3> scales(TRANSFORM_COUNT);
+    for (size_t i = 0; i < TRANSFORM_COUNT; i++)
+    {
+        glm::vec3 position(positionRange(random), positionRange(random), positionRange(random));
+        glm::vec3 rotation(angleRange(random), angleRange(random), angleRange(random));
+        glm::vec3 scale(scaleRange(random), scaleRange(random), scaleRange(random));
+        transforms[i].setPosition(position);
+        transforms[i].setRotation(rotation);
+        transforms[i].setScale(scale);
+        positions[i] = position;
+        rotations[i] = quatFromEuler(rotation);
+        scales[i] = scale;
+    }
+
+    std::vector<glm::mat4> matrices(TRANSFORM_COUNT);
+    std::vector<AffineRecord> world(TRANSFORM_COUNT);
+    std::vector<AffineRecord> normals(TRANSFORM_COUNT);
+
+    // every transform is marked dirty first, so both sides rebuild all matrices
+    double eulerMs = measureMs([&]
+        {
+            for (size_t i = 0; i < TRANSFORM_COUNT; i++)
+            {
+                transforms[i].setPosition(positions[i]);
+                matrices[i] = transforms[i].getModelMatrix();
+            }
+        });
+
+    double kernelMs = measureMs([&]
+        {
+            TransformKernel::compose(positions.data(), rotations.data(), scales.data(), TRANSFORM_COUNT, world.data());
+        });
+
+    double kernelNormalsMs = measureMs([&]
+        {
+            TransformKernel::compose(positions.data(), rotations.data(), scales.data(), TRANSFORM_COUNT, world.data(), normals.data());
+        });
+
+    double parallelMs = measureMs([&]
+        {
+            JobSystem::instance().parallelFor(TRANSFORM_COUNT, 16384, [&](size_t begin, size_t end)
+                {
+                    TransformKernel::compose(&positions[begin], &rotations[begin], &scales[begin], end - begin, &world[begin], &normals[begin]);
+                });
+        });
+
+    // both paths have to agree
+    float maxError = 0.0f;
+    for (size_t i = 0; i < TRANSFORM_COUNT; i += 997)
+    {
+        glm::mat4 kernelMatrix = world[i].toMat4();
+        for (int column = 0; column < 4; column++)
+            for (int row = 0; row < 3; row++)
+                maxError = std::max(maxError, std::abs(kernelMatrix[column][row] - matrices[i][column][row]));
+    }
+
+    std::cout << TRANSFORM_COUNT << " transforms, best of " << REPEATS << std::endl;
+    report("Transform::getModelMatrix (Euler, mat4)", eulerMs, eulerMs);
+    report("TransformKernel::compose", kernelMs, eulerMs);
+    report("TransformKernel::compose + normal matrices", kernelNormalsMs, eulerMs);
+    report("TransformKernel::compose + normal matrices, " + std::to_string(JobSystem::instance().getThreadCount()) + " threads", parallelMs, eulerMs);
+    check("kernel matches getModelMatrix", maxError <= MAX_ERROR, "max difference " + std::to_string(maxError));
+    return failures > 0 ? 1 : 0;
+}
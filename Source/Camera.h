@@ -49,7 +49,10 @@ public:
     float Zoom;
 
     CameraMode CurrentMode;
-    Transform* TargetTransform;
+    Transform* TargetTransform = nullptr;
+    // Socket used in ATTACHED mode, child of the target so it reuses the target's cached world matrix
+    Transform AttachmentNode;
+    glm::vec3 AttachmentViewDir = glm::vec3(-1.0f, -0.3f, 0.0f);
 
 	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f),
         float yaw = YAW, float pitch = PITCH, CameraMode mode = FREE) : Front(glm::vec3(0.0f, 0.0f, -1.0f)),
@@ -62,30 +65,30 @@ public:
         updateCameraVectors();
     }
 
-    glm::mat4 getViewMatrix()
+    // Follow the target, the attachment node is placed at the given offset in the target's space
+    void attachTo(Transform* target, const glm::vec3& localOffset = glm::vec3(11.0f, 11.0f, 0.0f))
     {
-        static glm::vec3 localOffset(11, 11, 0);
-        static glm::vec3 viewDir(-1, -0.3, 0);
+        TargetTransform = target;
+        AttachmentNode.setPosition(localOffset);
+        AttachmentNode.setParent(target);
+    }
 
+    glm::mat4 getViewMatrix()
+    {
 		switch (CurrentMode)
 	    {
 	    case STATIC_SCENE:
 			return glm::lookAt(Position, glm::vec3(0.0f), Up);
 		case STATIC_TRACKING:
-			return glm::lookAt(Position, TargetTransform->position, WorldUp);
+			return glm::lookAt(Position, TargetTransform->getWorldPosition(), WorldUp);
 	    case ATTACHED:
+	    {
 	    	// third person perspective
-            glm::mat4 rotationMatrix = glm::mat4(1.0f);
-            rotationMatrix = glm::rotate(rotationMatrix, glm::radians(TargetTransform->rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-            rotationMatrix = glm::rotate(rotationMatrix, glm::radians(TargetTransform->rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-            rotationMatrix = glm::rotate(rotationMatrix, glm::radians(TargetTransform->rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-
-			glm::vec4 offset = rotationMatrix * glm::vec4(localOffset, 1.0f);
-			glm::vec3 cameraPos = TargetTransform->position + glm::vec3(offset);
-            glm::vec3 direction = glm::normalize(glm::vec3(rotationMatrix * glm::vec4(viewDir, 0.0f)));
-            Position = cameraPos;
+            Position = AttachmentNode.getWorldPosition();
+            glm::vec3 direction = glm::normalize(AttachmentNode.transformDirection(AttachmentViewDir));
 
 			return glm::lookAt(Position, Position + direction, WorldUp);
+	    }
 	    case FREE:
 	    default:
 			return glm::lookAt(Position, Position + Front, Up);
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "ClothSolver.h"
+#include "ComputeShader.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Material.h"
+#include "Shader.h"
+
+#include <chrono>
+#include <vector>
+
+#define CLOTH_POSITION_BINDING 4
+#define CLOTH_PREVIOUS_BINDING 5
+#define CLOTH_OUTPUT_BINDING 6
+
+// Position based cloth on a square particle grid hanging from a pole, the column at u = 0 is pinned.
+// Every substep is a Verlet integration with gravity and wind followed by Jacobi iterations over
+// structural, shear and bending distance constraints, and a final pass computes the normals.
+// With compute shaders all passes run in cloth.cs on two ping-ponged position buffers, which are also
+// the vertex buffers of the draw, so the particles never leave the GPU. Otherwise ClothSolver runs the same
+// passes on the JobSystem workers and the result is uploaded, it is also the reference for the shader in
+// Benchmarks/ClothBenchmark.cpp.
+class Cloth
+{
+public:
+    ClothSettings settings;
+    bool useGpu = true;
+
+    // CPU solve including the upload, or GPU time of the compute passes from a previous frame
+    float lastSimulateMs = 0.0f;
+    float lastGpuMs = 0.0f;
+
+    static bool supportsGpu()
+    {
+        const GLCaps& caps = GLCaps::instance();
+        return caps.computeShader && caps.shaderStorage;
+    }
+
+    static void setupShader(const Shader& shader)
+    {
+        if (!supportsGpu())
+            return;
+        GLuint positions = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "ClothPositions");
+        if (positions != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(shader.ID, positions, CLOTH_POSITION_BINDING);
+        GLuint previous = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "ClothPrevious");
+        if (previous != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(shader.ID, previous, CLOTH_PREVIOUS_BINDING);
+        GLuint output = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "ClothOutput");
+        if (output != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(shader.ID, output, CLOTH_OUTPUT_BINDING);
+    }
+
+    int getResolution() const { return solver.getResolution(); }
+    bool isCreated() const { return solver.getResolution() > 0; }
+
+    // resolution x resolution particles over a size x size square, the pinned edge runs up from origin
+    void create(int particleResolution, float size, const glm::vec3& origin, unsigned int clothMaterial = 0)
+    {
+        solver.create(particleResolution, size, origin);
+        const int resolution = solver.getResolution();
+        material = clothMaterial;
+        useGpu = useGpu && supportsGpu();
+
+        std::vector<glm::vec2> texCoords;
+        std::vector<GLuint> indices;
+        for (int y = 0; y < resolution; y++)
+        {
+            for (int x = 0; x < resolution; x++)
+                texCoords.push_back(glm::vec2((float)x, (float)y) / (float)(resolution - 1));
+        }
+        for (int y = 0; y + 1 < resolution; y++)
+        {
+            for (int x = 0; x + 1 < resolution; x++)
+            {
+                GLuint v0 = (GLuint)(y * resolution + x);
+                GLuint v1 = v0 + (GLuint)resolution;
+                indices.insert(indices.end(), { v0, v0 + 1, v1 + 1, v0, v1 + 1, v1 });
+            }
+        }
+        indexCount = (GLsizei)indices.size();
+
+        const size_t bytes = (size_t)resolution * resolution * sizeof(glm::vec4);
+        GLState& state = GLState::instance();
+        glGenBuffers(2, positionBuffers);
+        glGenBuffers(1, &previousBuffer);
+        glGenBuffers(1, &normalBuffer);
+        glGenBuffers(1, &texCoordBuffer);
+        glGenBuffers(1, &indexBuffer);
+        for (GLuint buffer : { positionBuffers[0], positionBuffers[1], previousBuffer, normalBuffer })
+        {
+            state.bindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_DYNAMIC_DRAW);
+        }
+        state.bindBuffer(GL_ARRAY_BUFFER, texCoordBuffer);
+        glBufferData(GL_ARRAY_BUFFER, texCoords.size() * sizeof(glm::vec2), texCoords.data(), GL_STATIC_DRAW);
+
+        // one vertex array per position buffer, the solve can end in either
+        glGenVertexArrays(2, VAOs);
+        for (int i = 0; i < 2; i++)
+        {
+            state.bindVertexArray(VAOs[i]);
+            state.bindBuffer(GL_ARRAY_BUFFER, positionBuffers[i]);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+            state.bindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+            state.bindBuffer(GL_ARRAY_BUFFER, texCoordBuffer);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+            state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+            if (i == 0)
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+        }
+        state.bindVertexArray(0);
+        glGenQueries(1, &timerQuery);
+
+        reset();
+    }
+
+    // back to the flat rest pose
+    void reset()
+    {
+        solver.reset();
+        current = 0;
+        gpuTime = 0.0f;
+
+        GLState& state = GLState::instance();
+        const std::vector<glm::vec4>& positions = solver.getPositions();
+        const size_t bytes = positions.size() * sizeof(glm::vec4);
+        for (GLuint buffer : { positionBuffers[0], positionBuffers[1], previousBuffer })
+        {
+            state.bindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, positions.data());
+        }
+        state.bindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, solver.getNormals().data());
+    }
+
+    // computeShader is the cloth.cs program, null without compute shaders
+    void simulate(ComputeShader* computeShader, float deltaTime)
+    {
+        if (!isCreated())
+            return;
+        // long frames would need more substeps than we can afford, the cloth slows down instead
+        deltaTime = glm::min(deltaTime, 1.0f / 30.0f);
+        if (deltaTime <= 0.0f)
+            return;
+        const float timeStep = deltaTime / (float)glm::max(settings.substeps, 1);
+
+        const bool gpu = useGpu && computeShader && supportsGpu();
+        // the solvers do not share their state, switching starts over from the rest pose
+        if (gpu != solvedOnGpu)
+            reset();
+        solvedOnGpu = gpu;
+        if (gpu)
+            simulateGpu(*computeShader, timeStep);
+        else
+            simulateCpu(timeStep);
+    }
+
+    // the latest positions of whichever solver ran, reads back from the GPU
+    void readPositions(std::vector<glm::vec4>& positions) const
+    {
+        if (!solvedOnGpu)
+        {
+            positions = solver.getPositions();
+            return;
+        }
+        positions.resize(solver.getPositions().size());
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, positionBuffers[current]);
+        glGetBufferSubData(GL_ARRAY_BUFFER, 0, positions.size() * sizeof(glm::vec4), positions.data());
+    }
+
+    // shader is the regular object shader with its per frame uniforms set
+    void draw(Shader& shader)
+    {
+        if (!isCreated())
+            return;
+
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        if (!library.isBindless())
+            library.get(material).bind();
+        shader.use();
+        shader.setModelMatrix(glm::mat4(1.0f));
+        GLState::instance().bindVertexArray(VAOs[current]);
+        glVertexAttribI1ui(MATERIAL_ATTRIBUTE, material);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    }
+
+private:
+    enum Pass { PASS_INTEGRATE = 0, PASS_CONSTRAIN = 1, PASS_NORMALS = 2 };
+
+    ClothSolver solver;
+    unsigned int material = 0;
+    // time of the GPU solve, the CPU solver keeps its own
+    float gpuTime = 0.0f;
+
+    GLuint VAOs[2] = {}, positionBuffers[2] = {};
+    GLuint previousBuffer = 0, normalBuffer = 0, texCoordBuffer = 0, indexBuffer = 0;
+    GLsizei indexCount = 0;
+    // position buffer holding the latest state
+    int current = 0;
+    GLuint timerQuery = 0;
+    bool timerPending = false;
+    bool solvedOnGpu = false;
+
+    void simulateGpu(ComputeShader& computeShader, float timeStep)
+    {
+        // the result of the previous frame's query, never waits
+        if (timerPending)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(timerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &nanoseconds);
+                lastGpuMs = (float)((double)nanoseconds / 1e6);
+                timerPending = false;
+            }
+        }
+        const bool timed = !timerPending;
+        if (timed)
+            glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+
+        const int resolution = solver.getResolution();
+        computeShader.use();
+        computeShader.setInt("resolution", resolution);
+        computeShader.setFloat("spacing", solver.getSpacing());
+        computeShader.setFloat("timeStep", timeStep);
+        computeShader.setFloat("damping", settings.damping);
+        computeShader.setVec3("gravity", settings.gravity);
+        computeShader.setVec3("wind", settings.wind);
+        computeShader.setFloat("turbulence", settings.turbulence);
+        computeShader.setFloat("drag", settings.drag);
+        computeShader.setFloat("stiffness", settings.stiffness);
+        computeShader.setFloat("bendStiffness", settings.bendStiffness);
+
+        GLState& state = GLState::instance();
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLOTH_PREVIOUS_BINDING, previousBuffer);
+        const GLuint groups = (GLuint)(resolution + 15) / 16;
+        auto dispatch = [&](Pass pass, GLuint target)
+            {
+                computeShader.setInt("pass", pass);
+                state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLOTH_POSITION_BINDING, positionBuffers[current]);
+                state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, CLOTH_OUTPUT_BINDING, target);
+                computeShader.dispatch(groups, groups);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            };
+
+        for (int step = 0; step < settings.substeps; step++)
+        {
+            gpuTime += timeStep;
+            computeShader.setFloat("time", gpuTime);
+            dispatch(PASS_INTEGRATE, positionBuffers[1 - current]);
+            current = 1 - current;
+            for (int i = 0; i < settings.iterations; i++)
+            {
+                dispatch(PASS_CONSTRAIN, positionBuffers[1 - current]);
+                current = 1 - current;
+            }
+        }
+        dispatch(PASS_NORMALS, normalBuffer);
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+        if (timed)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            timerPending = true;
+        }
+    }
+
+    void simulateCpu(float timeStep)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        solver.simulate(settings, timeStep);
+
+        GLState& state = GLState::instance();
+        const std::vector<glm::vec4>& positions = solver.getPositions();
+        const size_t bytes = positions.size() * sizeof(glm::vec4);
+        state.bindBuffer(GL_ARRAY_BUFFER, positionBuffers[current]);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, positions.data());
+        state.bindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, solver.getNormals().data());
+        lastSimulateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "JobSystem.h"
+
+#include <cmath>
+#include <functional>
+#include <vector>
+
+// parameters shared by the CPU solver and cloth.cs
+struct ClothSettings
+{
+    glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+    glm::vec3 wind = glm::vec3(6.0f, 0.0f, 2.0f);
+    // strength of the gusts relative to the wind
+    float turbulence = 0.6f;
+    float drag = 0.8f;
+    float damping = 0.01f;
+    float stiffness = 1.5f;
+    float bendStiffness = 0.3f;
+    int substeps = 4;
+    int iterations = 8;
+};
+
+// CPU reference of cloth.cs without any GL, so it also runs in the benchmarks. The passes mirror the shader:
+// every particle reads the current positions and writes its output, which becomes the next input.
+class ClothSolver
+{
+public:
+    // resolution x resolution particles over a size x size square, the pinned edge runs up from origin
+    void create(int particleResolution, float size, const glm::vec3& origin)
+    {
+        resolution = glm::max(particleResolution, 3);
+        spacing = size / (float)(resolution - 1);
+        anchor = origin;
+        reset();
+    }
+
+    // back to the flat rest pose
+    void reset()
+    {
+        positions.resize((size_t)resolution * resolution);
+        for (int y = 0; y < resolution; y++)
+        {
+            for (int x = 0; x < resolution; x++)
+            {
+                const float inverseMass = x == 0 ? 0.0f : 1.0f;
+                positions[y * resolution + x] = glm::vec4(anchor + glm::vec3(x * spacing, y * spacing, 0.0f), inverseMass);
+            }
+        }
+        previous = positions;
+        output.resize(positions.size());
+        normals.assign(positions.size(), glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
+        simulationTime = 0.0f;
+    }
+
+    // the substeps of one frame followed by the normals
+    void simulate(const ClothSettings& settings, float timeStep)
+    {
+        for (int step = 0; step < settings.substeps; step++)
+        {
+            integrate(settings, timeStep);
+            for (int i = 0; i < settings.iterations; i++)
+                constrain(settings);
+        }
+        computeNormals();
+    }
+
+    void integrate(const ClothSettings& settings, float timeStep)
+    {
+        simulationTime += timeStep;
+        runPass([&](int x, int y, size_t index) { output[index] = integrateParticle(settings, x, y, index, timeStep); });
+        positions.swap(output);
+    }
+
+    void constrain(const ClothSettings& settings)
+    {
+        runPass([&](int x, int y, size_t index) { output[index] = constrainParticle(settings, x, y, index); });
+        positions.swap(output);
+    }
+
+    void computeNormals()
+    {
+        runPass([&](int x, int y, size_t index) { normals[index] = glm::vec4(gridNormal(x, y), 0.0f); });
+    }
+
+    // root mean square of the relative length errors of the structural and shear constraints
+    float constraintResidual() const
+    {
+        static const glm::ivec2 neighbours[4] = { { 1, 0 }, { 0, 1 }, { 1, 1 }, { -1, 1 } };
+        double sum = 0.0;
+        size_t count = 0;
+        for (int y = 0; y < resolution; y++)
+        {
+            for (int x = 0; x < resolution; x++)
+            {
+                for (const glm::ivec2& offset : neighbours)
+                {
+                    const int ox = x + offset.x, oy = y + offset.y;
+                    if (ox < 0 || ox >= resolution || oy >= resolution)
+                        continue;
+                    const float rest = spacing * glm::length(glm::vec2(offset));
+                    const float error = (glm::length(glm::vec3(at(ox, oy)) - glm::vec3(at(x, y))) - rest) / rest;
+                    sum += (double)error * error;
+                    count++;
+                }
+            }
+        }
+        return count > 0 ? (float)std::sqrt(sum / (double)count) : 0.0f;
+    }
+
+    int getResolution() const { return resolution; }
+    float getSpacing() const { return spacing; }
+    float getTime() const { return simulationTime; }
+    // xyz - position, w - inverse mass, 0 pins the particle
+    const std::vector<glm::vec4>& getPositions() const { return positions; }
+    const std::vector<glm::vec4>& getNormals() const { return normals; }
+
+private:
+    int resolution = 0;
+    float spacing = 0.0f;
+    glm::vec3 anchor = glm::vec3(0.0f);
+    float simulationTime = 0.0f;
+    std::vector<glm::vec4> positions, previous, output, normals;
+
+    // rows are spread over the workers, like the dispatch every particle only writes itself
+    void runPass(const std::function<void(int, int, size_t)>& particle)
+    {
+        JobSystem::instance().parallelFor((size_t)resolution, 8, [&](size_t begin, size_t end)
+            {
+                for (size_t y = begin; y < end; y++)
+                {
+                    for (int x = 0; x < resolution; x++)
+                        particle(x, (int)y, y * resolution + x);
+                }
+            });
+    }
+
+    // the functions below mirror cloth.cs
+
+    const glm::vec4& at(int x, int y) const
+    {
+        return positions[(size_t)y * resolution + x];
+    }
+
+    glm::vec3 gridNormal(int x, int y) const
+    {
+        const int last = resolution - 1;
+        glm::vec3 du = glm::vec3(at(glm::min(x + 1, last), y)) - glm::vec3(at(glm::max(x - 1, 0), y));
+        glm::vec3 dv = glm::vec3(at(x, glm::min(y + 1, last))) - glm::vec3(at(x, glm::max(y - 1, 0)));
+        glm::vec3 normal = glm::cross(du, dv);
+        float area = glm::length(normal);
+        return area > 1e-12f ? normal / area : glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+
+    glm::vec4 integrateParticle(const ClothSettings& settings, int x, int y, size_t index, float timeStep)
+    {
+        const glm::vec4 position = positions[index];
+        const glm::vec3 last = glm::vec3(previous[index]);
+        previous[index] = position;
+        if (position.w == 0.0f)
+            return position;
+
+        const glm::vec3 p = glm::vec3(position);
+        const glm::vec3 velocity = (p - last) / timeStep;
+        const float gust = 1.0f + settings.turbulence * std::sin(simulationTime * 2.3f + p.x * 0.9f + p.y * 0.7f)
+            * std::sin(simulationTime * 1.7f + p.z * 1.3f);
+        const glm::vec3 normal = gridNormal(x, y);
+        const glm::vec3 acceleration = settings.gravity + settings.drag * glm::dot(normal, settings.wind * gust - velocity) * normal;
+        const glm::vec3 next = p + (p - last) * (1.0f - settings.damping) + acceleration * timeStep * timeStep;
+        return glm::vec4(next, position.w);
+    }
+
+    glm::vec4 constrainParticle(const ClothSettings& settings, int x, int y, size_t index) const
+    {
+        static const glm::ivec2 neighbours[12] = {
+            { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 },
+            { 1, 1 }, { -1, -1 }, { 1, -1 }, { -1, 1 },
+            { 2, 0 }, { -2, 0 }, { 0, 2 }, { 0, -2 } };
+
+        const glm::vec4 position = positions[index];
+        if (position.w == 0.0f)
+            return position;
+
+        glm::vec3 correction(0.0f);
+        int count = 0;
+        for (int k = 0; k < 12; k++)
+        {
+            const int ox = x + neighbours[k].x, oy = y + neighbours[k].y;
+            if (ox < 0 || oy < 0 || ox >= resolution || oy >= resolution)
+                continue;
+
+            const glm::vec4& neighbour = at(ox, oy);
+            const glm::vec3 delta = glm::vec3(neighbour) - glm::vec3(position);
+            const float separation = glm::length(delta);
+            if (separation < 1e-6f)
+                continue;
+            const float rest = spacing * glm::length(glm::vec2(neighbours[k]));
+            const float weight = position.w / (position.w + neighbour.w) * (k < 8 ? 1.0f : settings.bendStiffness);
+            correction += weight * (separation - rest) / separation * delta;
+            count++;
+        }
+        return glm::vec4(glm::vec3(position) + settings.stiffness * correction / (float)glm::max(count, 1), position.w);
+    }
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "GLExtensions.h"
+#include "Shader.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Program made of a single compute stage, only usable when GLCaps reports compute shaders
+// https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/shader_c.h
+class ComputeShader : public Shader
+{
+public:
+    ComputeShader(const char* computePath, const char* header = nullptr)
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: "
+                << e.what() << std::endl;
+        }
+        if (header != nullptr)
+            computeCode = addHeader(computeCode, header);
+
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(compute);
+    }
+
+    void dispatch(GLuint groupsX, GLuint groupsY = 1, GLuint groupsZ = 1) const
+    {
+        glDispatchCompute(groupsX, groupsY, groupsZ);
+    }
+};
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Material.h"
+#include "PatchRenderer.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <vector>
+
+// Bicubic patch tessellation on the CPU, the alternative to the tessellation shaders.
+// Bernstein basis and derivative values are tabulated once per level, every patch is then evaluated
+// row by row: the control rows are first combined along u, the inner loop over v runs on
+// per-component arrays and vectorizes. Patches are spread over the JobSystem workers, which write
+// straight into a mapped segment of a ring buffered VBO, a fence keeps a segment from being
+// overwritten while the GPU may still read it.
+class CpuTessellator
+{
+public:
+    struct TessellatedVertex
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec2 texCoords;
+        GLuint material;
+    };
+
+    static const int RING_SEGMENTS = 3;
+
+    float lastTessellateMs = 0.0f;
+
+    size_t getPatchCount() const { return patches.size(); }
+    size_t getVisiblePatchCount() const { return visible.size(); }
+
+    void clear()
+    {
+        patches.clear();
+    }
+
+    // 16 world space control points, i * 4 + j with i along u
+    void addPatch(const glm::vec3* points, unsigned int material)
+    {
+        Patch patch;
+        for (int k = 0; k < 16; k++)
+            patch.points[k] = points[k];
+        patch.material = material;
+        patches.push_back(patch);
+    }
+
+    // shared control points are transformed once per object
+    void addSurface(const BezierSurface& surface, const glm::mat4& model, unsigned int material)
+    {
+        worldPoints.resize(surface.controlPoints.size());
+        for (size_t i = 0; i < surface.controlPoints.size(); i++)
+            worldPoints[i] = glm::vec3(model * glm::vec4(surface.controlPoints[i], 1.0f));
+
+        glm::vec3 points[16];
+        for (size_t patch = 0; patch < surface.getPatchCount(); patch++)
+        {
+            for (int k = 0; k < 16; k++)
+                points[k] = worldPoints[surface.indices[patch * 16 + k]];
+            addPatch(points, material);
+        }
+    }
+
+    // tessellates the patches inside the frustum and draws them with the regular object shader
+    void draw(Shader& shader, const Frustum& frustum, int level)
+    {
+        level = glm::clamp(level, 1, 64);
+        cull(frustum);
+        if (visible.empty())
+            return;
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        // without bindless textures a draw samples one texture array set, the patches of a set are drawn together
+        if (!library.isBindless())
+        {
+            std::stable_sort(visible.begin(), visible.end(), [&](unsigned int a, unsigned int b)
+                {
+                    const Material& ma = library.get(patches[a].material);
+                    const Material& mb = library.get(patches[b].material);
+                    if (ma.diffuse.array != mb.diffuse.array)
+                        return ma.diffuse.array < mb.diffuse.array;
+                    return ma.specular.array < mb.specular.array;
+                });
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        const BasisTable& table = getTable(level);
+        const size_t verticesPerPatch = (size_t)table.samples * table.samples;
+        prepareIndices(level, visible.size());
+        prepareVertexBuffer(visible.size() * verticesPerPatch);
+
+        GLState& state = GLState::instance();
+        waitForSegment(segment);
+        const size_t segmentOffset = segment * segmentCapacity;
+        state.bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        TessellatedVertex* mapped = (TessellatedVertex*)glMapBufferRange(GL_ARRAY_BUFFER,
+            segmentOffset * sizeof(TessellatedVertex), visible.size() * verticesPerPatch * sizeof(TessellatedVertex),
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!mapped)
+        {
+            std::cout << "ERROR::CPU_TESSELLATOR::MAP_FAILED" << std::endl;
+            return;
+        }
+
+        JobSystem::instance().parallelFor(visible.size(), 8, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Patch& patch = patches[visible[i]];
+                    evaluatePatch(patch, table, mapped + i * verticesPerPatch);
+                }
+            });
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        lastTessellateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        shader.use();
+        shader.setModelMatrix(glm::mat4(1.0f));
+        state.bindVertexArray(VAO);
+        size_t first = 0;
+        while (first < visible.size())
+        {
+            size_t end = visible.size();
+            if (!library.isBindless())
+            {
+                const Material& material = library.get(patches[visible[first]].material);
+                end = first + 1;
+                while (end < visible.size() && material.sharesBindings(library.get(patches[visible[end]].material)))
+                    end++;
+                material.bind();
+            }
+            glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)((end - first) * indicesPerPatch), GL_UNSIGNED_INT,
+                (void*)(first * indicesPerPatch * sizeof(GLuint)), (GLint)segmentOffset);
+            first = end;
+        }
+
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % RING_SEGMENTS;
+    }
+
+private:
+    struct Patch
+    {
+        glm::vec3 points[16];
+        unsigned int material;
+    };
+
+    // basis values at the level + 1 sample positions t = k / level
+    struct BasisTable
+    {
+        int samples = 0;
+        std::vector<float> basis[4];
+        std::vector<float> derivative[4];
+    };
+
+    std::vector<Patch> patches;
+    std::vector<unsigned int> visible;
+    std::vector<glm::vec3> worldPoints;
+    std::map<int, BasisTable> tables;
+
+    GLuint VAO = 0, vertexBuffer = 0, indexBuffer = 0;
+    size_t segmentCapacity = 0;  // vertices per ring segment
+    GLsync fences[RING_SEGMENTS] = {};
+    int segment = 0;
+    int indexedLevel = 0;
+    size_t indexedPatches = 0;
+    size_t indicesPerPatch = 0;
+
+    const BasisTable& getTable(int level)
+    {
+        auto found = tables.find(level);
+        if (found != tables.end())
+            return found->second;
+
+        BasisTable& table = tables[level];
+        table.samples = level + 1;
+        for (int k = 0; k < 4; k++)
+        {
+            table.basis[k].resize(table.samples);
+            table.derivative[k].resize(table.samples);
+        }
+        for (int s = 0; s < table.samples; s++)
+        {
+            const float t = (float)s / (float)level;
+            const float it = 1.0f - t;
+            table.basis[0][s] = it * it * it;
+            table.basis[1][s] = 3.0f * t * it * it;
+            table.basis[2][s] = 3.0f * t * t * it;
+            table.basis[3][s] = t * t * t;
+            table.derivative[0][s] = -3.0f * it * it;
+            table.derivative[1][s] = 3.0f * it * (1.0f - 3.0f * t);
+            table.derivative[2][s] = 3.0f * t * (2.0f - 3.0f * t);
+            table.derivative[3][s] = 3.0f * t * t;
+        }
+        return table;
+    }
+
+    // the control hull contains the patch, so its bounding sphere does too
+    void cull(const Frustum& frustum)
+    {
+        visible.clear();
+        for (unsigned int i = 0; i < patches.size(); i++)
+        {
+            glm::vec3 center(0.0f);
+            for (const glm::vec3& point : patches[i].points)
+                center += point;
+            center /= 16.0f;
+            float radius = 0.0f;
+            for (const glm::vec3& point : patches[i].points)
+                radius = glm::max(radius, glm::length(point - center));
+            if (frustum.intersectsSphere(center, radius))
+                visible.push_back(i);
+        }
+    }
+
+    static void evaluatePatch(const Patch& patch, const BasisTable& table, TessellatedVertex* out)
+    {
+        const int samples = table.samples;
+        // per v sample, per component, at most 65 samples
+        float px[65], py[65], pz[65];
+        float ux[65], uy[65], uz[65];
+        float vx[65], vy[65], vz[65];
+
+        for (int a = 0; a < samples; a++)
+        {
+            // rows combined along u: r[j] = sum_i B_i(u) P_ij, dr[j] = sum_i dB_i(u) P_ij
+            glm::vec3 r[4], dr[4];
+            for (int j = 0; j < 4; j++)
+            {
+                r[j] = glm::vec3(0.0f);
+                dr[j] = glm::vec3(0.0f);
+                for (int i = 0; i < 4; i++)
+                {
+                    r[j] += table.basis[i][a] * patch.points[i * 4 + j];
+                    dr[j] += table.derivative[i][a] * patch.points[i * 4 + j];
+                }
+            }
+
+            const float* b0 = table.basis[0].data(), * b1 = table.basis[1].data(), * b2 = table.basis[2].data(), * b3 = table.basis[3].data();
+            const float* d0 = table.derivative[0].data(), * d1 = table.derivative[1].data(), * d2 = table.derivative[2].data(), * d3 = table.derivative[3].data();
+            for (int b = 0; b < samples; b++)
+            {
+                px[b] = b0[b] * r[0].x + b1[b] * r[1].x + b2[b] * r[2].x + b3[b] * r[3].x;
+                py[b] = b0[b] * r[0].y + b1[b] * r[1].y + b2[b] * r[2].y + b3[b] * r[3].y;
+                pz[b] = b0[b] * r[0].z + b1[b] * r[1].z + b2[b] * r[2].z + b3[b] * r[3].z;
+                ux[b] = b0[b] * dr[0].x + b1[b] * dr[1].x + b2[b] * dr[2].x + b3[b] * dr[3].x;
+                uy[b] = b0[b] * dr[0].y + b1[b] * dr[1].y + b2[b] * dr[2].y + b3[b] * dr[3].y;
+                uz[b] = b0[b] * dr[0].z + b1[b] * dr[1].z + b2[b] * dr[2].z + b3[b] * dr[3].z;
+                vx[b] = d0[b] * r[0].x + d1[b] * r[1].x + d2[b] * r[2].x + d3[b] * r[3].x;
+                vy[b] = d0[b] * r[0].y + d1[b] * r[1].y + d2[b] * r[2].y + d3[b] * r[3].y;
+                vz[b] = d0[b] * r[0].z + d1[b] * r[1].z + d2[b] * r[2].z + d3[b] * r[3].z;
+            }
+
+            const float u = (float)a / (float)(samples - 1);
+            TessellatedVertex* row = out + a * samples;
+            for (int b = 0; b < samples; b++)
+            {
+                // normal as in tessEval.tes, degenerate edges (collapsed rows) fall back to up
+                glm::vec3 normal = glm::cross(glm::vec3(ux[b], uy[b], uz[b]), glm::vec3(vx[b], vy[b], vz[b]));
+                float length = glm::length(normal);
+                row[b].position = glm::vec3(px[b], py[b], pz[b]);
+                row[b].normal = length > 1e-12f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+                row[b].texCoords = glm::vec2(u, (float)b / (float)(samples - 1));
+                row[b].material = patch.material;
+            }
+        }
+    }
+
+    // the same grid for every patch, patch p starts at vertex p * samples^2
+    void prepareIndices(int level, size_t patchCount)
+    {
+        if (level == indexedLevel && patchCount <= indexedPatches)
+            return;
+
+        const GLuint samples = (GLuint)level + 1;
+        const GLuint verticesPerPatch = samples * samples;
+        indicesPerPatch = (size_t)level * level * 6;
+        // grow in steps, the number of visible patches changes every frame
+        indexedPatches = level == indexedLevel ? glm::max(patchCount, indexedPatches * 2) : patchCount;
+        indexedLevel = level;
+
+        std::vector<GLuint> indices;
+        indices.reserve(indexedPatches * indicesPerPatch);
+        for (size_t patch = 0; patch < indexedPatches; patch++)
+        {
+            const GLuint base = (GLuint)patch * verticesPerPatch;
+            for (GLuint a = 0; a < (GLuint)level; a++)
+            {
+                for (GLuint b = 0; b < (GLuint)level; b++)
+                {
+                    GLuint v0 = base + a * samples + b;
+                    GLuint v1 = v0 + samples;
+                    indices.insert(indices.end(), { v0, v1, v1 + 1, v0, v1 + 1, v0 + 1 });
+                }
+            }
+        }
+
+        GLState& state = GLState::instance();
+        if (VAO == 0)
+            createVertexArray();
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    }
+
+    void createVertexArray()
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+    }
+
+    // RING_SEGMENTS segments of at least vertexCount vertices
+    void prepareVertexBuffer(size_t vertexCount)
+    {
+        if (vertexCount <= segmentCapacity)
+            return;
+
+        // the old storage is orphaned, its fences mean nothing for the new one
+        for (GLsync& fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        segmentCapacity = vertexCount + vertexCount / 2;
+        segment = 0;
+
+        GLState& state = GLState::instance();
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, RING_SEGMENTS * segmentCapacity * sizeof(TessellatedVertex), nullptr, GL_STREAM_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(TessellatedVertex), (void*)offsetof(TessellatedVertex, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(TessellatedVertex), (void*)offsetof(TessellatedVertex, normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(TessellatedVertex), (void*)offsetof(TessellatedVertex, texCoords));
+        glEnableVertexAttribArray(MATERIAL_ATTRIBUTE);
+        glVertexAttribIPointer(MATERIAL_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(TessellatedVertex), (void*)offsetof(TessellatedVertex, material));
+    }
+
+    void waitForSegment(int index)
+    {
+        GLsync& fence = fences[index];
+        if (!fence)
+            return;
+        // usually signaled long ago, two frames have passed since
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+};
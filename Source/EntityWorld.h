@@ -0,0 +1,355 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "Model.h"
+#include "Transform.h"
+#include "TransformKernel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+typedef uint32_t Entity;
+const Entity INVALID_ENTITY = 0xFFFFFFFFu;
+
+// Entities of the scene stored as structure of arrays. Every component lives in its own contiguous
+// array indexed by the entity, systems walk the arrays in chunks spread over the JobSystem.
+
+struct TransformComponents
+{
+    std::vector<glm::vec3> position;
+    std::vector<glm::vec3> rotation;  // Euler angles in degrees, as in Transform, kept for editing
+    std::vector<glm::quat> orientation;  // rotation as used by the transform kernel
+    std::vector<glm::vec3> scale;
+    std::vector<AffineRecord> world;
+    std::vector<uint8_t> dirty;
+    std::vector<uint32_t> version;    // bumped whenever world changes
+};
+
+// Movement on a circle around the origin (the train path)
+struct MotionComponents
+{
+    std::vector<uint8_t> moving;
+    std::vector<uint8_t> driven;    // placed every frame by another system (track vehicles), never static
+    std::vector<uint8_t> followed;  // a light, the camera or an emitter is attached, never time-sliced
+    std::vector<float> radius;
+    std::vector<float> speed;
+    std::vector<float> angle;
+    // animation LOD, the angle is simulated on ticks and the drawn one interpolates from the previous tick
+    std::vector<float> previousAngle;
+    std::vector<float> elapsed;     // since the last tick
+    std::vector<float> tickSpan;    // time simulated by the last tick
+    std::vector<float> lag;         // driven: distance travelled since the transform was last written
+};
+
+struct RenderComponents
+{
+    std::vector<Model*> model;  // nullptr - simulated and culled, but not drawn
+    std::vector<uint8_t> instanced;  // drawn together with all visible entities of the same model
+    std::vector<uint8_t> skinned;    // drawn from its own skinned vertices (see SkinningSystem)
+    std::vector<std::string> name;
+};
+
+struct BoundsComponents
+{
+    std::vector<glm::vec4> local;  // model space sphere, xyz - center, w - radius
+    std::vector<glm::vec4> world;
+};
+
+class EntityWorld
+{
+public:
+    TransformComponents transforms;
+    MotionComponents motion;
+    RenderComponents render;
+    BoundsComponents bounds;
+
+    // Result of the last cull(), visible entities in ascending order
+    std::vector<Entity> visible;
+
+    // Entities per chunk handed to a worker
+    size_t chunkSize = 4096;
+
+    float lastUpdateMs = 0.0f;
+    float lastCullMs = 0.0f;
+
+    // Animation LOD: moving entities that were culled last frame, or are further than animationLodDistance
+    // from the viewer, are simulated every hiddenInterval/farInterval frames only. Ticks are spread over the
+    // frames by the entity index and visible entities interpolate in between, so the cost follows what is seen.
+    // Driven entities are still simulated by their system, which only writes hidden ones on their ticks (see
+    // isTransformDue). Culling widens the bounds of hidden entities by how far they moved since their transform
+    // was written. Followed entities always run every frame, so what is attached to them never steps.
+    bool animationLod = true;
+    glm::vec3 viewer = glm::vec3(0.0f);
+    float animationLodDistance = 30.0f;
+    uint32_t farInterval = 4;
+    uint32_t hiddenInterval = 8;
+    // motion ticks and interpolated transforms of the last update
+    size_t lastAnimated = 0;
+
+    Entity create(Model* model, const Transform& transform, const std::string& name)
+    {
+        Entity entity = (Entity)size();
+        transforms.position.push_back(transform.getPosition());
+        transforms.rotation.push_back(transform.getRotation());
+        transforms.orientation.push_back(quatFromEuler(transform.getRotation()));
+        transforms.scale.push_back(transform.getScale());
+        transforms.world.push_back(AffineRecord());
+        transforms.dirty.push_back(1);
+        transforms.version.push_back(0);
+
+        motion.moving.push_back(0);
+        motion.driven.push_back(0);
+        motion.followed.push_back(0);
+        motion.radius.push_back(15.0f);
+        motion.speed.push_back(0.5f);
+        motion.angle.push_back(0.0f);
+        motion.previousAngle.push_back(0.0f);
+        motion.elapsed.push_back(0.0f);
+        motion.tickSpan.push_back(0.0f);
+        motion.lag.push_back(0.0f);
+
+        render.model.push_back(model);
+        render.instanced.push_back(0);
+        render.skinned.push_back(0);
+        render.name.push_back(name);
+
+        bounds.local.push_back(model ? model->getBoundingSphere() : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        bounds.world.push_back(glm::vec4(0.0f));
+        visibleFlags.push_back(0);
+        return entity;
+    }
+
+    // result of the last cull()
+    bool isVisible(Entity entity) const
+    {
+        return visibleFlags[entity] != 0;
+    }
+
+    // Whether the system of a driven entity writes its transform this frame, visible ones always. Whatever it
+    // skips has to be added to motion.lag, and the lag reset when it writes.
+    bool isTransformDue(Entity entity) const
+    {
+        const uint32_t interval = visibleFlags[entity] ? 1 : glm::max(getTickInterval(entity), 1u);
+        return (frame + (uint32_t)entity) % interval == 0;
+    }
+
+    size_t size() const
+    {
+        return transforms.position.size();
+    }
+
+    void reserve(size_t count)
+    {
+        transforms.position.reserve(count);
+        transforms.rotation.reserve(count);
+        transforms.orientation.reserve(count);
+        transforms.scale.reserve(count);
+        transforms.world.reserve(count);
+        transforms.dirty.reserve(count);
+        transforms.version.reserve(count);
+        motion.moving.reserve(count);
+        motion.driven.reserve(count);
+        motion.followed.reserve(count);
+        motion.radius.reserve(count);
+        motion.speed.reserve(count);
+        motion.angle.reserve(count);
+        motion.previousAngle.reserve(count);
+        motion.elapsed.reserve(count);
+        motion.tickSpan.reserve(count);
+        motion.lag.reserve(count);
+        render.model.reserve(count);
+        render.instanced.reserve(count);
+        render.skinned.reserve(count);
+        render.name.reserve(count);
+        bounds.local.reserve(count);
+        bounds.world.reserve(count);
+        visibleFlags.reserve(count);
+    }
+
+    void setPosition(Entity entity, const glm::vec3& position)
+    {
+        transforms.position[entity] = position;
+        transforms.dirty[entity] = 1;
+    }
+
+    void setRotation(Entity entity, const glm::vec3& rotation)
+    {
+        transforms.rotation[entity] = rotation;
+        transforms.orientation[entity] = quatFromEuler(rotation);
+        transforms.dirty[entity] = 1;
+    }
+
+    void setScale(Entity entity, const glm::vec3& scale)
+    {
+        transforms.scale[entity] = scale;
+        transforms.dirty[entity] = 1;
+    }
+
+    // Motion, transform and bounds systems, fused per chunk so a chunk's data is still in cache for the next system
+    void update(float deltaTime)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::atomic<size_t> animated(0);
+        JobSystem::instance().parallelFor(size(), chunkSize, [&](size_t begin, size_t end)
+            {
+                animated += updateMotion(begin, end, deltaTime);
+                updateTransforms(begin, end);
+            });
+        lastAnimated = animated;
+        frame++;
+        lastUpdateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Tests the world bounding spheres against the frustum and compacts the visible entities into `visible`
+    void cull(const Frustum& frustum)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        JobSystem& jobs = JobSystem::instance();
+        const size_t count = size();
+        const size_t chunks = (count + chunkSize - 1) / chunkSize;
+        chunkVisible.assign(chunks, 0);
+
+        jobs.parallelFor(count, chunkSize, [&](size_t begin, size_t end)
+            {
+                uint32_t visibleCount = 0;
+                for (size_t i = begin; i < end; i++)
+                {
+                    const glm::vec4& sphere = bounds.world[i];
+                    uint8_t inside = frustum.intersectsSphere(glm::vec3(sphere), sphere.w + getMotionMargin(i)) ? 1 : 0;
+                    visibleFlags[i] = inside;
+                    visibleCount += inside;
+                }
+                chunkVisible[begin / chunkSize] = visibleCount;
+            });
+
+        // exclusive prefix sum gives every chunk its output offset
+        uint32_t total = 0;
+        for (uint32_t& chunkCount : chunkVisible)
+        {
+            uint32_t offset = total;
+            total += chunkCount;
+            chunkCount = offset;
+        }
+        visible.resize(total);
+
+        jobs.parallelFor(count, chunkSize, [&](size_t begin, size_t end)
+            {
+                uint32_t out = chunkVisible[begin / chunkSize];
+                for (size_t i = begin; i < end; i++)
+                {
+                    if (visibleFlags[i])
+                        visible[out++] = (Entity)i;
+                }
+            });
+        lastCullMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+private:
+    std::vector<uint8_t> visibleFlags;
+    std::vector<uint32_t> chunkVisible;
+    uint32_t frame = 0;
+
+    // frames between the motion ticks of an entity, from last frame's culling
+    uint32_t getTickInterval(size_t i) const
+    {
+        if (!animationLod || motion.followed[i])
+            return 1;
+        if (!visibleFlags[i])
+            return hiddenInterval;
+        return glm::length(transforms.position[i] - viewer) > animationLodDistance ? farInterval : 1;
+    }
+
+    // Hidden entities keep the transform of their last tick, which trails the simulated angle by that tick and
+    // everything since. Their sphere is widened by the arc they covered meanwhile, so an entity that moved into
+    // view is found this frame instead of on its next tick.
+    float getMotionMargin(size_t i) const
+    {
+        if (visibleFlags[i])
+            return 0.0f;
+        if (motion.driven[i])
+            return motion.lag[i];
+        if (!motion.moving[i])
+            return 0.0f;
+        const float radius = glm::abs(motion.radius[i]);
+        const float arc = glm::abs(motion.speed[i]) * (motion.tickSpan[i] + motion.elapsed[i]) * radius;
+        return glm::min(arc, 2.0f * radius);
+    }
+
+    // returns the number of entities it touched
+    size_t updateMotion(size_t begin, size_t end, float deltaTime)
+    {
+        size_t animated = 0;
+        for (size_t i = begin; i < end; i++)
+        {
+            if (!motion.moving[i])
+                continue;
+
+            const uint32_t interval = glm::max(getTickInterval(i), 1u);
+            motion.elapsed[i] += deltaTime;
+            float angle;
+            if ((frame + (uint32_t)i) % interval == 0)
+            {
+                // the drawn angle trails by one tick, so it reaches the old angle right as the new one is known
+                motion.previousAngle[i] = motion.angle[i];
+                motion.angle[i] += motion.speed[i] * motion.elapsed[i];
+                motion.tickSpan[i] = motion.elapsed[i];
+                motion.elapsed[i] = 0.0f;
+                angle = motion.previousAngle[i];
+            }
+            else if (!visibleFlags[i])
+            {
+                // nobody sees it, the transform waits for the next tick
+                continue;
+            }
+            else
+            {
+                const float t = motion.tickSpan[i] > 0.0f ? glm::min(motion.elapsed[i] / motion.tickSpan[i], 1.0f) : 1.0f;
+                angle = motion.previousAngle[i] + (motion.angle[i] - motion.previousAngle[i]) * t;
+            }
+            animated++;
+
+            float s = sin(angle);
+            float c = cos(angle);
+            transforms.position[i].x = motion.radius[i] * s;
+            transforms.position[i].z = motion.radius[i] * c;
+            // face the direction of movement
+            transforms.rotation[i].y = glm::degrees(atan2(-s, -c));
+            transforms.orientation[i] = quatFromEuler(transforms.rotation[i]);
+            transforms.dirty[i] = 1;
+        }
+        return animated;
+    }
+
+    // Rebuilds the world matrices of chunks containing a dirty entity with the batched kernel,
+    // static chunks cost a flag scan. Versions and world bounds only change for the dirty entities.
+    void updateTransforms(size_t begin, size_t end)
+    {
+        size_t firstDirty = begin;
+        while (firstDirty < end && !transforms.dirty[firstDirty])
+            firstDirty++;
+        if (firstDirty == end)
+            return;
+
+        TransformKernel::compose(&transforms.position[firstDirty], &transforms.orientation[firstDirty], &transforms.scale[firstDirty],
+            end - firstDirty, &transforms.world[firstDirty]);
+
+        for (size_t i = firstDirty; i < end; i++)
+        {
+            if (!transforms.dirty[i])
+                continue;
+            transforms.dirty[i] = 0;
+            transforms.version[i]++;
+
+            const glm::vec4& local = bounds.local[i];
+            const glm::vec3& scale = transforms.scale[i];
+            float maxScale = glm::max(glm::abs(scale.x), glm::max(glm::abs(scale.y), glm::abs(scale.z)));
+            bounds.world[i] = glm::vec4(transforms.world[i].transformPoint(glm::vec3(local)), local.w * maxScale);
+        }
+    }
+};
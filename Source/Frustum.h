@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// View frustum as six inward facing planes (xyz normal, w distance), extracted from a view-projection matrix
+struct Frustum
+{
+    glm::vec4 planes[6];
+    // optional range around the viewer (xyz position, w distance), spheres entirely outside it are rejected too
+    glm::vec4 range = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+
+    static Frustum fromMatrix(const glm::mat4& viewProjection)
+    {
+        // rows of the column-major matrix
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++)
+            row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+        Frustum frustum;
+        frustum.planes[0] = row[3] + row[0]; // left
+        frustum.planes[1] = row[3] - row[0]; // right
+        frustum.planes[2] = row[3] + row[1]; // bottom
+        frustum.planes[3] = row[3] - row[1]; // top
+        frustum.planes[4] = row[3] + row[2]; // near
+        frustum.planes[5] = row[3] - row[2]; // far
+        for (glm::vec4& plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+
+    // Frustum accepting every sphere, for disabled culling
+    static Frustum everything()
+    {
+        Frustum frustum;
+        for (glm::vec4& plane : frustum.planes)
+            plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return frustum;
+    }
+
+    // e.g. the fog distance, past which everything has the clear colour
+    void setRange(const glm::vec3& viewPos, float distance)
+    {
+        range = glm::vec4(viewPos, distance);
+    }
+
+    bool intersectsSphere(const glm::vec3& center, float radius) const
+    {
+        if (range.w >= 0.0f && glm::length(center - glm::vec3(range)) - radius > range.w)
+            return false;
+        for (const glm::vec4& plane : planes)
+        {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <iostream>
+
+// The bundled glad loader only covers core 4.0, everything newer is optional and loaded here.
+// Features are only used when GLCaps reports them, so the renderer still runs on a plain 4.0 context.
+
+#ifndef GL_VERSION_4_3
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_SHADER_STORAGE_BLOCK 0x92E6
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_DISPATCH_INDIRECT_BUFFER 0x90EE
+#define GL_ATOMIC_COUNTER_BUFFER 0x92C0
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#define GL_ELEMENT_ARRAY_BARRIER_BIT 0x00000002
+#define GL_UNIFORM_BARRIER_BIT 0x00000004
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint x, GLuint y, GLuint z);
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEINDIRECTPROC)(GLintptr indirect);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+typedef void (APIENTRYP PFNGLSHADERSTORAGEBLOCKBINDINGPROC)(GLuint program, GLuint storageBlockIndex, GLuint storageBlockBinding);
+typedef GLuint (APIENTRYP PFNGLGETPROGRAMRESOURCEINDEXPROC)(GLuint program, GLenum programInterface, const GLchar* name);
+
+inline PFNGLMULTIDRAWELEMENTSINDIRECTPROC glMultiDrawElementsIndirect = nullptr;
+inline PFNGLDISPATCHCOMPUTEPROC glDispatchCompute = nullptr;
+inline PFNGLDISPATCHCOMPUTEINDIRECTPROC glDispatchComputeIndirect = nullptr;
+inline PFNGLMEMORYBARRIERPROC glMemoryBarrier = nullptr;
+inline PFNGLSHADERSTORAGEBLOCKBINDINGPROC glShaderStorageBlockBinding = nullptr;
+inline PFNGLGETPROGRAMRESOURCEINDEXPROC glGetProgramResourceIndex = nullptr;
+#endif
+
+#ifndef GL_ARB_bindless_texture
+typedef GLuint64 (APIENTRYP PFNGLGETTEXTUREHANDLEARBPROC)(GLuint texture);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(GLuint64 handle);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)(GLuint64 handle);
+
+inline PFNGLGETTEXTUREHANDLEARBPROC glGetTextureHandleARB = nullptr;
+inline PFNGLMAKETEXTUREHANDLERESIDENTARBPROC glMakeTextureHandleResidentARB = nullptr;
+inline PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC glMakeTextureHandleNonResidentARB = nullptr;
+#endif
+
+class GLCaps
+{
+public:
+    int major = 4;
+    int minor = 0;
+
+    bool multiDrawIndirect = false;  // also implies base instance
+    bool shaderStorage = false;
+    bool computeShader = false;
+    bool bindlessTexture = false;
+    // lifts the dynamically uniform restriction on samplers, also for bindless handles
+    bool gpuShader5 = false;
+
+    static GLCaps& instance()
+    {
+        static GLCaps caps;
+        return caps;
+    }
+
+    // Call once after gladLoadGLLoader, with the same loader
+    void load(GLADloadproc loader)
+    {
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        const bool core43 = major > 4 || (major == 4 && minor >= 3);
+
+#ifndef GL_VERSION_4_3
+        glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)loader("glMultiDrawElementsIndirect");
+        glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)loader("glDispatchCompute");
+        glDispatchComputeIndirect = (PFNGLDISPATCHCOMPUTEINDIRECTPROC)loader("glDispatchComputeIndirect");
+        glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)loader("glMemoryBarrier");
+        glShaderStorageBlockBinding = (PFNGLSHADERSTORAGEBLOCKBINDINGPROC)loader("glShaderStorageBlockBinding");
+        glGetProgramResourceIndex = (PFNGLGETPROGRAMRESOURCEINDEXPROC)loader("glGetProgramResourceIndex");
+#endif
+#ifndef GL_ARB_bindless_texture
+        glGetTextureHandleARB = (PFNGLGETTEXTUREHANDLEARBPROC)loader("glGetTextureHandleARB");
+        glMakeTextureHandleResidentARB = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)loader("glMakeTextureHandleResidentARB");
+        glMakeTextureHandleNonResidentARB = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)loader("glMakeTextureHandleNonResidentARB");
+#endif
+
+        multiDrawIndirect = (core43 || hasExtension("GL_ARB_multi_draw_indirect")) && glMultiDrawElementsIndirect;
+        shaderStorage = (core43 || hasExtension("GL_ARB_shader_storage_buffer_object")) && glShaderStorageBlockBinding && glGetProgramResourceIndex;
+        computeShader = (core43 || hasExtension("GL_ARB_compute_shader")) && glDispatchCompute && glMemoryBarrier;
+        bindlessTexture = hasExtension("GL_ARB_bindless_texture") && glGetTextureHandleARB && glMakeTextureHandleResidentARB;
+        gpuShader5 = hasExtension("GL_NV_gpu_shader5");
+
+        std::cout << "OpenGL " << major << "." << minor
+            << " multi draw indirect: " << multiDrawIndirect
+            << ", shader storage: " << shaderStorage
+            << ", compute: " << computeShader
+            << ", bindless textures: " << bindlessTexture
+            << ", gpu shader 5: " << gpuShader5 << std::endl;
+    }
+
+    bool hasExtension(const char* name) const
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (extension && std::strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+private:
+    GLCaps() = default;
+};
@@ -0,0 +1,383 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "GLExtensions.h"
+
+#include <cstdint>
+
+// Thin shadow of the OpenGL binding/fixed-function state.
+// Every setter compares against the cached value and only reaches the driver when something changes,
+// so draw code can bind what it needs without caring what the previous draw left behind.
+// All GL objects that may be bound through the cache must also be deleted through it,
+// otherwise a recycled object name could be mistaken for the one that is still "bound".
+
+#define MAX_TEXTURE_UNITS 16
+#define MAX_BUFFER_BINDINGS 16
+
+// Immutable fixed-function state for one kind of pass (opaque, wireframe, transparent...).
+// Applying it through GLState only touches the parts that differ from the current state.
+struct PipelineStateDesc
+{
+    bool depthTest = true;
+    bool depthWrite = true;
+    GLenum depthFunc = GL_LESS;
+
+    bool blend = false;
+    GLenum blendSrc = GL_SRC_ALPHA;
+    GLenum blendDst = GL_ONE_MINUS_SRC_ALPHA;
+
+    bool cullFace = false;
+    GLenum cullMode = GL_BACK;
+
+    GLenum polygonMode = GL_FILL;
+};
+
+class PipelineState
+{
+public:
+    explicit PipelineState(const PipelineStateDesc& desc = PipelineStateDesc()) : desc(desc) {}
+
+    const PipelineStateDesc& getDesc() const { return desc; }
+
+private:
+    const PipelineStateDesc desc;
+};
+
+class GLState
+{
+public:
+    struct FrameStats
+    {
+        unsigned int issued = 0;
+        unsigned int elided = 0;
+    };
+
+    static GLState& instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    // Counters are accumulated into the current frame and published on beginFrame()
+    void beginFrame()
+    {
+        lastFrame = current;
+        current = FrameStats();
+    }
+
+    const FrameStats& getLastFrameStats() const { return lastFrame; }
+
+    // Forget everything, next calls will always reach the driver (use after foreign code touched GL state)
+    void invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        elementBuffer = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+        {
+            textures[i] = { UNKNOWN, UNKNOWN };
+            samplers[i] = UNKNOWN;
+        }
+        for (auto& buffer : buffers)
+            buffer.id = UNKNOWN;
+        for (int i = 0; i < MAX_BUFFER_BINDINGS; i++)
+        {
+            uniformBindings[i] = { UNKNOWN, 0, 0 };
+            storageBindings[i] = { UNKNOWN, 0, 0 };
+        }
+        depthTest = depthWrite = blend = cullFace = UNKNOWN;
+        depthFunc = blendSrc = blendDst = cullMode = polygonMode = UNKNOWN;
+    }
+
+    // ------------------------------------------------------------------------
+    void useProgram(GLuint id)
+    {
+        if (!changed(program, id))
+            return;
+        glUseProgram(id);
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (!changed(vertexArray, id))
+            return;
+        glBindVertexArray(id);
+        // element array binding is part of the VAO
+        elementBuffer = UNKNOWN;
+    }
+
+    void bindBuffer(GLenum target, GLuint id)
+    {
+        if (target == GL_ELEMENT_ARRAY_BUFFER)
+        {
+            if (!changed(elementBuffer, id))
+                return;
+            glBindBuffer(target, id);
+            return;
+        }
+
+        BufferSlot* slot = findBufferSlot(target);
+        if (slot && !changed(slot->id, id))
+            return;
+        if (!slot)
+            current.issued++;
+        glBindBuffer(target, id);
+    }
+
+    // Indexed binding points (uniform blocks, shader storage blocks).
+    // Binding a range also changes the generic binding of the target, which is tracked as well.
+    void bindBufferRange(GLenum target, GLuint index, GLuint id, GLintptr offset, GLsizeiptr size)
+    {
+        IndexedSlot* slot = findIndexedSlot(target, index);
+        if (slot && slot->id == id && slot->offset == offset && slot->size == size)
+        {
+            current.elided++;
+            return;
+        }
+        current.issued++;
+        if (size == 0)
+            glBindBufferBase(target, index, id);
+        else
+            glBindBufferRange(target, index, id, offset, size);
+        if (slot)
+            *slot = { id, offset, size };
+        if (BufferSlot* generic = findBufferSlot(target))
+            generic->id = id;
+    }
+
+    void bindBufferBase(GLenum target, GLuint index, GLuint id)
+    {
+        bindBufferRange(target, index, id, 0, 0);
+    }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        if (unit >= MAX_TEXTURE_UNITS)
+        {
+            current.issued += 2;
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(target, id);
+            activeUnit = unit;
+            return;
+        }
+
+        TextureSlot& slot = textures[unit];
+        if (slot.target == target && slot.id == id)
+        {
+            current.elided++;
+            return;
+        }
+        setActiveUnit(unit);
+        current.issued++;
+        glBindTexture(target, id);
+        slot = { target, id };
+    }
+
+    void bindSampler(GLuint unit, GLuint id)
+    {
+        if (unit < MAX_TEXTURE_UNITS && !changed(samplers[unit], id))
+            return;
+        if (unit >= MAX_TEXTURE_UNITS)
+            current.issued++;
+        glBindSampler(unit, id);
+    }
+
+    // Texture uploads need a bound texture, this keeps the cache coherent while doing it. The upload calls act
+    // on the active unit, so unit 0 is made active even when the texture is already bound there
+    void bindTextureForUpload(GLenum target, GLuint id)
+    {
+        setActiveUnit(0);
+        bindTexture(0, target, id);
+    }
+
+    // ------------------------------------------------------------------------
+    void setDepthTest(bool enabled) { setCapability(GL_DEPTH_TEST, depthTest, enabled); }
+    void setBlend(bool enabled) { setCapability(GL_BLEND, blend, enabled); }
+    void setCullFace(bool enabled) { setCapability(GL_CULL_FACE, cullFace, enabled); }
+
+    void setDepthWrite(bool enabled)
+    {
+        if (!changed(depthWrite, enabled ? 1u : 0u))
+            return;
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+    }
+
+    void setDepthFunc(GLenum func)
+    {
+        if (!changed(depthFunc, func))
+            return;
+        glDepthFunc(func);
+    }
+
+    void setBlendFunc(GLenum src, GLenum dst)
+    {
+        if (blendSrc == src && blendDst == dst)
+        {
+            current.elided++;
+            return;
+        }
+        current.issued++;
+        glBlendFunc(src, dst);
+        blendSrc = src;
+        blendDst = dst;
+    }
+
+    void setCullMode(GLenum mode)
+    {
+        if (!changed(cullMode, mode))
+            return;
+        glCullFace(mode);
+    }
+
+    void setPolygonMode(GLenum mode)
+    {
+        if (!changed(polygonMode, mode))
+            return;
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+    }
+
+    // Applies only the delta between the pipeline state and what is currently set
+    void apply(const PipelineState& pipeline)
+    {
+        const PipelineStateDesc& desc = pipeline.getDesc();
+        setDepthTest(desc.depthTest);
+        setDepthWrite(desc.depthWrite);
+        setDepthFunc(desc.depthFunc);
+        setBlend(desc.blend);
+        if (desc.blend)
+            setBlendFunc(desc.blendSrc, desc.blendDst);
+        setCullFace(desc.cullFace);
+        if (desc.cullFace)
+            setCullMode(desc.cullMode);
+        setPolygonMode(desc.polygonMode);
+    }
+
+    // ------------------------------------------------------------------------
+    // Deleting an object unbinds it, the cache has to follow, otherwise a recycled name would be elided
+    void deleteVertexArray(GLuint id)
+    {
+        if (vertexArray == id)
+        {
+            vertexArray = 0;
+            elementBuffer = UNKNOWN;
+        }
+        glDeleteVertexArrays(1, &id);
+    }
+
+    void deleteBuffer(GLuint id)
+    {
+        if (elementBuffer == id)
+            elementBuffer = UNKNOWN;
+        for (auto& buffer : buffers)
+            if (buffer.id == id)
+                buffer.id = 0;
+        for (int i = 0; i < MAX_BUFFER_BINDINGS; i++)
+        {
+            if (uniformBindings[i].id == id)
+                uniformBindings[i] = { 0, 0, 0 };
+            if (storageBindings[i].id == id)
+                storageBindings[i] = { 0, 0, 0 };
+        }
+        glDeleteBuffers(1, &id);
+    }
+
+    void deleteTexture(GLuint id)
+    {
+        for (auto& texture : textures)
+            if (texture.id == id)
+                texture = { UNKNOWN, UNKNOWN };
+        glDeleteTextures(1, &id);
+    }
+
+    void deleteProgram(GLuint id)
+    {
+        if (program == id)
+            program = UNKNOWN;
+        glDeleteProgram(id);
+    }
+
+private:
+    static constexpr GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    struct TextureSlot { GLuint target; GLuint id; };
+    struct BufferSlot { GLenum target; GLuint id; };
+    struct IndexedSlot { GLuint id; GLintptr offset; GLsizeiptr size; };
+
+    GLuint program = UNKNOWN;
+    GLuint vertexArray = UNKNOWN;
+    GLuint elementBuffer = UNKNOWN;
+    GLuint activeUnit = UNKNOWN;
+    TextureSlot textures[MAX_TEXTURE_UNITS];
+    GLuint samplers[MAX_TEXTURE_UNITS];
+    BufferSlot buffers[8] = {
+        { GL_ARRAY_BUFFER, UNKNOWN },
+        { GL_UNIFORM_BUFFER, UNKNOWN },
+        { GL_TEXTURE_BUFFER, UNKNOWN },
+        { GL_COPY_READ_BUFFER, UNKNOWN },
+        { GL_COPY_WRITE_BUFFER, UNKNOWN },
+        { GL_DRAW_INDIRECT_BUFFER, UNKNOWN },
+        { GL_TRANSFORM_FEEDBACK_BUFFER, UNKNOWN },
+        { GL_SHADER_STORAGE_BUFFER, UNKNOWN },
+    };
+    IndexedSlot uniformBindings[MAX_BUFFER_BINDINGS];
+    IndexedSlot storageBindings[MAX_BUFFER_BINDINGS];
+
+    GLuint depthTest, depthWrite, blend, cullFace;
+    GLuint depthFunc, blendSrc, blendDst, cullMode, polygonMode;
+
+    FrameStats current;
+    FrameStats lastFrame;
+
+    GLState() { invalidate(); }
+
+    // Updates the cached value and counts the call as issued or elided
+    bool changed(GLuint& cached, GLuint value)
+    {
+        if (cached == value)
+        {
+            current.elided++;
+            return false;
+        }
+        current.issued++;
+        cached = value;
+        return true;
+    }
+
+    void setCapability(GLenum capability, GLuint& cached, bool enabled)
+    {
+        if (!changed(cached, enabled ? 1u : 0u))
+            return;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+    void setActiveUnit(GLuint unit)
+    {
+        if (!changed(activeUnit, unit))
+            return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    BufferSlot* findBufferSlot(GLenum target)
+    {
+        for (auto& buffer : buffers)
+            if (buffer.target == target)
+                return &buffer;
+        return nullptr;
+    }
+
+    IndexedSlot* findIndexedSlot(GLenum target, GLuint index)
+    {
+        if (index >= MAX_BUFFER_BINDINGS)
+            return nullptr;
+        if (target == GL_UNIFORM_BUFFER)
+            return &uniformBindings[index];
+        if (target == GL_SHADER_STORAGE_BUFFER)
+            return &storageBindings[index];
+        return nullptr;
+    }
+};
@@ -0,0 +1,498 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "EntityWorld.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Material.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Hierarchical LOD for static entities. Entities are clustered on a grid and the clusters are grouped
+// into coarser parents, every node gets one proxy mesh: its members' meshes merged in world space,
+// simplified by vertex clustering and textured from a single atlas of their downsampled diffuse maps.
+// A node far enough away is then one draw instead of one per entity and mesh.
+class HlodBuilder
+{
+public:
+    struct Stats
+    {
+        int nodes = 0;
+        int sourceTriangles = 0;
+        int proxyTriangles = 0;
+        float buildMs = 0.0f;
+    };
+
+    // edge of a level 0 cluster, every level doubles it
+    float clusterSize = 32.0f;
+    int levels = 3;
+    // simplification grid cells along a node's bounding sphere diameter
+    int cellsPerNode = 48;
+    // pixels per atlas side, every material of a node gets a square tile
+    int atlasSize = 256;
+    // a level 0 proxy replaces its members past this distance, every level doubles it
+    float switchDistance = 30.0f;
+    Stats stats;
+
+    // results of select(), per entity whether a proxy draws it
+    std::vector<uint8_t> covered;
+    size_t selectedProxies = 0;
+    size_t coveredEntities = 0;
+
+    // World matrices have to be up to date. Runs before MaterialLibrary::build(), the atlases become
+    // materials and the source textures are read back before they are packed.
+    void build(const EntityWorld& world, const std::vector<Entity>& candidates)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        nodes.clear();
+        roots.clear();
+        stats = Stats();
+
+        // level 0, static entities small enough to share a cluster (not the floor)
+        std::vector<int> current = groupEntities(world, candidates);
+        for (int level = 1; level < levels; level++)
+        {
+            std::vector<int> parents = groupNodes(world, current, level);
+            // nothing left to merge
+            if (parents.size() == current.size())
+            {
+                nodes.resize(nodes.size() - parents.size());
+                break;
+            }
+            current = parents;
+        }
+        roots = current;
+        fitMaterialBudget();
+
+        std::vector<std::map<unsigned int, int>> tiles(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            for (Entity entity : nodes[i].members)
+            {
+                for (const Mesh& mesh : world.render.model[entity]->meshes)
+                    tiles[i].emplace(mesh.materialIndex, (int)tiles[i].size());
+            }
+            // the GL work stays on this thread
+            for (const auto& tile : tiles[i])
+                getMaterialPixels(tile.first);
+        }
+
+        std::vector<ProxyData> proxies(nodes.size());
+        JobSystem::instance().parallelFor(nodes.size(), 1, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; i++)
+                    simplify(world, nodes[i], tiles[i], proxies[i]);
+            });
+
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            upload(nodes[i], proxies[i], buildAtlas(tiles[i]));
+            stats.sourceTriangles += nodes[i].level == 0 ? proxies[i].sourceTriangles : 0;
+            stats.proxyTriangles += (int)proxies[i].indices.size() / 3;
+        }
+        materialPixels.clear();
+        stats.nodes = (int)nodes.size();
+        stats.buildMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Picks the proxies top down, the coarsest node past its switch distance wins
+    void select(const EntityWorld& world, const glm::vec3& viewPos, const Frustum& frustum)
+    {
+        covered.assign(world.size(), 0);
+        selected.clear();
+        coveredEntities = 0;
+        for (int root : roots)
+            selectNode(world, root, viewPos, frustum);
+        selectedProxies = selected.size();
+    }
+
+    // shader is the object shader with its per frame uniforms set, proxies are in world space
+    void draw(Shader& shader)
+    {
+        if (selected.empty())
+            return;
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        GLState& state = GLState::instance();
+        shader.setModelMatrix(glm::mat4(1.0f));
+        for (int index : selected)
+        {
+            const Node& node = nodes[index];
+            if (!library.isBindless())
+                library.get(node.material).bind();
+            glVertexAttribI1ui(MATERIAL_ATTRIBUTE, node.material);
+            state.bindVertexArray(node.VAO);
+            glDrawElements(GL_TRIANGLES, node.count, GL_UNSIGNED_INT, 0);
+        }
+    }
+
+private:
+    struct Node
+    {
+        int level = 0;
+        glm::vec4 sphere = glm::vec4(0.0f);  // world space
+        std::vector<Entity> members;         // every entity below the node
+        std::vector<uint32_t> versions;      // transform versions of the members at build time
+        std::vector<int> children;
+        GLuint VAO = 0, VBO = 0, EBO = 0;
+        GLsizei count = 0;
+        unsigned int material = 0;
+    };
+
+    struct ProxyData
+    {
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        int sourceTriangles = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> roots;
+    std::vector<int> selected;
+    // diffuse maps box filtered to atlasSize, only while building
+    std::map<unsigned int, std::vector<unsigned char>> materialPixels;
+
+    typedef std::tuple<int, int, int> CellKey;
+
+    static CellKey getCell(const glm::vec3& position, float size)
+    {
+        return CellKey((int)std::floor(position.x / size), (int)std::floor(position.y / size), (int)std::floor(position.z / size));
+    }
+
+    std::vector<int> groupEntities(const EntityWorld& world, const std::vector<Entity>& candidates)
+    {
+        std::map<CellKey, int> cells;
+        std::vector<int> created;
+        for (Entity entity : candidates)
+        {
+            const glm::vec4& sphere = world.bounds.world[entity];
+            if (!world.render.model[entity] || world.render.instanced[entity] || world.render.skinned[entity] || world.motion.moving[entity]
+                || world.motion.driven[entity] || sphere.w > clusterSize)
+                continue;
+            auto found = cells.find(getCell(glm::vec3(sphere), clusterSize));
+            if (found == cells.end())
+            {
+                found = cells.emplace(getCell(glm::vec3(sphere), clusterSize), (int)nodes.size()).first;
+                created.push_back((int)nodes.size());
+                nodes.emplace_back();
+            }
+            nodes[found->second].members.push_back(entity);
+            nodes[found->second].versions.push_back(world.transforms.version[entity]);
+        }
+        for (int index : created)
+            nodes[index].sphere = getBoundingSphere(world, nodes[index].members);
+        return created;
+    }
+
+    // parents are appended after their children
+    std::vector<int> groupNodes(const EntityWorld& world, const std::vector<int>& children, int level)
+    {
+        const float size = clusterSize * (float)(1 << level);
+        std::map<CellKey, int> cells;
+        std::vector<int> created;
+        for (int child : children)
+        {
+            const CellKey key = getCell(glm::vec3(nodes[child].sphere), size);
+            auto found = cells.find(key);
+            if (found == cells.end())
+            {
+                found = cells.emplace(key, (int)nodes.size()).first;
+                created.push_back((int)nodes.size());
+                nodes.emplace_back();
+                nodes.back().level = level;
+            }
+            Node& parent = nodes[found->second];
+            parent.children.push_back(child);
+            parent.members.insert(parent.members.end(), nodes[child].members.begin(), nodes[child].members.end());
+            parent.versions.insert(parent.versions.end(), nodes[child].versions.begin(), nodes[child].versions.end());
+        }
+        for (int index : created)
+            nodes[index].sphere = getBoundingSphere(world, nodes[index].members);
+        return created;
+    }
+
+    glm::vec4 getBoundingSphere(const EntityWorld& world, const std::vector<Entity>& members) const
+    {
+        glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+        for (Entity entity : members)
+        {
+            const glm::vec4& sphere = world.bounds.world[entity];
+            low = glm::min(low, glm::vec3(sphere) - sphere.w);
+            high = glm::max(high, glm::vec3(sphere) + sphere.w);
+        }
+        const glm::vec3 center = (low + high) * 0.5f;
+        float radius = 0.0f;
+        for (Entity entity : members)
+        {
+            const glm::vec4& sphere = world.bounds.world[entity];
+            radius = glm::max(radius, glm::length(glm::vec3(sphere) - center) + sphere.w);
+        }
+        return glm::vec4(center, radius);
+    }
+
+    void selectNode(const EntityWorld& world, int index, const glm::vec3& viewPos, const Frustum& frustum)
+    {
+        const Node& node = nodes[index];
+        // the world culls the members themselves
+        if (!frustum.intersectsSphere(glm::vec3(node.sphere), node.sphere.w))
+            return;
+        const float distance = glm::length(glm::vec3(node.sphere) - viewPos) - node.sphere.w;
+        if (node.count > 0 && distance > switchDistance * (float)(1 << node.level) && isCurrent(world, node))
+        {
+            for (Entity entity : node.members)
+                covered[entity] = 1;
+            coveredEntities += node.members.size();
+            selected.push_back(index);
+            return;
+        }
+        for (int child : node.children)
+            selectNode(world, child, viewPos, frustum);
+    }
+
+    // a member moved in the editor since the build, its proxy is stale and the members are drawn themselves
+    static bool isCurrent(const EntityWorld& world, const Node& node)
+    {
+        for (size_t i = 0; i < node.members.size(); i++)
+        {
+            if (world.transforms.version[node.members[i]] != node.versions[i])
+                return false;
+        }
+        return true;
+    }
+
+    // Every node becomes one material, the ones past MAX_MATERIALS would silently draw with the default one.
+    // The coarsest levels are dropped until the rest fits, without a level left the members draw themselves.
+    void fitMaterialBudget()
+    {
+        const size_t used = MaterialLibrary::instance().size();
+        const size_t budget = used < MAX_MATERIALS ? MAX_MATERIALS - used : 0;
+        if (nodes.size() <= budget)
+            return;
+
+        std::cout << "ERROR::HLOD::MATERIAL_BUDGET: " << nodes.size() << " nodes but " << budget
+            << " materials left, dropping the coarsest levels" << std::endl;
+        // parents come after their children, so a level is a tail of the nodes
+        while (!nodes.empty() && nodes.size() > budget)
+        {
+            const int level = nodes.back().level;
+            while (!nodes.empty() && nodes.back().level == level)
+                nodes.pop_back();
+        }
+        roots.clear();
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].level == nodes.back().level)
+                roots.push_back((int)i);
+        }
+    }
+
+    const std::vector<unsigned char>& getMaterialPixels(unsigned int material)
+    {
+        auto found = materialPixels.find(material);
+        if (found != materialPixels.end())
+            return found->second;
+
+        int width, height;
+        const GLuint source = TextureArrayPool::instance().getSource(MaterialLibrary::instance().get(material).diffuseTexture, width, height);
+        std::vector<unsigned char> pixels((size_t)width * height * 4);
+        GLState::instance().bindTextureForUpload(GL_TEXTURE_2D, source);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+        std::vector<unsigned char>& filtered = materialPixels[material];
+        resample(pixels.data(), width, height, filtered, atlasSize);
+        return filtered;
+    }
+
+    // box filter to a size x size square, nearest when enlarging
+    static void resample(const unsigned char* source, int width, int height, std::vector<unsigned char>& target, int size)
+    {
+        target.assign((size_t)size * size * 4, 0);
+        for (int y = 0; y < size; y++)
+        {
+            const int y0 = y * height / size;
+            const int y1 = glm::max(y0 + 1, (y + 1) * height / size);
+            for (int x = 0; x < size; x++)
+            {
+                const int x0 = x * width / size;
+                const int x1 = glm::max(x0 + 1, (x + 1) * width / size);
+                int sum[4] = { 0, 0, 0, 0 };
+                for (int sy = y0; sy < y1; sy++)
+                {
+                    for (int sx = x0; sx < x1; sx++)
+                    {
+                        for (int c = 0; c < 4; c++)
+                            sum[c] += source[((size_t)sy * width + sx) * 4 + c];
+                    }
+                }
+                const int count = (x1 - x0) * (y1 - y0);
+                for (int c = 0; c < 4; c++)
+                    target[((size_t)y * size + x) * 4 + c] = (unsigned char)(sum[c] / count);
+            }
+        }
+    }
+
+    int getTilesPerSide(size_t tileCount) const
+    {
+        return glm::max(1, (int)std::ceil(std::sqrt((double)tileCount)));
+    }
+
+    // uv offset and scale of a tile, inset by half a texel so filtering stays inside it
+    glm::vec4 getTileRect(int tile, size_t tileCount) const
+    {
+        const int perSide = getTilesPerSide(tileCount);
+        const float tileSize = (float)(atlasSize / perSide);
+        const glm::vec2 origin((float)(tile % perSide) * tileSize, (float)(tile / perSide) * tileSize);
+        const glm::vec2 offset = (origin + 0.5f) / (float)atlasSize;
+        const float scale = (tileSize - 1.0f) / (float)atlasSize;
+        return glm::vec4(offset.x, offset.y, scale, scale);
+    }
+
+    int buildAtlas(const std::map<unsigned int, int>& tiles)
+    {
+        const int perSide = getTilesPerSide(tiles.size());
+        const int tileSize = atlasSize / perSide;
+        std::vector<unsigned char> atlas((size_t)atlasSize * atlasSize * 4, 255);
+        std::vector<unsigned char> tilePixels;
+        for (const auto& tile : tiles)
+        {
+            resample(materialPixels[tile.first].data(), atlasSize, atlasSize, tilePixels, tileSize);
+            const int originX = (tile.second % perSide) * tileSize;
+            const int originY = (tile.second / perSide) * tileSize;
+            for (int y = 0; y < tileSize; y++)
+                std::copy(tilePixels.begin() + (size_t)y * tileSize * 4, tilePixels.begin() + (size_t)(y + 1) * tileSize * 4,
+                    atlas.begin() + ((size_t)(originY + y) * atlasSize + originX) * 4);
+        }
+        return TextureArrayPool::instance().addPixels(atlas, atlasSize, atlasSize);
+    }
+
+    // Vertex clustering: vertices falling into the same grid cell with the same tile become one vertex
+    // at their average, triangles left with fewer than three distinct vertices are dropped
+    void simplify(const EntityWorld& world, const Node& node, const std::map<unsigned int, int>& tiles, ProxyData& proxy) const
+    {
+        struct Cluster
+        {
+            glm::vec3 position = glm::vec3(0.0f);
+            glm::vec3 normal = glm::vec3(0.0f);
+            glm::vec2 uv = glm::vec2(0.0f);
+            int count = 0;
+            int tile = 0;
+        };
+
+        const glm::vec3 low = glm::vec3(node.sphere) - node.sphere.w;
+        const float cellSize = 2.0f * node.sphere.w / (float)cellsPerNode;
+        std::unordered_map<uint64_t, uint32_t> clusterIndices;
+        std::vector<Cluster> clusters;
+        std::unordered_set<uint64_t> triangles;
+        std::vector<uint32_t> remap;
+
+        for (Entity entity : node.members)
+        {
+            const glm::mat4 model = world.transforms.world[entity].toMat4();
+            const glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(model));
+            for (const Mesh& mesh : world.render.model[entity]->meshes)
+            {
+                const int tile = tiles.at(mesh.materialIndex);
+                remap.resize(mesh.vertices.size());
+                for (size_t v = 0; v < mesh.vertices.size(); v++)
+                {
+                    const Vertex& vertex = mesh.vertices[v];
+                    const glm::vec3 position = glm::vec3(model * glm::vec4(vertex.Position, 1.0f));
+                    const glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor((position - low) / cellSize)), glm::ivec3(0), glm::ivec3(cellsPerNode - 1));
+                    const uint64_t key = (uint64_t)cell.x | ((uint64_t)cell.y << 16) | ((uint64_t)cell.z << 32) | ((uint64_t)tile << 48);
+                    auto found = clusterIndices.find(key);
+                    if (found == clusterIndices.end())
+                    {
+                        found = clusterIndices.emplace(key, (uint32_t)clusters.size()).first;
+                        clusters.emplace_back();
+                        clusters.back().tile = tile;
+                    }
+                    Cluster& cluster = clusters[found->second];
+                    cluster.position += position;
+                    cluster.normal += glm::normalize(normalMatrix * vertex.Normal);
+                    cluster.uv += wrap(vertex.TexCoords);
+                    cluster.count++;
+                    remap[v] = found->second;
+                }
+
+                proxy.sourceTriangles += (int)mesh.indices.size() / 3;
+                for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+                {
+                    uint32_t a = remap[mesh.indices[i]], b = remap[mesh.indices[i + 1]], c = remap[mesh.indices[i + 2]];
+                    if (a == b || b == c || a == c)
+                        continue;
+                    // rotated so the smallest index leads, opposite windings of a thin part both stay
+                    while (a > b || a > c)
+                    {
+                        const uint32_t first = a;
+                        a = b;
+                        b = c;
+                        c = first;
+                    }
+                    if (!triangles.insert((uint64_t)a | ((uint64_t)b << 21) | ((uint64_t)c << 42)).second)
+                        continue;
+                    proxy.indices.push_back(a);
+                    proxy.indices.push_back(b);
+                    proxy.indices.push_back(c);
+                }
+            }
+        }
+
+        proxy.vertices.resize(clusters.size());
+        for (size_t i = 0; i < clusters.size(); i++)
+        {
+            const Cluster& cluster = clusters[i];
+            const glm::vec4 rect = getTileRect(cluster.tile, tiles.size());
+            Vertex vertex = {};
+            vertex.Position = cluster.position / (float)cluster.count;
+            const float length = glm::length(cluster.normal);
+            vertex.Normal = length > 1e-6f ? cluster.normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+            vertex.TexCoords = glm::vec2(rect) + cluster.uv / (float)cluster.count * glm::vec2(rect.z, rect.w);
+            proxy.vertices[i] = vertex;
+        }
+    }
+
+    // tiled coordinates are wrapped per vertex, a triangle across a seam smears the tile, unnoticeable at proxy distances
+    static glm::vec2 wrap(const glm::vec2& uv)
+    {
+        return glm::vec2(uv.x >= 0.0f && uv.x <= 1.0f ? uv.x : uv.x - std::floor(uv.x),
+            uv.y >= 0.0f && uv.y <= 1.0f ? uv.y : uv.y - std::floor(uv.y));
+    }
+
+    void upload(Node& node, const ProxyData& proxy, int atlas)
+    {
+        node.material = MaterialLibrary::instance().add(atlas, -1, 32.0f);
+        node.count = (GLsizei)proxy.indices.size();
+        if (node.count == 0)
+            return;
+
+        GLState& state = GLState::instance();
+        glGenVertexArrays(1, &node.VAO);
+        glGenBuffers(1, &node.VBO);
+        glGenBuffers(1, &node.EBO);
+        state.bindVertexArray(node.VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, node.VBO);
+        glBufferData(GL_ARRAY_BUFFER, proxy.vertices.size() * sizeof(Vertex), proxy.vertices.data(), GL_STATIC_DRAW);
+        Mesh::setupVertexAttributes();
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, node.EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, proxy.indices.size() * sizeof(unsigned int), proxy.indices.data(), GL_STATIC_DRAW);
+        state.bindVertexArray(0);
+    }
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Shader.h"
+#include "TransformKernel.h"
+
+#include <iostream>
+#include <map>
+
+// units of the impostor atlases, after the material texture arrays
+#define IMPOSTOR_ALBEDO_UNIT 2
+#define IMPOSTOR_NORMAL_DEPTH_UNIT 3
+
+// Far field stand-ins for whole models. Every model is rendered once, at load, from frames x frames
+// directions spread over an octahedron into an albedo and a normal/depth atlas. A distant instance is
+// then a single camera facing quad (impostor.vs) blending the four closest frames and lit per pixel
+// from the baked normals, with its depth pushed back onto the baked surface.
+class ImpostorBaker
+{
+public:
+    struct Atlas
+    {
+        GLuint albedo = 0;      // rgb - unlit diffuse color, a - coverage
+        GLuint normalDepth = 0; // xyz - object space normal, w - depth across the bounding sphere
+        glm::vec4 sphere = glm::vec4(0.0f); // object space bounding sphere the frames are fitted to
+        int frames = 0;
+    };
+
+    // frames per side of the octahedral grid and their size in pixels
+    int frames = 8;
+    int frameSize = 128;
+
+    // Connects the atlas samplers of an IMPOSTOR program to their units, once per program
+    static void setupShader(const Shader& shader)
+    {
+        shader.use();
+        shader.setInt("impostorAlbedo", IMPOSTOR_ALBEDO_UNIT);
+        shader.setInt("impostorNormalDepth", IMPOSTOR_NORMAL_DEPTH_UNIT);
+    }
+
+    // same mapping as octahedralEncode in impostor.vs, p in [-1, 1]^2 and y is the up axis
+    static glm::vec3 octahedralDecode(const glm::vec2& p)
+    {
+        glm::vec3 direction(p.x, 1.0f - glm::abs(p.x) - glm::abs(p.y), p.y);
+        if (direction.y < 0.0f)
+        {
+            const float x = direction.x, z = direction.z;
+            direction.x = (1.0f - glm::abs(z)) * (x >= 0.0f ? 1.0f : -1.0f);
+            direction.z = (1.0f - glm::abs(x)) * (z >= 0.0f ? 1.0f : -1.0f);
+        }
+        return glm::normalize(direction);
+    }
+
+    // direction from the model towards the camera of frame (x, y)
+    static glm::vec3 getFrameDirection(int x, int y, int frames)
+    {
+        const glm::vec2 p = (glm::vec2((float)x, (float)y) + 0.5f) / (float)frames * 2.0f - 1.0f;
+        return octahedralDecode(p);
+    }
+
+    // same basis as frameBasis in impostor.vs, the quad is built from it
+    static void getFrameBasis(const glm::vec3& direction, glm::vec3& right, glm::vec3& up)
+    {
+        const glm::vec3 reference = glm::abs(direction.y) < 0.999f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+        right = glm::normalize(glm::cross(reference, direction));
+        up = glm::cross(direction, right);
+    }
+
+    bool has(Model* model) const
+    {
+        return atlases.count(model) != 0;
+    }
+
+    // bakeShader is the object shader compiled with IMPOSTOR_BAKE, the materials have to be built already
+    void bake(Model* model, Shader& bakeShader)
+    {
+        if (has(model))
+            return;
+        const glm::vec4 sphere = model->getBoundingSphere();
+        if (sphere.w <= 0.0f)
+            return;
+
+        Atlas atlas;
+        atlas.sphere = sphere;
+        atlas.frames = frames;
+        const int size = frames * frameSize;
+        atlas.albedo = createTarget(GL_RGBA8, size);
+        atlas.normalDepth = createTarget(GL_RGBA16F, size);
+
+        GLuint framebuffer, depthBuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlas.albedo, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, atlas.normalDepth, 0);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        const GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, buffers);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
+        {
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            // empty texels have no coverage, the runtime blend relies on them being zero
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            const glm::vec3 center(sphere);
+            const float radius = sphere.w;
+            bakeShader.use();
+            bakeShader.setModelMatrix(glm::mat4(1.0f));
+            // the camera is 2 radii away, so depth 0..1 spans the sphere front to back
+            bakeShader.setMat4("projection", glm::ortho(-radius, radius, -radius, radius, radius, 3.0f * radius));
+            for (int y = 0; y < frames; y++)
+            {
+                for (int x = 0; x < frames; x++)
+                {
+                    const glm::vec3 direction = getFrameDirection(x, y, frames);
+                    bakeShader.setMat4("view", getFrameView(direction, center, radius));
+                    glViewport(x * frameSize, y * frameSize, frameSize, frameSize);
+                    model->Draw(bakeShader);
+                }
+            }
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            atlases[model] = atlas;
+        }
+        else
+        {
+            std::cout << "ERROR::IMPOSTOR::FRAMEBUFFER_INCOMPLETE" << std::endl;
+            glDeleteTextures(1, &atlas.albedo);
+            glDeleteTextures(1, &atlas.normalDepth);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        glDeleteFramebuffers(1, &framebuffer);
+    }
+
+    // instances of a baked model, shader is the IMPOSTOR variant with its per frame uniforms set
+    void draw(Shader& shader, Model* model, const AffineRecord* instances, GLsizei instanceCount)
+    {
+        auto found = atlases.find(model);
+        if (found == atlases.end() || instanceCount <= 0)
+            return;
+        const Atlas& atlas = found->second;
+
+        GLState& state = GLState::instance();
+        if (VAO == 0)
+            createVertexArray();
+        // orphaned per model, the previous draw may still be reading the buffer
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instanceCount * sizeof(AffineRecord), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instanceCount * sizeof(AffineRecord), instances);
+
+        shader.use();
+        shader.setVec4("boundingSphere", atlas.sphere);
+        shader.setInt("impostorFrames", atlas.frames);
+        state.bindTexture(IMPOSTOR_ALBEDO_UNIT, GL_TEXTURE_2D, atlas.albedo);
+        state.bindTexture(IMPOSTOR_NORMAL_DEPTH_UNIT, GL_TEXTURE_2D, atlas.normalDepth);
+        state.bindVertexArray(VAO);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
+    }
+
+private:
+    std::map<Model*, Atlas> atlases;
+    GLuint VAO = 0, instanceBuffer = 0;
+
+    static GLuint createTarget(GLenum format, int size)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::instance().bindTextureForUpload(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, size, size, 0, GL_RGBA, GL_FLOAT, nullptr);
+        // no mipmaps, they would bleed neighbouring frames into each other
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    // orthographic camera looking at the center along -direction, rows are the frame basis
+    static glm::mat4 getFrameView(const glm::vec3& direction, const glm::vec3& center, float radius)
+    {
+        glm::vec3 right, up;
+        getFrameBasis(direction, right, up);
+        const glm::vec3 eye = center + direction * 2.0f * radius;
+        glm::mat4 view(1.0f);
+        for (int i = 0; i < 3; i++)
+        {
+            view[i][0] = right[i];
+            view[i][1] = up[i];
+            view[i][2] = direction[i];
+        }
+        view[3] = glm::vec4(-glm::dot(right, eye), -glm::dot(up, eye), -glm::dot(direction, eye), 1.0f);
+        return view;
+    }
+
+    void createVertexArray()
+    {
+        GLState& state = GLState::instance();
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &instanceBuffer);
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        // the quad's corners come from gl_VertexID
+        Mesh::setupInstanceAttributes();
+    }
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small persistent thread pool for data parallel loops over contiguous arrays.
+// parallelFor splits a range into chunks which are pulled by the workers and the calling thread.
+// It is not reentrant: the callback must not call parallelFor itself.
+class JobSystem
+{
+public:
+    static JobSystem& instance()
+    {
+        static JobSystem jobSystem;
+        return jobSystem;
+    }
+
+    // Threads taking part in a parallelFor, including the caller
+    size_t getThreadCount() const
+    {
+        return workers.size() + 1;
+    }
+
+    // Runs fn(begin, end) for consecutive chunks covering [0, count), returns once all chunks are done
+    void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& fn)
+    {
+        if (count == 0)
+            return;
+        chunkSize = std::max<size_t>(chunkSize, 1);
+        if (count <= chunkSize || workers.empty())
+        {
+            fn(0, count);
+            return;
+        }
+
+        std::lock_guard<std::mutex> submitLock(submitMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            jobCount = count;
+            jobChunkSize = chunkSize;
+            jobChunks = (count + chunkSize - 1) / chunkSize;
+            nextChunk = 0;
+            remainingChunks = jobChunks;
+            generation++;
+        }
+        wakeCondition.notify_all();
+
+        runChunks();
+
+        // wait for the chunks taken by workers, and for the workers to leave the job before it goes out of scope
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [this] { return remainingChunks == 0 && activeWorkers == 0; });
+        job = nullptr;
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wakeCondition.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex submitMutex;
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    bool stop = false;
+
+    // current job, written under mutex before generation changes
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    size_t jobCount = 0;
+    size_t jobChunkSize = 0;
+    size_t jobChunks = 0;
+    size_t generation = 0;
+    size_t activeWorkers = 0;
+    std::atomic<size_t> nextChunk{ 0 };
+    std::atomic<size_t> remainingChunks{ 0 };
+
+    JobSystem()
+    {
+        unsigned int threads = std::thread::hardware_concurrency();
+        // the calling thread works too
+        for (unsigned int i = 1; i < threads; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    void runChunks()
+    {
+        for (;;)
+        {
+            size_t chunk = nextChunk.fetch_add(1);
+            if (chunk >= jobChunks)
+                return;
+            size_t begin = chunk * jobChunkSize;
+            size_t end = std::min(begin + jobChunkSize, jobCount);
+            (*job)(begin, end);
+            if (remainingChunks.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                doneCondition.notify_all();
+            }
+        }
+    }
+
+    void workerLoop()
+    {
+        size_t seenGeneration = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCondition.wait(lock, [&] { return stop || (generation != seenGeneration && job != nullptr); });
+                if (stop)
+                    return;
+                seenGeneration = generation;
+                activeWorkers++;
+            }
+
+            runChunks();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                activeWorkers--;
+            }
+            doneCondition.notify_all();
+        }
+    }
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "PointLight.h"
+#include "Shader.h"
+
+#include <cstddef>
+#include <vector>
+
+// Point light gizmos drawn as one instanced triangle strip: every light is a camera facing quad that
+// ray traces its sphere per pixel and writes the sphere's depth (lightImpostor.vs, lightFragment.fs),
+// so no sphere mesh and no per light uniforms are needed.
+class LightGizmos
+{
+public:
+    struct Instance
+    {
+        glm::vec4 sphere;   // xyz - position, w - radius
+        glm::vec4 color;
+    };
+
+    // lightShader is the impostor shader with view, projection and fog set
+    void draw(Shader& lightShader, const std::vector<PointLight>& lights, float radius)
+    {
+        if (lights.empty())
+            return;
+
+        instances.clear();
+        for (const PointLight& light : lights)
+            instances.push_back({ glm::vec4(light.position, radius), glm::vec4(light.diffuse, 1.0f) });
+
+        GLState& state = GLState::instance();
+        if (VAO == 0)
+            createVertexArray();
+        // lights move with the UI, a fresh store every frame avoids waiting for the previous draw
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STREAM_DRAW);
+
+        lightShader.use();
+        state.bindVertexArray(VAO);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)instances.size());
+    }
+
+private:
+    GLuint VAO = 0, instanceBuffer = 0;
+    std::vector<Instance> instances;
+
+    void createVertexArray()
+    {
+        GLState& state = GLState::instance();
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &instanceBuffer);
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, sphere));
+        glVertexAttribDivisor(0, 1);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, color));
+        glVertexAttribDivisor(1, 1);
+    }
+};
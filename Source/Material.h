@@ -0,0 +1,359 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Fixed texture units and binding points shared by every material shader
+#define MATERIAL_DIFFUSE_UNIT 0
+#define MATERIAL_SPECULAR_UNIT 1
+#define MATERIAL_BLOCK_BINDING 0
+#define MATERIAL_STORAGE_BINDING 1
+// Vertex attribute carrying the material index (constant per draw or per instance)
+#define MATERIAL_ATTRIBUTE 7
+// Has to match MAX_MATERIALS in fragment.fs, 256 * 32 bytes fits the minimal UBO size
+#define MAX_MATERIALS 256
+// Shader variant used when materials are accessed through bindless handles. The material index comes from a
+// vertex or instance attribute, so it differs within a batch, GL_NV_gpu_shader5 makes that lookup defined
+#define BINDLESS_SHADER_HEADER "#version 430 core\n#extension GL_ARB_bindless_texture : require\n#extension GL_NV_gpu_shader5 : require\n#define BINDLESS"
+
+// Location of a texture after packing, one layer of a GL_TEXTURE_2D_ARRAY
+struct TextureLayer
+{
+    GLuint array = 0;
+    int layer = 0;
+};
+
+// Packs 2D textures of the same size into texture arrays, so draws using different textures
+// can share the same bindings. Textures are registered while loading and packed once in build().
+class TextureArrayPool
+{
+public:
+    static TextureArrayPool& instance()
+    {
+        static TextureArrayPool pool;
+        return pool;
+    }
+
+    // Registers an already uploaded 2D texture, returns the entry to resolve after build()
+    int add(GLuint texture, int width, int height)
+    {
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].source == texture)
+                return (int)i;
+        }
+        Entry entry;
+        entry.source = texture;
+        entry.width = width;
+        entry.height = height;
+        entries.push_back(entry);
+        return (int)entries.size() - 1;
+    }
+
+    // Uploads raw RGBA pixels as a 2D texture and registers it (used for the fallback 1x1 textures)
+    int addPixels(const std::vector<unsigned char>& rgba, int width, int height)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::instance().bindTextureForUpload(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return add(texture, width, height);
+    }
+
+    // Makes every registered texture resident once and remembers its bindless handle.
+    // Resident textures can no longer change their parameters, so this happens after loading.
+    void makeResident()
+    {
+        for (Entry& entry : entries)
+        {
+            if (entry.handle != 0)
+                continue;
+            entry.handle = glGetTextureHandleARB(entry.source);
+            glMakeTextureHandleResidentARB(entry.handle);
+        }
+    }
+
+    GLuint64 getHandle(int entry) const
+    {
+        return entries[entry].handle;
+    }
+
+    // The registered 2D texture of an entry, for reading its pixels back (HlodBuilder atlases).
+    // Only valid before build(), which deletes the textures it packed into arrays
+    GLuint getSource(int entry, int& width, int& height) const
+    {
+        width = entries[entry].width;
+        height = entries[entry].height;
+        return entries[entry].source;
+    }
+
+    // Creates one texture array per texture size, all layers are stored as RGBA8. The source textures are
+    // deleted once copied, so every texture is held once
+    void build()
+    {
+        GLState& state = GLState::instance();
+
+        GLint maxLayers = 256;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+        // group entries by size, keeping registration order inside a group
+        std::map<std::pair<int, int>, std::vector<size_t>> groups;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].resolved.array == 0)
+                groups[{ entries[i].width, entries[i].height }].push_back(i);
+        }
+
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        std::vector<unsigned char> staging;
+        for (auto& group : groups)
+        {
+            const int width = group.first.first;
+            const int height = group.first.second;
+            const std::vector<size_t>& members = group.second;
+            staging.resize((size_t)width * height * 4);
+
+            for (size_t first = 0; first < members.size(); first += maxLayers)
+            {
+                const GLsizei layers = (GLsizei)std::min(members.size() - first, (size_t)maxLayers);
+
+                GLuint array;
+                glGenTextures(1, &array);
+                state.bindTextureForUpload(GL_TEXTURE_2D_ARRAY, array);
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+                for (GLsizei layer = 0; layer < layers; layer++)
+                {
+                    Entry& entry = entries[members[first + layer]];
+                    // read back the original texture, the driver converts RED/RGB to RGBA for us
+                    state.bindTextureForUpload(GL_TEXTURE_2D, entry.source);
+                    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, staging.data());
+                    state.bindTextureForUpload(GL_TEXTURE_2D_ARRAY, array);
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, staging.data());
+                    entry.resolved = { array, layer };
+                    // the layer is the only copy from now on, the name may be reused so add() must not match it
+                    state.deleteTexture(entry.source);
+                    entry.source = 0;
+                }
+
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                arrays.push_back(array);
+            }
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    const TextureLayer& resolve(int entry) const
+    {
+        return entries[entry].resolved;
+    }
+
+    size_t getArrayCount() const { return arrays.size(); }
+
+private:
+    struct Entry
+    {
+        GLuint source = 0;
+        int width = 0;
+        int height = 0;
+        TextureLayer resolved;
+        GLuint64 handle = 0;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<GLuint> arrays;
+
+    TextureArrayPool() = default;
+};
+
+// std140 layout of one material in the MaterialBlock uniform block
+struct MaterialParams
+{
+    glm::ivec4 layers;  // x - diffuse layer, y - specular layer
+    glm::vec4 params;   // x - shininess
+};
+
+// std430 layout of one material in the MaterialBuffer storage block (bindless path)
+struct BindlessMaterialParams
+{
+    GLuint64 diffuse;
+    GLuint64 specular;
+    glm::vec4 params;   // x - shininess
+};
+
+class Material
+{
+public:
+    int diffuseTexture;   // TextureArrayPool entries
+    int specularTexture;
+    float shininess;
+
+    // resolved when the library is built
+    TextureLayer diffuse;
+    TextureLayer specular;
+
+    Material(int diffuseTexture, int specularTexture, float shininess)
+        : diffuseTexture(diffuseTexture), specularTexture(specularTexture), shininess(shininess) {}
+
+    // Binds the texture arrays to their fixed units, elided when the previous material used the same arrays
+    void bind() const
+    {
+        GLState& state = GLState::instance();
+        state.bindTexture(MATERIAL_DIFFUSE_UNIT, GL_TEXTURE_2D_ARRAY, diffuse.array);
+        state.bindTexture(MATERIAL_SPECULAR_UNIT, GL_TEXTURE_2D_ARRAY, specular.array);
+    }
+
+    bool sharesBindings(const Material& other) const
+    {
+        return diffuse.array == other.diffuse.array && specular.array == other.specular.array;
+    }
+};
+
+// All materials of all loaded models, their parameters live in a single uniform buffer.
+// Index 0 is the default material (white, used by meshes without textures and the Bezier patch).
+// With GL_ARB_bindless_texture the textures are not bound at all: every texture is made resident once
+// and the materials in a storage buffer hold the handles, otherwise the texture arrays are used.
+class MaterialLibrary
+{
+public:
+    static MaterialLibrary& instance()
+    {
+        static MaterialLibrary library;
+        return library;
+    }
+
+    unsigned int add(int diffuseTexture, int specularTexture, float shininess)
+    {
+        if (materials.size() >= MAX_MATERIALS)
+        {
+            std::cout << "ERROR::MATERIAL:: too many materials, using the default one" << std::endl;
+            return 0;
+        }
+        if (diffuseTexture < 0)
+            diffuseTexture = whiteTexture;
+        // without a specular map the diffuse map doubles as one
+        if (specularTexture < 0)
+            specularTexture = diffuseTexture;
+        materials.emplace_back(diffuseTexture, specularTexture, shininess);
+        return (unsigned int)materials.size() - 1;
+    }
+
+    const Material& get(unsigned int index) const
+    {
+        return materials[index];
+    }
+
+    size_t size() const { return materials.size(); }
+
+    // Decided from the context capabilities, shaders have to be compiled with BINDLESS_SHADER_HEADER then
+    static bool supportsBindless()
+    {
+        const GLCaps& caps = GLCaps::instance();
+        return caps.bindlessTexture && caps.gpuShader5 && caps.shaderStorage;
+    }
+
+    bool isBindless() const { return bindless; }
+
+    // Packs the textures and uploads the parameters, call once after all models are loaded
+    void build()
+    {
+        bindless = supportsBindless();
+        if (bindless)
+        {
+            buildBindless();
+            return;
+        }
+
+        TextureArrayPool& pool = TextureArrayPool::instance();
+        pool.build();
+
+        std::vector<MaterialParams> params(materials.size());
+        for (size_t i = 0; i < materials.size(); i++)
+        {
+            Material& material = materials[i];
+            material.diffuse = pool.resolve(material.diffuseTexture);
+            material.specular = pool.resolve(material.specularTexture);
+            params[i].layers = glm::ivec4(material.diffuse.layer, material.specular.layer, 0, 0);
+            params[i].params = glm::vec4(material.shininess, 0.0f, 0.0f, 0.0f);
+        }
+
+        GLState& state = GLState::instance();
+        if (ubo == 0)
+            glGenBuffers(1, &ubo);
+        state.bindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * sizeof(MaterialParams), nullptr, GL_STATIC_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, params.size() * sizeof(MaterialParams), params.data());
+        state.bindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, ubo);
+    }
+
+    // Connects the shader's samplers and material block to the fixed units, once per program
+    static void setupShader(const Shader& shader)
+    {
+        if (supportsBindless())
+        {
+            GLuint storageIndex = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "MaterialBuffer");
+            if (storageIndex != GL_INVALID_INDEX)
+                glShaderStorageBlockBinding(shader.ID, storageIndex, MATERIAL_STORAGE_BINDING);
+            return;
+        }
+
+        shader.use();
+        shader.setInt("diffuseMaps", MATERIAL_DIFFUSE_UNIT);
+        shader.setInt("specularMaps", MATERIAL_SPECULAR_UNIT);
+        GLuint blockIndex = glGetUniformBlockIndex(shader.ID, "MaterialBlock");
+        if (blockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(shader.ID, blockIndex, MATERIAL_BLOCK_BINDING);
+    }
+
+private:
+    std::vector<Material> materials;
+    int whiteTexture;
+    GLuint ubo = 0;
+    GLuint ssbo = 0;
+    bool bindless = false;
+
+    void buildBindless()
+    {
+        TextureArrayPool& pool = TextureArrayPool::instance();
+        pool.makeResident();
+
+        std::vector<BindlessMaterialParams> params(materials.size());
+        for (size_t i = 0; i < materials.size(); i++)
+        {
+            params[i].diffuse = pool.getHandle(materials[i].diffuseTexture);
+            params[i].specular = pool.getHandle(materials[i].specularTexture);
+            params[i].params = glm::vec4(materials[i].shininess, 0.0f, 0.0f, 0.0f);
+        }
+
+        GLState& state = GLState::instance();
+        if (ssbo == 0)
+            glGenBuffers(1, &ssbo);
+        state.bindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, params.size() * sizeof(BindlessMaterialParams), params.data(), GL_STATIC_DRAW);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_STORAGE_BINDING, ssbo);
+    }
+
+    MaterialLibrary()
+    {
+        whiteTexture = TextureArrayPool::instance().addPixels({ 255, 255, 255, 255 }, 1, 1);
+        add(whiteTexture, whiteTexture, 32.0f);
+    }
+};
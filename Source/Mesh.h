@@ -6,12 +6,17 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "GLState.h"
+#include "Material.h"
 #include "Shader.h"
+#include "TransformKernel.h"
 
 #include <string>
 #include <vector>
 
 #define MAX_BONE_INFLUENCE 4
+// first of the three vec4 rows of a per-instance AffineRecord
+#define INSTANCE_ATTRIBUTE 8
 
 struct Vertex {
     glm::vec3 Position;
@@ -29,6 +34,9 @@ struct Texture {
     unsigned int id;
     std::string type;
     std::string path;
+    int width = 0;
+    int height = 0;
+    int poolEntry = -1; // TextureArrayPool entry
 };
 
 class Mesh {
@@ -37,14 +45,16 @@ public:
     std::vector<Vertex>       vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture>      textures;
+    unsigned int materialIndex;
     unsigned int VAO;
 
     // constructor
-    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, unsigned int materialIndex = 0)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->materialIndex = materialIndex;
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
@@ -53,64 +63,31 @@ public:
     // render the mesh
     void Draw(Shader &shader) 
     {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            std::string number;
-            std::string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++);
-             else if(name == "texture_height")
-                number = std::to_string(heightNr++);
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
-        
-        // draw mesh
-        glBindVertexArray(VAO);
+        // samplers sit on fixed units and the parameters in the material block,
+        // so a draw only binds the texture arrays (usually elided) and tells the shader which material it is
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        if (!library.isBindless())
+            library.get(materialIndex).bind();
+        glVertexAttribI1ui(MATERIAL_ATTRIBUTE, materialIndex);
+
+        // draw mesh, bindings are left as they are, the next draw only changes what it needs
+        GLState::instance().bindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
     }
 
-private:
-    unsigned int VBO, EBO;
-
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    // frees the mesh's own buffers once its data lives in a merged model batch
+    void releaseBuffers()
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        GLState& state = GLState::instance();
+        state.deleteVertexArray(VAO);
+        state.deleteBuffer(VBO);
+        state.deleteBuffer(EBO);
+        VAO = VBO = EBO = 0;
+    }
 
-        // set the vertex attribute pointers
+    // vertex layout of the currently bound VAO and GL_ARRAY_BUFFER, shared with merged model batches
+    static void setupVertexAttributes()
+    {
         // vertex Positions
         glEnableVertexAttribArray(0);	
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -133,6 +110,44 @@ private:
 		// weights
 		glEnableVertexAttribArray(6);
 		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+    }
+
+    // per-instance world matrix rows from the currently bound GL_ARRAY_BUFFER of AffineRecords
+    static void setupInstanceAttributes()
+    {
+        for (int row = 0; row < 3; row++)
+        {
+            glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + row);
+            glVertexAttribPointer(INSTANCE_ATTRIBUTE + row, 4, GL_FLOAT, GL_FALSE, sizeof(AffineRecord), (void*)(row * sizeof(glm::vec4)));
+            glVertexAttribDivisor(INSTANCE_ATTRIBUTE + row, 1);
+        }
+    }
+
+private:
+    unsigned int VBO, EBO;
+
+    // initializes all the buffer objects/arrays
+    void setupMesh()
+    {
+        // create buffers/arrays
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        GLState& state = GLState::instance();
+        state.bindVertexArray(VAO);
+        // load data into vertex buffers
+        state.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        // A great thing about structs is that their memory layout is sequential for all its items.
+        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+        // again translates to 3/2 floats which translates to a byte array.
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
+
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+
+        // set the vertex attribute pointers
+        setupVertexAttributes();
+        state.bindVertexArray(0);
     }
 };
@@ -10,17 +10,34 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Material.h"
 #include "Mesh.h"
 #include "Shader.h"
+#include "Skeleton.h"
+#include "TransformKernel.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cfloat>
 #include <map>
 #include <vector>
 
-unsigned int TextureFromFile(const char *path, const std::string &directory);
+unsigned int TextureFromFile(const char *path, const std::string &directory, int* outWidth = nullptr, int* outHeight = nullptr);
+
+// layout expected by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
 
 class Model 
 {
@@ -29,6 +46,12 @@ public:
     std::vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     std::vector<Mesh>    meshes;
     std::string directory;
+    // model space bounding box of all meshes
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+    // bones the vertices are weighted to and the clips moving them, empty for static models
+    Skeleton skeleton;
+    std::vector<AnimationClip> animations;
 
     // constructor, expects a filepath to a 3D model.
     Model(std::string const &path, bool flipUVs = true)
@@ -36,20 +59,338 @@ public:
         loadModel(path, flipUVs);
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader &shader)
+    // model space bounding sphere, xyz - center, w - radius
+    glm::vec4 getBoundingSphere() const
+    {
+        if (meshes.empty())
+            return glm::vec4(0.0f);
+        glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+        return glm::vec4(center, glm::length(boundsMax - center));
+    }
+
+    bool hasSkeleton() const
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        return skeleton.getBoneCount() > 0;
+    }
+
+    // draws the model, and thus all its meshes. vertexArray replaces the model's own vertices with ones
+    // in the same layout and order, like the skinned copies of createVertexArray
+    void Draw(Shader &shader, GLuint vertexArray = 0)
+    {
+        if (drawOrder.size() != meshes.size())
+            prepareDraw();
+        const GLuint VAO = vertexArray != 0 ? vertexArray : batchVAO;
+
+        if (batchCommands != 0)
+        {
+            drawBatch(VAO);
+            return;
+        }
+
+        GLState::instance().bindVertexArray(VAO);
+        for (const MeshRange& range : meshRanges)
+        {
+            bindRangeMaterial(range);
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.count, GL_UNSIGNED_INT,
+                (void*)(range.firstIndex * sizeof(unsigned int)), range.baseVertex);
+        }
+    }
+
+    // draws instanceCount copies of the model, each with its own world matrix
+    void DrawInstanced(Shader& shader, const AffineRecord* instances, GLsizei instanceCount)
+    {
+        if (instanceCount <= 0)
+            return;
+        if (drawOrder.size() != meshes.size())
+            prepareDraw();
+        if (meshRanges.empty())
+            return;
+        if (instanceVAO == 0)
+            setupInstanceArray();
+
+        GLState& state = GLState::instance();
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // orphan last frame's records instead of waiting for the draws still reading them
+        glBufferData(GL_ARRAY_BUFFER, instanceCount * sizeof(AffineRecord), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instanceCount * sizeof(AffineRecord), instances);
+
+        DrawInstanced(shader, instanceVAO, instanceCount);
+    }
+
+    // instanced draw of a vertex array from createVertexArray(..., true) with its per-instance attributes set up
+    void DrawInstanced(Shader& shader, GLuint vertexArray, GLsizei instanceCount)
+    {
+        if (instanceCount <= 0)
+            return;
+        if (drawOrder.size() != meshes.size())
+            prepareDraw();
+
+        GLState::instance().bindVertexArray(vertexArray);
+        for (const MeshRange& range : meshRanges)
+        {
+            bindRangeMaterial(range);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.count, GL_UNSIGNED_INT,
+                (void*)(range.firstIndex * sizeof(unsigned int)), instanceCount, range.baseVertex);
+        }
+    }
+
+    // one command per mesh in draw order without instances, for command buffers whose instance counts are written
+    // on the GPU. baseInstance is 0, the instance attributes start at the beginning of their buffer
+    std::vector<DrawElementsIndirectCommand> getDrawCommands()
+    {
+        if (drawOrder.size() != meshes.size())
+            prepareDraw();
+        std::vector<DrawElementsIndirectCommand> commands;
+        for (const MeshRange& range : meshRanges)
+            commands.push_back({ (GLuint)range.count, 0, range.firstIndex, range.baseVertex, 0 });
+        return commands;
+    }
+
+    // instanced draw like DrawInstanced with the instance counts read from commandBuffer (see getDrawCommands)
+    void DrawIndirect(Shader& shader, GLuint vertexArray, GLuint commandBuffer)
+    {
+        if (drawOrder.size() != meshes.size())
+            prepareDraw();
+
+        GLState& state = GLState::instance();
+        state.bindVertexArray(vertexArray);
+        state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        for (size_t i = 0; i < meshRanges.size(); i++)
+        {
+            bindRangeMaterial(meshRanges[i]);
+            glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(i * sizeof(DrawElementsIndirectCommand)));
+        }
+    }
+
+    // merged vertices of all meshes in draw order, the source of skinning
+    GLuint getVertexBuffer()
+    {
+        if (drawOrder.size() != meshes.size())
+            prepareDraw();
+        return batchVBO;
+    }
+
+    GLsizei getVertexCount() const
+    {
+        return batchVertexCount;
+    }
+
+    // bind pose of the merged vertices, only kept for models with a skeleton
+    const std::vector<Vertex>& getBindPoseVertices() const
+    {
+        return bindPoseVertices;
+    }
+
+    // vertex array drawing the model's indices from another buffer of getVertexCount() vertices. Instanced arrays
+    // read the material from the generic attribute like DrawInstanced, the caller adds the per-instance attributes
+    GLuint createVertexArray(GLuint vertexBuffer, bool instanced = false)
+    {
+        if (drawOrder.size() != meshes.size())
+            prepareDraw();
+
+        GLState& state = GLState::instance();
+        GLuint vertexArray;
+        glGenVertexArrays(1, &vertexArray);
+        state.bindVertexArray(vertexArray);
+        state.bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        Mesh::setupVertexAttributes();
+        if (batchMaterials != 0 && !instanced)
+            setupMaterialStream();
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, batchEBO);
+        state.bindVertexArray(0);
+        return vertexArray;
     }
     
 private:
+    // meshes using the same texture bindings, drawn with one glMultiDrawElementsIndirect
+    struct BatchGroup
+    {
+        unsigned int material; // any material of the group, only its bindings are used
+        GLsizei first;
+        GLsizei count;
+    };
+
+    // aiMaterial index -> MaterialLibrary index
+    std::map<unsigned int, unsigned int> materialIndices;
+    // meshes sorted so that the ones sharing texture arrays are drawn one after another
+    std::vector<unsigned int> drawOrder;
+
+    // a mesh inside the merged buffers
+    struct MeshRange
+    {
+        GLsizei count;
+        GLuint firstIndex;
+        GLint baseVertex;
+        unsigned int material;
+    };
+
+    // all meshes merged into shared buffers, ranges in draw order
+    GLuint batchVAO = 0, batchVBO = 0, batchEBO = 0;
+    std::vector<MeshRange> meshRanges;
+    GLsizei batchVertexCount = 0;
+    std::vector<Vertex> bindPoseVertices;
+    // per-instance material stream and indirect commands, only with multi draw indirect support
+    GLuint batchMaterials = 0, batchCommands = 0;
+    std::vector<BatchGroup> batchGroups;
+    // merged buffers plus per-instance world matrices (INSTANCE_ATTRIBUTE), created by the first DrawInstanced
+    GLuint instanceVAO = 0, instanceVBO = 0;
+
+    // has to run after MaterialLibrary::build(), before that the texture arrays are unknown
+    void prepareDraw()
+    {
+        sortByMaterial();
+
+        if (!meshes.empty())
+            buildBatch();
+    }
+
+    // Merges the meshes into one vertex/index buffer shared by regular and instanced draws.
+    // With multi draw indirect every mesh also becomes an indirect command whose baseInstance is its draw ID,
+    // the per-instance attribute MATERIAL_ATTRIBUTE then yields the material, so meshes with different
+    // materials are drawn by a single multi draw (one per texture array set without bindless textures).
+    void buildBatch()
+    {
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        const bool multiDraw = GLCaps::instance().multiDrawIndirect;
+
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        std::vector<DrawElementsIndirectCommand> commands;
+        std::vector<GLuint> materials;
+        for (unsigned int i = 0; i < drawOrder.size(); i++)
+        {
+            const Mesh& mesh = meshes[drawOrder[i]];
+
+            DrawElementsIndirectCommand command;
+            command.count = (GLuint)mesh.indices.size();
+            command.instanceCount = 1;
+            command.firstIndex = (GLuint)indices.size();
+            command.baseVertex = (GLint)vertices.size();
+            command.baseInstance = (GLuint)commands.size();
+            commands.push_back(command);
+            materials.push_back(mesh.materialIndex);
+            meshRanges.push_back({ (GLsizei)command.count, command.firstIndex, command.baseVertex, mesh.materialIndex });
+
+            vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+            indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+
+            const Material& material = library.get(mesh.materialIndex);
+            if (batchGroups.empty() || (!library.isBindless() && !material.sharesBindings(library.get(batchGroups.back().material))))
+                batchGroups.push_back({ mesh.materialIndex, (GLsizei)i, 0 });
+            batchGroups.back().count++;
+        }
+
+        GLState& state = GLState::instance();
+        glGenVertexArrays(1, &batchVAO);
+        glGenBuffers(1, &batchVBO);
+        glGenBuffers(1, &batchEBO);
+
+        state.bindVertexArray(batchVAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, batchVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+        Mesh::setupVertexAttributes();
+
+        if (multiDraw)
+        {
+            glGenBuffers(1, &batchMaterials);
+            state.bindBuffer(GL_ARRAY_BUFFER, batchMaterials);
+            glBufferData(GL_ARRAY_BUFFER, materials.size() * sizeof(GLuint), materials.data(), GL_STATIC_DRAW);
+            setupMaterialStream();
+        }
+
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, batchEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        state.bindVertexArray(0);
+
+        if (multiDraw)
+        {
+            glGenBuffers(1, &batchCommands);
+            state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, batchCommands);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+        }
+
+        batchVertexCount = (GLsizei)vertices.size();
+        if (hasSkeleton())
+            bindPoseVertices = vertices;
+
+        // the merged buffers hold everything now
+        for (Mesh& mesh : meshes)
+            mesh.releaseBuffers();
+    }
+
+    // per draw material of the multi draw commands, from batchMaterials
+    void setupMaterialStream()
+    {
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, batchMaterials);
+        glEnableVertexAttribArray(MATERIAL_ATTRIBUTE);
+        glVertexAttribIPointer(MATERIAL_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+        glVertexAttribDivisor(MATERIAL_ATTRIBUTE, 1);
+    }
+
+    void drawBatch(GLuint VAO)
+    {
+        GLState& state = GLState::instance();
+        const MaterialLibrary& library = MaterialLibrary::instance();
+
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, batchCommands);
+        for (const BatchGroup& group : batchGroups)
+        {
+            if (!library.isBindless())
+                library.get(group.material).bind();
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (void*)(group.first * sizeof(DrawElementsIndirectCommand)), group.count, 0);
+        }
+    }
+
+    // instanced draws read the material from the generic attribute, the per-instance slot holds the matrices
+    void setupInstanceArray()
+    {
+        GLState& state = GLState::instance();
+        glGenVertexArrays(1, &instanceVAO);
+        glGenBuffers(1, &instanceVBO);
+
+        state.bindVertexArray(instanceVAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, batchVBO);
+        Mesh::setupVertexAttributes();
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        Mesh::setupInstanceAttributes();
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, batchEBO);
+        state.bindVertexArray(0);
+    }
+
+    void bindRangeMaterial(const MeshRange& range) const
+    {
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        if (!library.isBindless())
+            library.get(range.material).bind();
+        glVertexAttribI1ui(MATERIAL_ATTRIBUTE, range.material);
+    }
+
+    // has to run after MaterialLibrary::build(), before that the texture arrays are unknown
+    void sortByMaterial()
+    {
+        drawOrder.resize(meshes.size());
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            drawOrder[i] = i;
+
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        std::stable_sort(drawOrder.begin(), drawOrder.end(), [&](unsigned int a, unsigned int b)
+            {
+                const Material& ma = library.get(meshes[a].materialIndex);
+                const Material& mb = library.get(meshes[b].materialIndex);
+                if (ma.diffuse.array != mb.diffuse.array)
+                    return ma.diffuse.array < mb.diffuse.array;
+                return ma.specular.array < mb.specular.array;
+            });
+    }
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 	void loadModel(std::string const& path, bool flipUVs)
     {
         // read file via ASSIMP
         Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | (flipUVs ? aiProcess_FlipUVs : 0));
+		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights | (flipUVs ? aiProcess_FlipUVs : 0));
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
@@ -62,6 +403,82 @@ private:
 
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+
+        // the bones are known once all meshes are read
+        if (hasSkeleton())
+        {
+            skeleton.globalInverse = glm::inverse(toMat4(scene->mRootNode->mTransformation));
+            readSkeleton(scene->mRootNode, -1);
+            for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+                animations.push_back(readAnimation(scene->mAnimations[i]));
+        }
+    }
+
+    // assimp matrices are row major
+    static glm::mat4 toMat4(const aiMatrix4x4& m)
+    {
+        glm::mat4 matrix;
+        matrix[0] = glm::vec4(m.a1, m.b1, m.c1, m.d1);
+        matrix[1] = glm::vec4(m.a2, m.b2, m.c2, m.d2);
+        matrix[2] = glm::vec4(m.a3, m.b3, m.c3, m.d3);
+        matrix[3] = glm::vec4(m.a4, m.b4, m.c4, m.d4);
+        return matrix;
+    }
+
+    // flattens the node hierarchy, parents first
+    void readSkeleton(const aiNode* node, int parent)
+    {
+        Skeleton::Node skeletonNode;
+        skeletonNode.name = node->mName.C_Str();
+        skeletonNode.parent = parent;
+        auto bone = skeleton.boneIndices.find(skeletonNode.name);
+        skeletonNode.bone = bone == skeleton.boneIndices.end() ? -1 : bone->second;
+        skeletonNode.bindPose = NodePose::fromMat4(toMat4(node->mTransformation));
+        skeleton.nodes.push_back(skeletonNode);
+
+        const int index = (int)skeleton.nodes.size() - 1;
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+            readSkeleton(node->mChildren[i], index);
+    }
+
+    // channels are matched to the skeleton nodes by name, key times converted from ticks to seconds
+    AnimationClip readAnimation(const aiAnimation* animation) const
+    {
+        AnimationClip clip;
+        clip.name = animation->mName.C_Str();
+        const float ticksPerSecond = animation->mTicksPerSecond > 0.0 ? (float)animation->mTicksPerSecond : 25.0f;
+        clip.duration = (float)animation->mDuration / ticksPerSecond;
+        clip.nodeChannels.assign(skeleton.nodes.size(), -1);
+        for (unsigned int i = 0; i < animation->mNumChannels; i++)
+        {
+            const aiNodeAnim* source = animation->mChannels[i];
+            const int node = skeleton.findNode(source->mNodeName.C_Str());
+            if (node < 0)
+                continue;
+
+            NodeChannel channel;
+            for (unsigned int k = 0; k < source->mNumPositionKeys; k++)
+            {
+                const aiVectorKey& key = source->mPositionKeys[k];
+                channel.positionTimes.push_back((float)key.mTime / ticksPerSecond);
+                channel.positions.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            for (unsigned int k = 0; k < source->mNumRotationKeys; k++)
+            {
+                const aiQuatKey& key = source->mRotationKeys[k];
+                channel.rotationTimes.push_back((float)key.mTime / ticksPerSecond);
+                channel.rotations.push_back(glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            for (unsigned int k = 0; k < source->mNumScalingKeys; k++)
+            {
+                const aiVectorKey& key = source->mScalingKeys[k];
+                channel.scaleTimes.push_back((float)key.mTime / ticksPerSecond);
+                channel.scales.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+            }
+            clip.nodeChannels[node] = (int)clip.channels.size();
+            clip.channels.push_back(channel);
+        }
+        return clip;
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -100,6 +517,8 @@ private:
             vector.y = mesh->mVertices[i].y;
             vector.z = mesh->mVertices[i].z;
             vertex.Position = vector;
+            boundsMin = glm::min(boundsMin, vector);
+            boundsMax = glm::max(boundsMax, vector);
             // normals
             if (mesh->HasNormals())
             {
@@ -130,9 +549,16 @@ private:
             }
             else
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+            // no bone influences until readBoneWeights
+            for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+            {
+                vertex.m_BoneIDs[k] = -1;
+                vertex.m_Weights[k] = 0.0f;
+            }
 
             vertices.push_back(vertex);
         }
+        readBoneWeights(vertices, mesh);
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for(unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
@@ -143,12 +569,8 @@ private:
         }
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];    
-        // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
-        // Same applies to other texture as the following list summarizes:
-        // diffuse: texture_diffuseN
-        // specular: texture_specularN
-        // normal: texture_normalN
+        // textures are collected by type, the first diffuse and specular map of the material end up in the
+        // texture arrays sampled by the shader (see Material.h), the rest is kept for reference
 
         // 1. diffuse maps
         std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
@@ -162,9 +584,55 @@ private:
         // 4. height maps
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+
+        // resolve the material once here instead of matching texture types on every draw
+        auto found = materialIndices.find(mesh->mMaterialIndex);
+        if (found == materialIndices.end())
+        {
+            float shininess = 0.0f;
+            material->Get(AI_MATKEY_SHININESS, shininess);
+            if (shininess <= 0.0f)
+                shininess = 32.0f;
+            int diffuse = diffuseMaps.empty() ? -1 : diffuseMaps[0].poolEntry;
+            int specular = specularMaps.empty() ? -1 : specularMaps[0].poolEntry;
+            found = materialIndices.emplace(mesh->mMaterialIndex, MaterialLibrary::instance().add(diffuse, specular, shininess)).first;
+        }
         
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return Mesh(vertices, indices, textures, found->second);
+    }
+
+    // bones get model wide indices, LimitBoneWeights leaves at most MAX_BONE_INFLUENCE of them per vertex
+    void readBoneWeights(std::vector<Vertex>& vertices, const aiMesh* mesh)
+    {
+        for (unsigned int i = 0; i < mesh->mNumBones; i++)
+        {
+            const aiBone* bone = mesh->mBones[i];
+            const std::string name = bone->mName.C_Str();
+            auto found = skeleton.boneIndices.find(name);
+            if (found == skeleton.boneIndices.end())
+            {
+                found = skeleton.boneIndices.emplace(name, (int)skeleton.boneOffsets.size()).first;
+                skeleton.boneOffsets.push_back(toMat4(bone->mOffsetMatrix));
+            }
+
+            for (unsigned int k = 0; k < bone->mNumWeights; k++)
+            {
+                const aiVertexWeight& weight = bone->mWeights[k];
+                if (weight.mVertexId >= vertices.size() || weight.mWeight <= 0.0f)
+                    continue;
+                Vertex& vertex = vertices[weight.mVertexId];
+                for (int slot = 0; slot < MAX_BONE_INFLUENCE; slot++)
+                {
+                    if (vertex.m_BoneIDs[slot] < 0)
+                    {
+                        vertex.m_BoneIDs[slot] = found->second;
+                        vertex.m_Weights[slot] = weight.mWeight;
+                        break;
+                    }
+                }
+            }
+        }
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -190,9 +658,11 @@ private:
             if(!skip)
             {   // if texture hasn't been loaded already, load it
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
+                texture.id = TextureFromFile(str.C_Str(), this->directory, &texture.width, &texture.height);
                 texture.type = typeName;
                 texture.path = str.C_Str();
+                if (texture.width > 0)
+                    texture.poolEntry = TextureArrayPool::instance().add(texture.id, texture.width, texture.height);
                 textures.push_back(texture);
                 textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
             }
@@ -202,7 +672,7 @@ private:
 };
 
 
-unsigned int TextureFromFile(const char *path, const std::string &directory)
+unsigned int TextureFromFile(const char *path, const std::string &directory, int* outWidth, int* outHeight)
 {
 	std::string filename = std::string(path);
     filename = directory + '/' + filename;
@@ -222,7 +692,7 @@ unsigned int TextureFromFile(const char *path, const std::string &directory)
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        GLState::instance().bindTextureForUpload(GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -232,6 +702,11 @@ unsigned int TextureFromFile(const char *path, const std::string &directory)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
         stbi_image_free(data);
+
+        if (outWidth)
+            *outWidth = width;
+        if (outHeight)
+            *outHeight = height;
     }
     else
     {
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "ComputeShader.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Shader.h"
+
+#include <cmath>
+#include <vector>
+
+#define PARTICLE_POOL_BINDING 10
+#define PARTICLE_LISTS_BINDING 11
+#define PARTICLE_DEAD_BINDING 12
+#define PARTICLE_STATE_BINDING 13
+#define PARTICLE_SORT_BINDING 14
+#define MAX_PARTICLE_EMITTERS 16
+
+// GPU particles: emission, simulation, compaction and sorting all run in particles.cs over buffers that are
+// created once, and the live particles are drawn by one indirect instanced draw (particle.vs), so the CPU
+// only sets the emitters and never touches a particle. The particles are blended premultiplied, additive
+// ones with an alpha of 0, which only need sorting back to front while blended (opaque) emitters are active.
+// The sort covers the alive count rounded up to a power of two, sized on the GPU, and the CPU only issues the
+// steps that a bound of the alive count from the recent emissions can need.
+// Needs compute shaders and shader storage buffers, there is no CPU fallback.
+class ParticleSystem
+{
+public:
+    struct Emitter
+    {
+        glm::vec3 position = glm::vec3(0.0f);
+        float radius = 0.1f;        // particles spawn inside this sphere
+        glm::vec3 velocity = glm::vec3(0.0f, 1.0f, 0.0f);
+        float spread = 0.5f;        // random speed in any direction
+        glm::vec4 color = glm::vec4(1.0f); // a - opacity, 0 blends additively
+        float startSize = 0.1f;
+        float endSize = 0.1f;
+        float gravityScale = 1.0f;  // negative rises
+        float drag = 0.0f;          // also how much the wind carries the particle
+        float minLife = 1.0f;
+        float maxLife = 2.0f;
+        float rate = 100.0f;        // particles per second
+        bool enabled = true;
+    };
+
+    std::vector<Emitter> emitters;
+    glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+    glm::vec3 wind = glm::vec3(1.5f, 0.0f, 0.5f);
+    bool simulate = true;
+    bool sortBlended = true;
+    float lastGpuMs = 0.0f;
+    // emitted last frame (requested, the pool may have had fewer free particles), and whether it was sorted
+    unsigned int lastEmitted = 0;
+    bool lastSorted = false;
+
+    static bool supportsGpu()
+    {
+        const GLCaps& caps = GLCaps::instance();
+        return caps.computeShader && caps.shaderStorage;
+    }
+
+    // the compute program and the draw program share the storage blocks
+    static void setupShader(const Shader& shader)
+    {
+        if (!supportsGpu())
+            return;
+        const char* blocks[] = { "ParticlePool", "ParticleLists", "ParticleDead", "ParticleState", "ParticleSort" };
+        const GLuint bindings[] = { PARTICLE_POOL_BINDING, PARTICLE_LISTS_BINDING, PARTICLE_DEAD_BINDING, PARTICLE_STATE_BINDING, PARTICLE_SORT_BINDING };
+        for (int i = 0; i < 5; i++)
+        {
+            GLuint block = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, blocks[i]);
+            if (block != GL_INVALID_INDEX)
+                glShaderStorageBlockBinding(shader.ID, block, bindings[i]);
+        }
+    }
+
+    unsigned int getCapacity() const { return capacity; }
+    // most particles that can be alive, from the emissions within their lifetime
+    unsigned int getAliveBound() const { return aliveBound; }
+    bool isCreated() const { return capacity > 0; }
+
+    // pool of particleCapacity particles, all free, computeShader is the particles.cs program
+    void create(unsigned int particleCapacity, ComputeShader& computeShader)
+    {
+        if (!supportsGpu())
+            return;
+        capacity = particleCapacity;
+        // the local sort pass needs whole groups
+        sortCapacity = GROUP_SIZE;
+        while (sortCapacity < capacity)
+            sortCapacity *= 2;
+
+        GLState& state = GLState::instance();
+        auto createBuffer = [&](GLuint& buffer, size_t bytes)
+            {
+                glGenBuffers(1, &buffer);
+                state.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, GL_DYNAMIC_COPY);
+            };
+        createBuffer(poolBuffer, (size_t)capacity * 4 * sizeof(glm::vec4));
+        createBuffer(listBuffer, (size_t)capacity * 2 * sizeof(GLuint));
+        createBuffer(deadBuffer, (size_t)capacity * sizeof(GLuint));
+        createBuffer(stateBuffer, STATE_SIZE);
+        createBuffer(sortBuffer, (size_t)sortCapacity * 2 * sizeof(GLuint));
+        glGenVertexArrays(1, &VAO);
+        glGenQueries(1, &timerQuery);
+
+        reset(computeShader);
+    }
+
+    // frees every particle
+    void reset(ComputeShader& computeShader)
+    {
+        if (!isCreated())
+            return;
+        current = 0;
+        emissions.clear();
+        aliveBound = 0;
+        computeShader.use();
+        bindBuffers();
+        computeShader.setUint("capacity", capacity);
+        dispatch(computeShader, PASS_RESET, (capacity + GROUP_SIZE - 1) / GROUP_SIZE);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    }
+
+    // Emits and simulates one step, sorts the live particles when blended ones can be among them
+    void update(ComputeShader& computeShader, float deltaTime, const glm::vec3& viewPos)
+    {
+        if (!isCreated() || !simulate)
+            return;
+        // long frames would fling the particles, they slow down instead
+        deltaTime = glm::min(deltaTime, 1.0f / 20.0f);
+        readTimer();
+        const bool timed = !timerPending;
+        if (timed)
+            glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+
+        computeShader.use();
+        bindBuffers();
+        computeShader.setUint("capacity", capacity);
+        computeShader.setUint("current", current);
+        computeShader.setFloat("deltaTime", deltaTime);
+        computeShader.setUint("seed", ++frame);
+        computeShader.setVec3("gravity", gravity);
+        computeShader.setVec3("wind", wind);
+        computeShader.setVec3("viewPos", viewPos);
+        const bool blended = setEmitterUniforms(computeShader, deltaTime);
+        updateAliveBound(deltaTime);
+
+        // counts and dispatch sizes from last frame's results
+        dispatch(computeShader, PASS_PREPARE, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        // survivors are compacted into the next list
+        dispatchIndirect(computeShader, PASS_SIMULATE, SIMULATE_DISPATCH_OFFSET);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        // new particles are appended after them
+        dispatchIndirect(computeShader, PASS_EMIT, EMIT_DISPATCH_OFFSET);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        // draw arguments and the sort size of the new list
+        dispatch(computeShader, PASS_FINISH, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        lastSorted = blended && sortBlended;
+        if (lastSorted)
+            sort(computeShader);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        current = 1 - current;
+
+        if (timed)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            timerPending = true;
+        }
+    }
+
+    // shader is particle.vs with view, projection and fog set, the pipeline has to blend premultiplied
+    void draw(Shader& shader)
+    {
+        if (!isCreated())
+            return;
+        GLState& state = GLState::instance();
+        shader.use();
+        bindBuffers();
+        // update() has already swapped the lists, current is the one just filled
+        shader.setUint("listOffset", current * capacity);
+        shader.setBool("sorted", lastSorted);
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, stateBuffer);
+        glDrawArraysIndirect(GL_TRIANGLE_STRIP, (void*)DRAW_ARGS_OFFSET);
+    }
+
+private:
+    enum Pass
+    {
+        PASS_RESET = 0, PASS_PREPARE = 1, PASS_SIMULATE = 2, PASS_EMIT = 3, PASS_FINISH = 4,
+        PASS_SORT_KEYS = 5, PASS_SORT_GLOBAL = 6, PASS_SORT_LOCAL = 7
+    };
+    static const unsigned int GROUP_SIZE = 256;
+    // ParticleState in particles.cs: 4 counters, then the emit and simulate dispatch, the draw arguments
+    // and the sort dispatch
+    static const size_t EMIT_DISPATCH_OFFSET = 16;
+    static const size_t SIMULATE_DISPATCH_OFFSET = 32;
+    static const size_t DRAW_ARGS_OFFSET = 48;
+    static const size_t SORT_DISPATCH_OFFSET = 64;
+    static const size_t STATE_SIZE = 80;
+
+    // particles emitted by one update, alive until the longest lifetime among them has passed
+    struct Emission
+    {
+        unsigned int count;
+        float maxLife;
+        float age;
+    };
+
+    unsigned int capacity = 0;
+    // entries of the sort buffer, the capacity rounded up to a power of two
+    unsigned int sortCapacity = 0;
+    unsigned int aliveBound = 0;
+    std::vector<Emission> emissions;
+    // alive list read by the next update
+    unsigned int current = 0;
+    unsigned int frame = 0;
+    GLuint poolBuffer = 0, listBuffer = 0, deadBuffer = 0, stateBuffer = 0, sortBuffer = 0;
+    // empty, the quads come from gl_VertexID and the particles from the storage blocks
+    GLuint VAO = 0;
+    GLuint timerQuery = 0;
+    bool timerPending = false;
+    // fractions of particles carried over to the next frame per emitter
+    std::vector<float> emitRemainders;
+
+    void bindBuffers()
+    {
+        GLState& state = GLState::instance();
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_POOL_BINDING, poolBuffer);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_LISTS_BINDING, listBuffer);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_DEAD_BINDING, deadBuffer);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_STATE_BINDING, stateBuffer);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, PARTICLE_SORT_BINDING, sortBuffer);
+    }
+
+    void dispatch(ComputeShader& computeShader, Pass pass, GLuint groups)
+    {
+        computeShader.setInt("pass", pass);
+        computeShader.dispatch(groups);
+    }
+
+    // group counts written by an earlier pass into ParticleState
+    void dispatchIndirect(ComputeShader& computeShader, Pass pass, size_t offset)
+    {
+        computeShader.setInt("pass", pass);
+        GLState::instance().bindBuffer(GL_DISPATCH_INDIRECT_BUFFER, stateBuffer);
+        glDispatchComputeIndirect((GLintptr)offset);
+    }
+
+    // ages the recent emissions by this step and adds this frame's, their sum bounds the alive count
+    void updateAliveBound(float deltaTime)
+    {
+        float maxLife = 0.0f;
+        for (const Emitter& emitter : emitters)
+        {
+            if (emitter.enabled)
+                maxLife = glm::max(maxLife, glm::max(emitter.minLife, emitter.maxLife));
+        }
+        size_t kept = 0;
+        unsigned int bound = lastEmitted;
+        for (Emission& emission : emissions)
+        {
+            emission.age += deltaTime;
+            // one step of slack for the rounding of the ages on the GPU
+            if (emission.age > emission.maxLife + deltaTime)
+                continue;
+            bound += emission.count;
+            emissions[kept++] = emission;
+        }
+        emissions.resize(kept);
+        if (lastEmitted > 0)
+            emissions.push_back({ lastEmitted, maxLife, 0.0f });
+        aliveBound = glm::min(bound, capacity);
+    }
+
+    // per emitter uniforms and the running sum of this frame's particles, returns whether any is blended.
+    // Every array is uploaded with one call
+    bool setEmitterUniforms(ComputeShader& computeShader, float deltaTime)
+    {
+        unsigned int first[MAX_PARTICLE_EMITTERS + 1];
+        glm::vec4 position[MAX_PARTICLE_EMITTERS], velocity[MAX_PARTICLE_EMITTERS], color[MAX_PARTICLE_EMITTERS], shape[MAX_PARTICLE_EMITTERS];
+        glm::vec2 life[MAX_PARTICLE_EMITTERS];
+
+        emitRemainders.resize(emitters.size(), 0.0f);
+        int count = 0;
+        unsigned int total = 0;
+        bool blended = false;
+        for (size_t i = 0; i < emitters.size() && count < MAX_PARTICLE_EMITTERS; i++)
+        {
+            const Emitter& emitter = emitters[i];
+            if (!emitter.enabled || emitter.rate <= 0.0f)
+                continue;
+            const float particles = emitter.rate * deltaTime + emitRemainders[i];
+            const unsigned int emitted = (unsigned int)particles;
+            emitRemainders[i] = particles - (float)emitted;
+            if (emitted == 0)
+                continue;
+
+            first[count] = total;
+            position[count] = glm::vec4(emitter.position, emitter.radius);
+            velocity[count] = glm::vec4(emitter.velocity, emitter.spread);
+            color[count] = emitter.color;
+            shape[count] = glm::vec4(emitter.startSize, emitter.endSize, emitter.gravityScale, emitter.drag);
+            life[count] = glm::vec2(emitter.minLife, emitter.maxLife);
+            total += emitted;
+            blended = blended || emitter.color.w > 0.0f;
+            count++;
+        }
+        first[count] = total;
+        computeShader.setInt("emitterCount", count);
+        computeShader.setUintArray("emitterFirst", first, count + 1);
+        if (count > 0)
+        {
+            computeShader.setVec4Array("emitterPosition", position, count);
+            computeShader.setVec4Array("emitterVelocity", velocity, count);
+            computeShader.setVec4Array("emitterColor", color, count);
+            computeShader.setVec4Array("emitterShape", shape, count);
+            computeShader.setVec2Array("emitterLife", life, count);
+        }
+        lastEmitted = total;
+        return blended;
+    }
+
+    // Bitonic sort of the alive count rounded up to a power of two, the steps comparing entries within a group
+    // run in shared memory. The groups come from FINISH, the steps stop at the bound rounded up the same way,
+    // anything between the two sizes returns right away.
+    void sort(ComputeShader& computeShader)
+    {
+        unsigned int sortSize = GROUP_SIZE;
+        while (sortSize < aliveBound && sortSize < sortCapacity)
+            sortSize *= 2;
+        dispatchIndirect(computeShader, PASS_SORT_KEYS, SORT_DISPATCH_OFFSET);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        for (unsigned int sequence = 2; sequence <= sortSize; sequence *= 2)
+        {
+            computeShader.setUint("sortSequence", sequence);
+            unsigned int distance = sequence / 2;
+            for (; distance >= GROUP_SIZE; distance /= 2)
+            {
+                computeShader.setUint("sortDistance", distance);
+                dispatchIndirect(computeShader, PASS_SORT_GLOBAL, SORT_DISPATCH_OFFSET);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+            computeShader.setUint("sortDistance", distance);
+            dispatchIndirect(computeShader, PASS_SORT_LOCAL, SORT_DISPATCH_OFFSET);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+    }
+
+    // the result of an earlier frame's query, never waits
+    void readTimer()
+    {
+        if (!timerPending)
+            return;
+        GLint available = 0;
+        glGetQueryObjectiv(timerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &nanoseconds);
+        lastGpuMs = (float)((double)nanoseconds / 1e6);
+        timerPending = false;
+    }
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "Material.h"
+#include "Mesh.h"
+#include "PatchRenderer.h"
+#include "Shader.h"
+#include "TransformKernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Tessellation output of static surfaces, captured once with transform feedback and replayed with plain
+// instanced draws until the surfaces or the level change. Every surface is captured in object space at a
+// fixed, view independent level (no adaptive levels, no culling), its objects then become instances,
+// so moving an object only updates its instance record.
+class PatchCache
+{
+public:
+    // vertex layout written by the capture shader, the TES outputs FragPos, Normal and TexCoords
+    struct CachedVertex
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec2 texCoords;
+    };
+
+    static const std::vector<const char*>& getFeedbackVaryings()
+    {
+        static const std::vector<const char*> varyings = { "FragPos", "Normal", "TexCoords" };
+        return varyings;
+    }
+
+    size_t getVertexCount() const
+    {
+        size_t count = 0;
+        for (const SurfaceEntry& entry : entries)
+            count += entry.vertexCount;
+        return count;
+    }
+
+    // captureShader is the regular tessellation shader linked with getFeedbackVaryings(),
+    // instancedShader the INSTANCED variant of the object shader with its per frame uniforms set
+    void draw(PatchRenderer& patches, Shader& captureShader, Shader& instancedShader, float tessLevel)
+    {
+        if (patches.objects.empty())
+            return;
+        patches.prepare();
+
+        const int level = (int)std::ceil(tessLevel);
+        if (patches.getGeometryVersion() != geometryVersion || level != capturedLevel)
+            capture(patches, captureShader, level);
+        updateInstances(patches);
+
+        GLState& state = GLState::instance();
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        instancedShader.use();
+        for (SurfaceEntry& entry : entries)
+        {
+            if (entry.vertexCount == 0 || entry.instances.empty())
+                continue;
+            state.bindVertexArray(entry.VAO);
+            if (library.isBindless())
+            {
+                pointInstances(entry, 0);
+                glDrawArraysInstanced(GL_TRIANGLES, 0, entry.vertexCount, (GLsizei)entry.instances.size());
+                continue;
+            }
+            // without bindless textures a draw samples one texture array set, the instances are sorted by set
+            for (const InstanceRun& run : entry.runs)
+            {
+                library.get(entry.materials[run.first]).bind();
+                pointInstances(entry, run.first);
+                glDrawArraysInstanced(GL_TRIANGLES, 0, entry.vertexCount, run.count);
+            }
+        }
+    }
+
+private:
+    // instances sharing a texture array set
+    struct InstanceRun
+    {
+        GLsizei first;
+        GLsizei count;
+    };
+
+    struct SurfaceEntry
+    {
+        GLuint VAO = 0, vertexBuffer = 0, instanceBuffer = 0, materialBuffer = 0;
+        GLsizei vertexCount = 0;
+        // sorted by texture array set without bindless textures
+        std::vector<unsigned int> objects;
+        std::vector<AffineRecord> instances;
+        std::vector<GLuint> materials;
+        std::vector<InstanceRun> runs;
+        // first instance the per-instance attributes of the VAO point at
+        GLsizei instanceOffset = 0;
+    };
+
+    std::vector<SurfaceEntry> entries;
+    std::vector<unsigned int> objectVersions;
+    unsigned int geometryVersion = 0;
+    int capturedLevel = -1;
+
+    void release()
+    {
+        GLState& state = GLState::instance();
+        for (SurfaceEntry& entry : entries)
+        {
+            state.deleteVertexArray(entry.VAO);
+            state.deleteBuffer(entry.vertexBuffer);
+            state.deleteBuffer(entry.instanceBuffer);
+            state.deleteBuffer(entry.materialBuffer);
+        }
+        entries.clear();
+    }
+
+    void capture(PatchRenderer& patches, Shader& captureShader, int level)
+    {
+        release();
+        GLState& state = GLState::instance();
+
+        captureShader.use();
+        captureShader.setFloat("tessLevel", (float)level);
+        captureShader.setBool("adaptive", false);
+        captureShader.setBool("frustumCulling", false);
+        captureShader.setBool("backfaceCulling", false);
+        captureShader.setModelMatrix(glm::mat4(1.0f));
+
+        GLuint query;
+        glGenQueries(1, &query);
+        glEnable(GL_RASTERIZER_DISCARD);
+        entries.resize(patches.getSurfaceCount());
+        for (unsigned int surface = 0; surface < entries.size(); surface++)
+        {
+            SurfaceEntry& entry = entries[surface];
+            // a quad patch with every level at n is split into 2 * n * n triangles
+            const size_t maxVertices = patches.getSurface(surface).getPatchCount() * 6 * level * level;
+            if (maxVertices == 0)
+                continue;
+
+            glGenBuffers(1, &entry.vertexBuffer);
+            state.bindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, entry.vertexBuffer);
+            glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, maxVertices * sizeof(CachedVertex), nullptr, GL_STATIC_DRAW);
+            state.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, entry.vertexBuffer);
+
+            glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, query);
+            glBeginTransformFeedback(GL_TRIANGLES);
+            patches.drawSurface(surface);
+            glEndTransformFeedback();
+            glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+
+            // only waits when the cache is rebuilt
+            GLuint primitives = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT, &primitives);
+            entry.vertexCount = (GLsizei)(primitives * 3);
+
+            glGenBuffers(1, &entry.instanceBuffer);
+            glGenBuffers(1, &entry.materialBuffer);
+            glGenVertexArrays(1, &entry.VAO);
+            state.bindVertexArray(entry.VAO);
+            state.bindBuffer(GL_ARRAY_BUFFER, entry.vertexBuffer);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CachedVertex), (void*)offsetof(CachedVertex, position));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(CachedVertex), (void*)offsetof(CachedVertex, normal));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(CachedVertex), (void*)offsetof(CachedVertex, texCoords));
+            state.bindBuffer(GL_ARRAY_BUFFER, entry.materialBuffer);
+            glEnableVertexAttribArray(MATERIAL_ATTRIBUTE);
+            glVertexAttribIPointer(MATERIAL_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+            glVertexAttribDivisor(MATERIAL_ATTRIBUTE, 1);
+            state.bindBuffer(GL_ARRAY_BUFFER, entry.instanceBuffer);
+            Mesh::setupInstanceAttributes();
+            state.bindVertexArray(0);
+        }
+        glDisable(GL_RASTERIZER_DISCARD);
+        glDeleteQueries(1, &query);
+
+        for (unsigned int i = 0; i < patches.objects.size(); i++)
+            entries[patches.objects[i].surface].objects.push_back(i);
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        if (!library.isBindless())
+        {
+            for (SurfaceEntry& entry : entries)
+            {
+                std::stable_sort(entry.objects.begin(), entry.objects.end(), [&](unsigned int a, unsigned int b)
+                    {
+                        const Material& ma = library.get(patches.objects[a].material);
+                        const Material& mb = library.get(patches.objects[b].material);
+                        if (ma.diffuse.array != mb.diffuse.array)
+                            return ma.diffuse.array < mb.diffuse.array;
+                        return ma.specular.array < mb.specular.array;
+                    });
+            }
+        }
+        // no transform has this version, so every instance is uploaded
+        objectVersions.assign(patches.objects.size(), ~0u);
+        geometryVersion = patches.getGeometryVersion();
+        capturedLevel = level;
+    }
+
+    // re-uploads the instances of a surface when one of its objects moved
+    void updateInstances(const PatchRenderer& patches)
+    {
+        GLState& state = GLState::instance();
+        for (SurfaceEntry& entry : entries)
+        {
+            bool changed = false;
+            for (unsigned int object : entry.objects)
+            {
+                unsigned int version = patches.objects[object].transform.getVersion();
+                if (version != objectVersions[object])
+                {
+                    objectVersions[object] = version;
+                    changed = true;
+                }
+            }
+            if (!changed || entry.VAO == 0)
+                continue;
+
+            const MaterialLibrary& library = MaterialLibrary::instance();
+            entry.instances.clear();
+            entry.materials.clear();
+            entry.runs.clear();
+            for (unsigned int object : entry.objects)
+            {
+                const unsigned int material = patches.objects[object].material;
+                if (entry.runs.empty() || !library.get(material).sharesBindings(library.get(entry.materials[entry.runs.back().first])))
+                    entry.runs.push_back({ (GLsizei)entry.instances.size(), 0 });
+                entry.runs.back().count++;
+                entry.instances.push_back(AffineRecord::fromMat4(patches.objects[object].transform.getModelMatrix()));
+                entry.materials.push_back(material);
+            }
+            state.bindBuffer(GL_ARRAY_BUFFER, entry.instanceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, entry.instances.size() * sizeof(AffineRecord), entry.instances.data(), GL_DYNAMIC_DRAW);
+            state.bindBuffer(GL_ARRAY_BUFFER, entry.materialBuffer);
+            glBufferData(GL_ARRAY_BUFFER, entry.materials.size() * sizeof(GLuint), entry.materials.data(), GL_DYNAMIC_DRAW);
+        }
+    }
+
+    // moves the per-instance attributes of the bound VAO to start at instance first, base instances need 4.2
+    void pointInstances(SurfaceEntry& entry, GLsizei first)
+    {
+        if (entry.instanceOffset == first)
+            return;
+        GLState& state = GLState::instance();
+        state.bindBuffer(GL_ARRAY_BUFFER, entry.materialBuffer);
+        glVertexAttribIPointer(MATERIAL_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)(first * sizeof(GLuint)));
+        state.bindBuffer(GL_ARRAY_BUFFER, entry.instanceBuffer);
+        for (int row = 0; row < 3; row++)
+        {
+            glVertexAttribPointer(INSTANCE_ATTRIBUTE + row, 4, GL_FLOAT, GL_FALSE, sizeof(AffineRecord),
+                (void*)(first * sizeof(AffineRecord) + row * sizeof(glm::vec4)));
+        }
+        entry.instanceOffset = first;
+    }
+};
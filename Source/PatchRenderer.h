@@ -0,0 +1,354 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Material.h"
+#include "Shader.h"
+#include "Transform.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define PATCH_RECORD_BINDING 2
+#define PATCH_OBJECT_BINDING 3
+#define PATCH_SHADER_DEFINE "#define PATCH_OBJECTS"
+
+// Bicubic Bezier surface made of 16 point patches. Identical control points are stored once,
+// so neighbouring patches share their boundary points.
+struct BezierSurface
+{
+    std::vector<glm::vec3> controlPoints;
+    // 16 per patch, row i (along u) of a patch is indices[i * 4 .. i * 4 + 3]
+    std::vector<GLuint> indices;
+
+    size_t getPatchCount() const { return indices.size() / 16; }
+
+    // .bpt: patch count, then per patch its degrees ("3 3") followed by 16 "x y z" lines
+    bool loadBpt(const std::string& path)
+    {
+        std::ifstream file(path);
+        size_t patchCount = 0;
+        if (!(file >> patchCount))
+        {
+            std::cout << "ERROR::BEZIER_SURFACE::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return false;
+        }
+
+        std::map<std::tuple<float, float, float>, GLuint> unique;
+        for (size_t patch = 0; patch < patchCount; patch++)
+        {
+            int degreeU = 0, degreeV = 0;
+            file >> degreeU >> degreeV;
+            if (degreeU != 3 || degreeV != 3)
+            {
+                std::cout << "ERROR::BEZIER_SURFACE::ONLY_BICUBIC_PATCHES_SUPPORTED: " << path << std::endl;
+                return false;
+            }
+
+            for (int k = 0; k < 16; k++)
+            {
+                glm::vec3 point;
+                if (!(file >> point.x >> point.y >> point.z))
+                {
+                    std::cout << "ERROR::BEZIER_SURFACE::UNEXPECTED_END_OF_FILE: " << path << std::endl;
+                    return false;
+                }
+                auto found = unique.emplace(std::make_tuple(point.x, point.y, point.z), (GLuint)controlPoints.size());
+                if (found.second)
+                    controlPoints.push_back(point);
+                indices.push_back(found.first->second);
+            }
+        }
+        return true;
+    }
+};
+
+// Draws every patch of every object with a single glDrawElements(GL_PATCHES), one per texture array set
+// without bindless textures. Control points of all surfaces live in one persistent buffer, objects using
+// the same surface index the same points. Which object and material a patch belongs to is a storage buffer
+// record looked up by gl_PrimitiveID, object matrices are a second storage buffer updated only when
+// a transform changes.
+// Without shader storage buffers every object is drawn on its own with the regular tessellation shader.
+class PatchRenderer
+{
+public:
+    struct PatchObject
+    {
+        unsigned int surface;
+        unsigned int material;
+        Transform transform;
+    };
+
+    std::vector<PatchObject> objects;
+
+    unsigned int addSurface(const BezierSurface& surface)
+    {
+        surfaces.push_back(surface);
+        dirtyGeometry = true;
+        return (unsigned int)surfaces.size() - 1;
+    }
+
+    // swaps the patches of a surface, e.g. a subdivision surface refined to another level
+    void setSurface(unsigned int index, const BezierSurface& surface)
+    {
+        surfaces[index] = surface;
+        dirtyGeometry = true;
+    }
+
+    // draws the object with another surface, e.g. a finer refinement of the same cage
+    void setObjectSurface(unsigned int object, unsigned int surface)
+    {
+        if (objects[object].surface == surface)
+            return;
+        objects[object].surface = surface;
+        dirtyGeometry = true;
+    }
+
+    unsigned int addObject(unsigned int surface, const Transform& transform, unsigned int material = 0)
+    {
+        objects.push_back({ surface, material, transform });
+        dirtyGeometry = true;
+        return (unsigned int)objects.size() - 1;
+    }
+
+    size_t getPatchCount() const { return patchCount; }
+    size_t getSurfaceCount() const { return surfaces.size(); }
+    const BezierSurface& getSurface(unsigned int surface) const { return surfaces[surface]; }
+    // changes whenever the shared buffers are rebuilt
+    unsigned int getGeometryVersion() const { return geometryVersion; }
+
+    // builds the shared buffers once surfaces or objects were added
+    void prepare()
+    {
+        if (dirtyGeometry)
+            buildGeometry();
+    }
+
+    // the patches of one surface, with whatever transform the bound shader applies (see PatchCache)
+    void drawSurface(unsigned int surface)
+    {
+        prepare();
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            if (objects[i].surface != surface)
+                continue;
+            glPatchParameteri(GL_PATCH_VERTICES, 16);
+            GLState::instance().bindVertexArray(VAO);
+            glDrawElements(GL_PATCHES, objectIndexCounts[i], GL_UNSIGNED_INT, (void*)(objectFirstIndices[i] * sizeof(GLuint)));
+            return;
+        }
+    }
+
+    static bool supportsStorage()
+    {
+        return GLCaps::instance().shaderStorage;
+    }
+
+    // shader variant reading the patch records, see tessControl.tcs
+    static std::string makeShaderHeader(const char* materialHeader)
+    {
+        if (materialHeader)
+            return std::string(materialHeader) + "\n" PATCH_SHADER_DEFINE;
+        return "#version 430 core\n" PATCH_SHADER_DEFINE;
+    }
+
+    static void setupShader(const Shader& shader)
+    {
+        if (!supportsStorage())
+            return;
+        GLuint recordIndex = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "PatchRecords");
+        if (recordIndex != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(shader.ID, recordIndex, PATCH_RECORD_BINDING);
+        GLuint objectIndex = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "PatchObjects");
+        if (objectIndex != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(shader.ID, objectIndex, PATCH_OBJECT_BINDING);
+    }
+
+    // patchShader is the PATCH_OBJECTS variant (null without storage buffers), fallbackShader the regular
+    // tessellation shader, both with their per frame uniforms already set
+    void draw(Shader* patchShader, Shader& fallbackShader)
+    {
+        if (objects.empty())
+            return;
+        prepare();
+
+        GLState& state = GLState::instance();
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        glPatchParameteri(GL_PATCH_VERTICES, 16);
+        state.bindVertexArray(VAO);
+
+        if (!patchShader || !supportsStorage())
+        {
+            fallbackShader.use();
+            for (size_t i : drawOrder)
+            {
+                const PatchObject& object = objects[i];
+                if (!library.isBindless())
+                    library.get(object.material).bind();
+                fallbackShader.setModelMatrix(object.transform.getModelMatrix());
+                glVertexAttribI1ui(MATERIAL_ATTRIBUTE, object.material);
+                glDrawElements(GL_PATCHES, objectIndexCounts[i], GL_UNSIGNED_INT, (void*)(objectFirstIndices[i] * sizeof(GLuint)));
+            }
+            return;
+        }
+
+        updateObjectMatrices();
+        patchShader->use();
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, PATCH_RECORD_BINDING, recordBuffer);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, PATCH_OBJECT_BINDING, objectBuffer);
+        if (library.isBindless())
+        {
+            patchShader->setInt("patchBase", 0);
+            glDrawElements(GL_PATCHES, (GLsizei)(patchCount * 16), GL_UNSIGNED_INT, 0);
+            return;
+        }
+
+        // without bindless textures a draw can only sample one texture array set, the objects are laid out by
+        // set so each one is a single run, and the records are found from the first patch of the run
+        size_t first = 0;
+        while (first < drawOrder.size())
+        {
+            const Material& material = library.get(objects[drawOrder[first]].material);
+            size_t end = first + 1;
+            while (end < drawOrder.size() && material.sharesBindings(library.get(objects[drawOrder[end]].material)))
+                end++;
+
+            material.bind();
+            const size_t last = drawOrder[end - 1];
+            const GLuint firstIndex = objectFirstIndices[drawOrder[first]];
+            const GLsizei count = (GLsizei)(objectFirstIndices[last] + objectIndexCounts[last] - firstIndex);
+            patchShader->setInt("patchBase", (int)(firstIndex / 16));
+            glDrawElements(GL_PATCHES, count, GL_UNSIGNED_INT, (void*)(firstIndex * sizeof(GLuint)));
+            first = end;
+        }
+    }
+
+private:
+    std::vector<BezierSurface> surfaces;
+    bool dirtyGeometry = false;
+    unsigned int geometryVersion = 0;
+    size_t patchCount = 0;
+
+    GLuint VAO = 0, controlPointBuffer = 0, indexBuffer = 0, recordBuffer = 0, objectBuffer = 0;
+    std::vector<GLuint> objectFirstIndices;
+    std::vector<GLsizei> objectIndexCounts;
+    // objects in the order of the index buffer, sorted by texture array set
+    std::vector<size_t> drawOrder;
+    std::vector<glm::mat4> objectMatrices;
+    std::vector<unsigned int> objectVersions;
+
+    void release()
+    {
+        GLState& state = GLState::instance();
+        state.deleteVertexArray(VAO);
+        state.deleteBuffer(controlPointBuffer);
+        state.deleteBuffer(indexBuffer);
+        state.deleteBuffer(recordBuffer);
+        state.deleteBuffer(objectBuffer);
+        VAO = controlPointBuffer = indexBuffer = recordBuffer = objectBuffer = 0;
+    }
+
+    // control points of all surfaces, then the patches of every object pointing into them. Runs on the first
+    // draw, after MaterialLibrary::build() placed the textures in their arrays.
+    void buildGeometry()
+    {
+        release();
+
+        const MaterialLibrary& library = MaterialLibrary::instance();
+        drawOrder.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); i++)
+            drawOrder[i] = i;
+        if (!library.isBindless())
+        {
+            auto arrays = [&](size_t object)
+                {
+                    const Material& material = library.get(objects[object].material);
+                    return std::make_tuple(material.diffuse.array, material.specular.array);
+                };
+            std::stable_sort(drawOrder.begin(), drawOrder.end(), [&](size_t a, size_t b) { return arrays(a) < arrays(b); });
+        }
+
+        std::vector<glm::vec3> points;
+        std::vector<GLuint> surfaceBase;
+        for (const BezierSurface& surface : surfaces)
+        {
+            surfaceBase.push_back((GLuint)points.size());
+            points.insert(points.end(), surface.controlPoints.begin(), surface.controlPoints.end());
+        }
+
+        std::vector<GLuint> indices;
+        std::vector<glm::uvec2> records;
+        objectFirstIndices.assign(objects.size(), 0);
+        objectIndexCounts.assign(objects.size(), 0);
+        for (size_t i : drawOrder)
+        {
+            const BezierSurface& surface = surfaces[objects[i].surface];
+            objectFirstIndices[i] = (GLuint)indices.size();
+            objectIndexCounts[i] = (GLsizei)surface.indices.size();
+            for (GLuint index : surface.indices)
+                indices.push_back(surfaceBase[objects[i].surface] + index);
+            for (size_t patch = 0; patch < surface.getPatchCount(); patch++)
+                records.push_back(glm::uvec2((unsigned int)i, objects[i].material));
+        }
+        patchCount = records.size();
+
+        GLState& state = GLState::instance();
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &controlPointBuffer);
+        glGenBuffers(1, &indexBuffer);
+
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, controlPointBuffer);
+        glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(glm::vec3), points.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+        state.bindVertexArray(0);
+
+        if (supportsStorage())
+        {
+            glGenBuffers(1, &recordBuffer);
+            state.bindBuffer(GL_SHADER_STORAGE_BUFFER, recordBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(glm::uvec2), records.data(), GL_STATIC_DRAW);
+
+            glGenBuffers(1, &objectBuffer);
+            state.bindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+            objectMatrices.assign(objects.size(), glm::mat4(1.0f));
+            // no transform has this version, so the first frame uploads everything
+            objectVersions.assign(objects.size(), ~0u);
+        }
+        dirtyGeometry = false;
+        geometryVersion++;
+    }
+
+    // uploads the range of objects whose transform changed since the last frame
+    void updateObjectMatrices()
+    {
+        size_t first = objects.size(), last = 0;
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            unsigned int version = objects[i].transform.getVersion();
+            if (version == objectVersions[i])
+                continue;
+            objectVersions[i] = version;
+            objectMatrices[i] = objects[i].transform.getModelMatrix();
+            first = std::min(first, i);
+            last = i;
+        }
+        if (first > last)
+            return;
+
+        GLState::instance().bindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(glm::mat4), (last - first + 1) * sizeof(glm::mat4), &objectMatrices[first]);
+    }
+};
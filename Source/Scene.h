@@ -1,26 +1,96 @@
 #pragma once
+#include <map>
+#include <memory>
 #include <vector>
 
 #include "Camera.h"
+#include "Cloth.h"
+#include "CpuTessellator.h"
 #include "DirLight.h"
-#include "GameObject.h"
+#include "EntityWorld.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include "HlodBuilder.h"
+#include "ImpostorBaker.h"
+#include "LightGizmos.h"
+#include "Material.h"
 #include "Model.h"
+#include "PatchCache.h"
+#include "ParticleSystem.h"
+#include "PatchRenderer.h"
 #include "PointLight.h"
+#include "SkinningSystem.h"
 #include "SpotLight.h"
+#include "SubdivisionSurface.h"
+#include "TrackNetwork.h"
+#include "VegetationScatter.h"
+#include "VertexAnimationBaker.h"
+
+// Programs the scene draws with, created by main() and handed to the scene once before the first frame.
+// patch is null without shader storage buffers, the compute programs and particle without compute shaders
+struct ScenePrograms
+{
+    Shader* shader = nullptr;
+    Shader* instanced = nullptr;
+    Shader* crowd = nullptr;
+    Shader* impostor = nullptr;
+    Shader* gouraud = nullptr;
+    Shader* gouraudInstanced = nullptr;
+    Shader* light = nullptr;
+    Shader* tessellation = nullptr;
+    Shader* patch = nullptr;
+    Shader* capture = nullptr;
+    Shader* particle = nullptr;
+    ComputeShader* cloth = nullptr;
+    ComputeShader* skinning = nullptr;
+    ComputeShader* particles = nullptr;
+    ComputeShader* vegetation = nullptr;
+};
 
 class Scene
 {
 public:
-    std::vector<std::unique_ptr<GameObject>> gameObjects;
+    ScenePrograms programs;
+    EntityWorld world;
+    // Entities created by setupScene, listed in the UI (stress test entities are not)
+    std::vector<Entity> sceneEntities;
+    // rails and the vehicles on them, the train is one of them
+    TrackNetwork tracks;
+    Model* vehicleModel = nullptr; // for spawned vehicles
+    // the followed vehicle and its entity
+    size_t followedVehicle = ~(size_t)0;
+    Entity train = INVALID_ENTITY;
+    // Mirrors the followed vehicle's entity, so the headlight and the chase camera can be its children
+    Transform trainNode;
+    bool frustumCulling = true;
     std::vector<PointLight> pointLights;
     SpotLight spotLight;
     DirLight dirLight;
-    Model* sphereModel; // for point lights
+    Model* sphereModel; // for the stress test entities
+    LightGizmos lightGizmos;
+    // models further than impostorDistance from the camera are drawn as baked impostors
+    ImpostorBaker impostors;
+    bool useImpostors = true;
+    float impostorDistance = 40.0f;
+    // merged proxies of the static scene entities, coarser ones further away
+    HlodBuilder hlod;
+    bool useHlod = true;
+    // shading LOD, objects covering less of the screen height than gouraudCoverage are lit per vertex
+    bool shadingLod = true;
+    float gouraudCoverage = 0.05f;
     float fogDistance = 60.0f;
+    // everything past fogDistance is the sky colour, so it is culled and the far plane is pulled in to it
+    bool fogCulling = true;
     bool isDayLight = true;
+    bool wireFrame = false;
     
 	bool useBlinn = true;
+    // maximum level with adaptive tessellation, the level of every edge without it
     float tessLevel = 32.0f;
+    bool adaptiveTessellation = true;
+    float tessPixelsPerEdge = 12.0f;
+    // only for the loaded surfaces, they are closed
+    bool patchBackfaceCulling = true;
 
     int screenWidth = 1400;
     int screenHeight = 900;
@@ -30,6 +100,11 @@ public:
 
     glm::vec3 trainLightDirection = { -1.0f, -0.25f, 0.0f };
 
+    // Pipeline states, switching between them only touches what differs
+    const PipelineState solidPipeline = PipelineState();
+    const PipelineState wireFramePipeline = PipelineState(makeWireFrameDesc());
+    const PipelineState particlePipeline = PipelineState(makeParticleDesc());
+
     // Bezier
     std::vector<glm::vec3> controlPoints = {
         // Bottom row
@@ -54,9 +129,45 @@ public:
         glm::vec3(1.0f, 0.5f, 1.0f)
     };
     Transform bezierTransform;
+    // surfaces loaded from .bpt files
+    PatchRenderer patches;
+    // replays captured tessellation of the surfaces instead of tessellating them every frame
+    bool cacheSurfaces = false;
+    PatchCache patchCache;
+    // evaluates the demo patch and the surfaces on worker threads instead of the tessellation shaders,
+    // at a fixed level and without adaptive levels
+    bool cpuTessellation = false;
+    CpuTessellator cpuTessellator;
+    // Catmull-Clark cage drawn through the patch pipeline, the irregular faces of every object are refined
+    // deeper the larger its cage edges are on screen
+    SubdivisionSurface subdivisionCage;
+    bool adaptiveIsolation = true;
+    // the level of every object without adaptive levels, otherwise the finest level an object uses
+    int isolationLevel = 2;
+    int maxIsolationLevel = 5;
+    // on screen size of the faces left at the last level, they become end caps
+    float isolationPixels = 24.0f;
+    // of the finest level in use
+    SubdivisionSurface::Stats subdivisionStats;
+    // flag simulated in cloth.cs, or on the CPU without compute shaders
+    Cloth cloth;
+    bool simulateCloth = true;
+    // entities with rigged models, sampled on the workers and skinned once per frame
+    SkinningSystem skinning;
+    // herds of a rigged model played from vertex animation textures, without per instance skinning
+    VertexAnimationBaker crowdAnimations;
+    Model* crowdModel = nullptr;
+    // steam of the followed vehicle and sparks under the others, simulated and drawn without the CPU
+    ParticleSystem particles;
+    bool simulateParticles = true;
+    int sparkingVehicles = 8;
+    // grass tufts and rocks scattered over the floor on the GPU every frame
+    VegetationScatter vegetation;
+    Model* grassModel = nullptr;
     float time = 0.0f;
     float animationSpeed = 3.5f;
-    float animationAmplitude = 0.005f;
+    // peak displacement of a control point along the patch's y axis, the wave itself runs in tessControl.tcs
+    float animationAmplitude = 0.1f;
 
     Scene() :
         spotLight(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), 12.5f, 15.0f, 1.0f, 0.008f, 0.001f,
@@ -64,18 +175,104 @@ public:
         dirLight(glm::vec3(-0.2f, -1.0f, -0.3f), glm::vec3(0.05f), glm::vec3(0.4f), glm::vec3(0.5f))
     {
         generateLights();
-        bezierTransform.position = glm::vec3(3.0f, 1.0f, 10.0f);
-        bezierTransform.scale = glm::vec3(3);
+        bezierTransform.setPosition(glm::vec3(3.0f, 1.0f, 10.0f));
+        bezierTransform.setScale(glm::vec3(3));
     }
 
-    void update(float deltaTime)
+    // Headlight and chase camera become children of the vehicle's transform
+    void followVehicle(size_t vehicle)
+    {
+        if (vehicle >= tracks.getVehicleCount())
+            return;
+        followedVehicle = vehicle;
+        // the attached light and camera must not step with the animation LOD
+        if (train != INVALID_ENTITY)
+            world.motion.followed[train] = 0;
+        train = tracks.vehicles.entity[vehicle];
+        world.motion.followed[train] = 1;
+        // forces a sync on the next update
+        trainNodeVersion = world.transforms.version[train] - 1;
+        trainLightDirection = tracks.vehicles.lightDirection[vehicle];
+        spotLight.attachTo(&trainNode, tracks.vehicles.lightOffset[vehicle], trainLightDirection);
+        if (tracks.vehicles.hasCameraSocket[vehicle])
+            camera.attachTo(&trainNode, tracks.vehicles.cameraOffset[vehicle]);
+        else
+            camera.attachTo(&trainNode);
+    }
+
+    // Vehicles spread evenly over the tracks after the first one, drawn instanced
+    void spawnVehicles(size_t count)
+    {
+        if (!vehicleModel || tracks.tracks.size() < 2)
+            return;
+        world.reserve(world.size() + count);
+        const size_t trackCount = tracks.tracks.size() - 1;
+        for (size_t i = 0; i < count; i++)
+        {
+            const uint32_t track = 1 + (uint32_t)(i % trackCount);
+            const size_t slot = i / trackCount;
+            const size_t slots = (count + trackCount - 1) / trackCount;
+            Entity entity = world.create(vehicleModel, Transform(), "");
+            world.render.instanced[entity] = 1;
+            tracks.addVehicle(track, tracks.tracks[track].length * (float)slot / (float)slots, 5.0f + (float)(track % 3) * 2.0f, entity, world);
+        }
+    }
+
+    // Herd of crowdModel on a grid playing its first clip, every instance with its own phase and pace.
+    // The clip is baked on first use, so the materials have to be built already
+    void spawnCrowd(size_t count)
     {
-        if (gameObjects.empty())
+        if (!crowdModel || !crowdAnimations.bake(crowdModel, 0))
             return;
+        const int side = (int)std::ceil(std::sqrt((float)count));
+        const float spacing = 2.5f * glm::max(crowdModel->getBoundingSphere().w, 0.5f);
+        const glm::vec3 origin(-0.5f * spacing * (float)side, -0.05f, 40.0f);
+        std::vector<VertexAnimationBaker::CrowdInstance> instances(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            Transform transform;
+            transform.setPosition(origin + glm::vec3((float)(i % side), 0.0f, (float)(i / side)) * spacing);
+            transform.setRotation(glm::vec3(0.0f, (float)((i * 137) % 360), 0.0f));
+            instances[i].transform = AffineRecord::fromMat4(transform.getModelMatrix());
+            instances[i].timeOffset = (float)((i * 7919) % 1000) * 0.01f;
+            instances[i].speed = 0.8f + (float)((i * 104729) % 100) * 0.004f;
+        }
+        crowdAnimations.addCrowd(crowdModel, 0, instances);
+    }
+
+    // Small moving spheres, drawn instanced
+    void spawnStressEntities(size_t count)
+    {
+        world.reserve(world.size() + count);
+        Transform transform;
+        transform.setScale(glm::vec3(0.2f));
+        for (size_t i = 0; i < count; i++)
+        {
+            Entity entity = world.create(sphereModel, transform, "");
+            world.render.instanced[entity] = 1;
+            world.motion.moving[entity] = 1;
+            world.motion.radius[entity] = 5.0f + (float)(i % 1000) * 0.5f;
+            world.motion.speed[entity] = 0.1f + (float)(i % 17) * 0.05f;
+            world.motion.angle[entity] = (float)i * 0.618f;
+            world.transforms.position[entity].y = (float)(i % 50) * 0.2f;
+        }
+    }
 
-        gameObjects[0]->update(deltaTime);
+    void update(float deltaTime)
+    {
+        tracks.update(deltaTime, world);
+        world.viewer = camera.Position;
+        world.update(deltaTime);
+        skinning.update(deltaTime);
+        crowdAnimations.update(deltaTime * skinning.playbackSpeed);
+        if (train != INVALID_ENTITY && world.transforms.version[train] != trainNodeVersion)
+        {
+            trainNode.setLocalMatrix(world.transforms.world[train].toMat4());
+            trainNodeVersion = world.transforms.version[train];
+        }
         updateSpotlight();
-        updateControlPoints(deltaTime);
+        time += deltaTime * animationSpeed;
+        frameTime = deltaTime;
     }
 
     void updateNight()
@@ -96,19 +293,237 @@ public:
         }
     }
 
-    void draw(Shader& shader, Shader& lightShader, Shader& tessellationShader)
+    // with the programs set up by main()
+    void draw()
     {
+        Shader& shader = *programs.shader;
+        Shader& instancedShader = *programs.instanced;
+        // depth writes have to be enabled for the clear to reach the depth buffer
+        GLState::instance().apply(wireFrame ? wireFramePipeline : solidPipeline);
+
         glClearColor(skyColor.x, skyColor.y, skyColor.z, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        const Frustum frustum = getCullingFrustum();
+        world.cull(frustum);
+        if (useHlod)
+            hlod.select(world, camera.Position, frustum);
+        // every pass below draws the visible skinned entities from these vertices
+        skinning.skin(programs.skinning, world);
+        if (programs.vegetation)
+            vegetation.scatter(*programs.vegetation, frustum, camera.Position);
+
+        // the solve runs here because it needs the context, its result is drawn right away
+        if (simulateCloth)
+            cloth.simulate(programs.cloth, frameTime);
+        if (simulateParticles && programs.particles)
+        {
+            updateEmitters();
+            particles.update(*programs.particles, frameTime, camera.Position);
+        }
+
         setupShaderUniforms(shader);
         drawObjects(shader);
-        setupLightUniforms(lightShader);
-        drawLights(lightShader);
-        drawTessellated(tessellationShader);
+        if (useHlod)
+            hlod.draw(shader);
+        cloth.draw(shader);
+        setupShaderUniforms(instancedShader);
+        drawInstanced(instancedShader);
+        vegetation.draw(instancedShader);
+        setupShaderUniforms(*programs.crowd);
+        crowdAnimations.draw(*programs.crowd, frustum);
+        setupShaderUniforms(*programs.impostor);
+        drawImpostors(*programs.impostor);
+        drawGouraud(*programs.gouraud, *programs.gouraudInstanced);
+        setupLightUniforms(*programs.light);
+        drawLights(*programs.light);
+        updateSubdivision();
+        if (cpuTessellation)
+            drawCpuTessellated(shader);
+        else
+        {
+            drawTessellated(*programs.tessellation, programs.patch);
+            if (cacheSurfaces)
+                patchCache.draw(patches, *programs.capture, instancedShader, tessLevel);
+        }
+        // blended, so after everything opaque
+        if (programs.particle)
+            drawParticles(*programs.particle);
+    }
+
+    // an object drawing subdivisionCage, updateSubdivision picks its isolation level every frame
+    void addSubdivisionObject(const Transform& transform, unsigned int material)
+    {
+        subdivisionObjects.push_back(patches.addObject(getSubdivisionSurface(isolationLevel), transform, material));
+    }
+
+    // grass on the whole floor, rocks sparser and farther, the materials have to be built already
+    void setupVegetation()
+    {
+        VegetationScatter::Layer grass;
+        grass.model = grassModel;
+        grass.instancesPerTile = 384;
+        grass.maxDistance = 70.0f;
+        grass.scaleRange = glm::vec2(0.35f, 0.7f);
+        grass.heightRange = glm::vec2(0.65f, 1.35f);
+        grass.maxTilt = 0.25f;
+        grass.twoSided = true;
+        vegetation.addLayer(grass, 1u << 19);
+
+        // flattened spheres
+        VegetationScatter::Layer rocks;
+        rocks.model = sphereModel;
+        rocks.instancesPerTile = 6;
+        rocks.maxDistance = 150.0f;
+        rocks.fadeStart = 0.8f;
+        rocks.scaleRange = glm::vec2(0.08f, 0.35f);
+        rocks.heightRange = glm::vec2(0.4f, 0.8f);
+        rocks.maxTilt = 0.4f;
+        vegetation.addLayer(rocks, 1u << 15);
+    }
+
+    // proxies of the static scene entities, before MaterialLibrary::build() as their atlases become materials
+    void buildHlod()
+    {
+        // the world matrices are only composed by the first update
+        world.update(0.0f);
+        hlod.build(world, sceneEntities);
+    }
+
+    // Renders one impostor atlas per model of the scene, instanced or not, and of the models spawned later.
+    // The materials have to be built already
+    void bakeImpostors(Shader& bakeShader)
+    {
+        GLState::instance().apply(solidPipeline);
+        for (Entity entity : sceneEntities)
+        {
+            Model* model = world.render.model[entity];
+            if (model && !world.render.skinned[entity])
+                impostors.bake(model, bakeShader);
+        }
+        for (Model* model : { vehicleModel, sphereModel })
+        {
+            if (model)
+                impostors.bake(model, bakeShader);
+        }
     }
 
 private:
+    uint32_t trainNodeVersion = 0;
+    std::vector<Entity> sparkingEntities;
+    float frameTime = 0.0f;
+    // patch objects drawing the subdivision cage
+    std::vector<unsigned int> subdivisionObjects;
+    // surface of the cage in the patch renderer per isolation level, built on first use
+    std::map<int, unsigned int> subdivisionSurfaces;
+    std::map<int, SubdivisionSurface::Stats> subdivisionLevelStats;
+    float cageEdgeLength = 0.0f;
+    // rest pose of the demo patch, uploaded once
+    GLuint patchVAO = 0, patchVBO = 0;
+    // world matrices of the visible instanced entities per model, refilled every frame
+    std::map<Model*, std::vector<AffineRecord>> instanceLists;
+    // world matrices of the visible entities drawn as impostors per model
+    std::map<Model*, std::vector<AffineRecord>> impostorLists;
+    // visible entities lit per vertex, drawn after the per pixel ones to switch programs once
+    std::vector<Entity> gouraudEntities;
+    std::map<Model*, std::vector<AffineRecord>> gouraudInstanceLists;
+
+    glm::mat4 getProjectionMatrix() const
+    {
+        return glm::perspective(glm::radians(camera.Zoom), (float)screenWidth / (float)screenHeight, 0.1f, getFarPlane());
+    }
+
+    // the fog distance is radial, so a plane at that depth never clips anything that is not fully fogged
+    float getFarPlane() const
+    {
+        return fogCulling ? glm::clamp(fogDistance, 1.0f, 1000.0f) : 1000.0f;
+    }
+
+    Frustum getCullingFrustum()
+    {
+        Frustum frustum = frustumCulling ? Frustum::fromMatrix(getProjectionMatrix() * camera.getViewMatrix()) : Frustum::everything();
+        if (fogCulling)
+            frustum.setRange(camera.Position, fogDistance);
+        return frustum;
+    }
+
+    static PipelineStateDesc makeWireFrameDesc()
+    {
+        PipelineStateDesc desc;
+        desc.polygonMode = GL_LINE;
+        return desc;
+    }
+
+    // tested against the scene but not written, the colors are premultiplied so additive particles blend too
+    static PipelineStateDesc makeParticleDesc()
+    {
+        PipelineStateDesc desc;
+        desc.depthWrite = false;
+        desc.blend = true;
+        desc.blendSrc = GL_ONE;
+        return desc;
+    }
+
+    // Steam from the followed vehicle's chimney, sparks from the wheels of the first other moving vehicles
+    void updateEmitters()
+    {
+        std::vector<ParticleSystem::Emitter>& emitters = particles.emitters;
+        emitters.clear();
+        if (train != INVALID_ENTITY)
+        {
+            const glm::mat4 matrix = world.transforms.world[train].toMat4();
+            ParticleSystem::Emitter steam;
+            steam.position = glm::vec3(matrix * glm::vec4(0.0f, 1.5f, 0.5f, 1.0f));
+            steam.radius = 0.15f;
+            steam.velocity = glm::vec3(0.0f, 2.0f, 0.0f);
+            steam.spread = 0.4f;
+            steam.color = glm::vec4(0.85f, 0.85f, 0.88f, 0.35f);
+            steam.startSize = 0.3f;
+            steam.endSize = 2.5f;
+            steam.gravityScale = -0.05f;
+            steam.drag = 0.8f;
+            steam.minLife = 2.0f;
+            steam.maxLife = 4.0f;
+            steam.rate = 400.0f;
+            emitters.push_back(steam);
+        }
+        // the sparking vehicles are followed too, so their emitters don't step while hidden
+        for (Entity entity : sparkingEntities)
+            world.motion.followed[entity] = entity == train ? 1 : 0;
+        sparkingEntities.clear();
+        for (size_t vehicle = 0; vehicle < tracks.getVehicleCount() && (int)sparkingEntities.size() < sparkingVehicles; vehicle++)
+        {
+            const Entity entity = tracks.vehicles.entity[vehicle];
+            if (entity == train || !tracks.vehicles.moving[vehicle])
+                continue;
+            world.motion.followed[entity] = 1;
+            sparkingEntities.push_back(entity);
+            const glm::mat4 matrix = world.transforms.world[entity].toMat4();
+            ParticleSystem::Emitter sparks;
+            sparks.position = glm::vec3(matrix[3]) + glm::vec3(0.0f, 0.05f, 0.0f);
+            sparks.radius = 0.3f;
+            sparks.velocity = glm::vec3(0.0f, 1.5f, 0.0f) - glm::normalize(glm::vec3(matrix[2])) * 2.0f;
+            sparks.spread = 2.5f;
+            sparks.color = glm::vec4(1.0f, 0.55f, 0.15f, 0.0f);
+            sparks.startSize = 0.04f;
+            sparks.endSize = 0.01f;
+            sparks.gravityScale = 1.0f;
+            sparks.drag = 0.1f;
+            sparks.minLife = 0.4f;
+            sparks.maxLife = 1.2f;
+            sparks.rate = 3000.0f;
+            emitters.push_back(sparks);
+        }
+    }
+
+    void drawParticles(Shader& particleShader)
+    {
+        GLState::instance().apply(particlePipeline);
+        setupLightUniforms(particleShader);
+        particles.draw(particleShader);
+        GLState::instance().apply(wireFrame ? wireFramePipeline : solidPipeline);
+    }
+
     void generateLights()
     {
         pointLights.clear();
@@ -140,12 +555,9 @@ private:
         shader.use();
         shader.setVec3("viewPos", camera.Position);
         shader.setBool("blinn", useBlinn);
-        shader.setFloat("material.shininess", 32.0f); // no specular map
 
         // Matrices
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom),
-            (float)screenWidth / (float)screenHeight, 0.1f, 1000.0f);
-        shader.setMat4("projection", projection);
+        shader.setMat4("projection", getProjectionMatrix());
         shader.setMat4("view", camera.getViewMatrix());
 
         // Lights
@@ -164,91 +576,240 @@ private:
     void setupLightUniforms(Shader& lightShader)
     {
         lightShader.use();
-        lightShader.setMat4("projection", glm::perspective(glm::radians(camera.Zoom),
-            (float)screenWidth / (float)screenHeight, 0.1f, 1000.0f));
+        lightShader.setMat4("projection", getProjectionMatrix());
         lightShader.setMat4("view", camera.getViewMatrix());
-        lightShader.setVec3("viewPos", camera.Position);
         lightShader.setFloat("fogDistance", fogDistance);
         lightShader.setVec3("skyColor", skyColor);
     }
 
-    // Spotlight fixed to first object (train)
+    // Spotlight attached to the followed vehicle (see followVehicle)
     void updateSpotlight()
     {
-        static glm::vec3 localOffset(-9, 3.5f, 0.0f);
+        if (followedVehicle < tracks.getVehicleCount())
+            tracks.vehicles.lightDirection[followedVehicle] = trainLightDirection;
+        spotLight.localDirection = trainLightDirection;
+        spotLight.updateFromNode();
+    }
 
-        if (gameObjects.empty())
-            return;
+    void drawObjects(Shader& shader)
+    {
+        for (auto& list : instanceLists)
+            list.second.clear();
+        for (auto& list : impostorLists)
+            list.second.clear();
+        for (auto& list : gouraudInstanceLists)
+            list.second.clear();
+        gouraudEntities.clear();
+
+        for (Entity entity : world.visible)
+        {
+            Model* model = world.render.model[entity];
+            if (!model)
+                continue;
+            const bool gouraud = shadingLod && getScreenCoverage(entity) < gouraudCoverage;
+            if (world.render.instanced[entity])
+            {
+                if (drawsImpostor(entity, model))
+                    impostorLists[model].push_back(world.transforms.world[entity]);
+                else
+                    (gouraud ? gouraudInstanceLists : instanceLists)[model].push_back(world.transforms.world[entity]);
+                continue;
+            }
+            if (useHlod && hlod.covered[entity])
+                continue;
+            if (drawsImpostor(entity, model))
+            {
+                impostorLists[model].push_back(world.transforms.world[entity]);
+                continue;
+            }
+            if (gouraud)
+            {
+                gouraudEntities.push_back(entity);
+                continue;
+            }
+            shader.setModelMatrix(world.transforms.world[entity].toMat4());
+            model->Draw(shader, skinning.getVertexArray(entity));
+        }
+    }
 
-        const auto& transform = gameObjects[0]->transform;
-        glm::mat4 rotationMatrix = glm::mat4(1.0f);
-        rotationMatrix = glm::rotate(rotationMatrix, glm::radians(transform.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-        rotationMatrix = glm::rotate(rotationMatrix, glm::radians(transform.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-        rotationMatrix = glm::rotate(rotationMatrix, glm::radians(transform.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+    void drawInstanced(Shader& instancedShader)
+    {
+        for (auto& list : instanceLists)
+            list.first->DrawInstanced(instancedShader, list.second.data(), (GLsizei)list.second.size());
+    }
 
-        spotLight.position = transform.position + glm::vec3(rotationMatrix * glm::vec4(localOffset, 1.0f));
-        spotLight.direction = glm::normalize(glm::vec3(rotationMatrix * glm::vec4(trainLightDirection, 0.0f)));
+    // skinned entities have no impostors, they would be frozen in the bind pose
+    bool drawsImpostor(Entity entity, Model* model) const
+    {
+        return useImpostors && !world.render.skinned[entity] && isFarField(entity) && impostors.has(model);
     }
 
-    void updateControlPoints(float deltaTime)
+    // distance from the camera to the entity's bounding sphere, so large objects switch only when all of them is far
+    bool isFarField(Entity entity) const
     {
-        time += deltaTime * animationSpeed;
+        const glm::vec4& sphere = world.bounds.world[entity];
+        return glm::length(glm::vec3(sphere) - camera.Position) - sphere.w > impostorDistance;
+    }
 
-        for (size_t i = 0; i < controlPoints.size(); ++i)
-        {
-            controlPoints[i].y += animationAmplitude * sin(time + i * 0.5f);
-        }
+    // projected diameter of the entity's bounding sphere as a fraction of the screen height
+    float getScreenCoverage(Entity entity) const
+    {
+        const glm::vec4& sphere = world.bounds.world[entity];
+        const float distance = glm::max(glm::length(glm::vec3(sphere) - camera.Position), sphere.w);
+        return sphere.w / (distance * std::tan(glm::radians(camera.Zoom) * 0.5f));
     }
 
-    void drawObjects(Shader& shader) const
+    void drawGouraud(Shader& gouraudShader, Shader& gouraudInstancedShader)
     {
-        for (const auto& obj : gameObjects)
+        if (!gouraudEntities.empty())
+        {
+            setupShaderUniforms(gouraudShader);
+            for (Entity entity : gouraudEntities)
+            {
+                gouraudShader.setModelMatrix(world.transforms.world[entity].toMat4());
+                world.render.model[entity]->Draw(gouraudShader, skinning.getVertexArray(entity));
+            }
+        }
+        // the lists are only cleared between frames, a model without small entities keeps an empty one
+        bool anyInstanced = false;
+        for (auto& list : gouraudInstanceLists)
+            anyInstanced = anyInstanced || !list.second.empty();
+        if (!anyInstanced)
+            return;
+        setupShaderUniforms(gouraudInstancedShader);
+        for (auto& list : gouraudInstanceLists)
         {
-            shader.setMat4("model", obj->transform.getModelMatrix());
-            obj->model->Draw(shader);
+            if (!list.second.empty())
+                list.first->DrawInstanced(gouraudInstancedShader, list.second.data(), (GLsizei)list.second.size());
         }
     }
 
-    void drawLights(Shader& lightShader) const
+    void drawImpostors(Shader& impostorShader)
     {
-        for (const auto& light : pointLights)
-        {
-            glm::mat4 model = glm::translate(glm::mat4(1.0f), light.position);
-            model = glm::scale(model, glm::vec3(0.2f));
-            lightShader.setMat4("model", model);
-            lightShader.setVec3("lightColor", light.diffuse);
-            sphereModel->Draw(lightShader);
-        }
+        for (auto& list : impostorLists)
+            impostors.draw(impostorShader, list.first, list.second.data(), (GLsizei)list.second.size());
     }
 
-    void drawTessellated(Shader& tessellationShader)
+    void drawLights(Shader& lightShader)
+    {
+        lightGizmos.draw(lightShader, pointLights, 0.2f);
+    }
+
+    void setupTessellationUniforms(Shader& tessellationShader)
     {
-        tessellationShader.use();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom),
-            (float)screenWidth / (float)screenHeight, 0.1f, 1000.0f);
-        glm::mat4 view = camera.getViewMatrix();
-        tessellationShader.setMat4("projection", projection);
-        tessellationShader.setMat4("view", view);
-        tessellationShader.setMat4("model", bezierTransform.getModelMatrix());
-        tessellationShader.setVec3("viewPos", camera.Position);
-        tessellationShader.setFloat("tessLevel", tessLevel);
         setupShaderUniforms(tessellationShader);
+        tessellationShader.setFloat("tessLevel", tessLevel);
+        tessellationShader.setBool("adaptive", adaptiveTessellation);
+        tessellationShader.setFloat("pixelsPerEdge", tessPixelsPerEdge);
+        tessellationShader.setVec2("viewportSize", glm::vec2((float)screenWidth, (float)screenHeight));
+        tessellationShader.setFloat("waveTime", time);
+        tessellationShader.setVec3("waveOffset", glm::vec3(0.0f));
+    }
+
+    // world space displacement of a control point at the peak of the wave
+    glm::vec3 getWaveOffset() const
+    {
+        return glm::mat3(bezierTransform.getModelMatrix()) * glm::vec3(0.0f, animationAmplitude, 0.0f);
+    }
 
-        unsigned int vao, vbo;
-        glGenVertexArrays(1, &vao);
-        glGenBuffers(1, &vbo);
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, controlPoints.size() * sizeof(glm::vec3), &controlPoints[0], GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-        glEnableVertexAttribArray(0);
+    void drawTessellated(Shader& tessellationShader, Shader* patchShader)
+    {
+        setupTessellationUniforms(tessellationShader);
+        tessellationShader.setModelMatrix(bezierTransform.getModelMatrix());
+        tessellationShader.setVec3("waveOffset", getWaveOffset());
+        // the demo patch is an open surface
+        tessellationShader.setBool("backfaceCulling", false);
+
+        GLState& state = GLState::instance();
+        if (patchVAO == 0)
+        {
+            glGenVertexArrays(1, &patchVAO);
+            glGenBuffers(1, &patchVBO);
+            state.bindVertexArray(patchVAO);
+            state.bindBuffer(GL_ARRAY_BUFFER, patchVBO);
+            glBufferData(GL_ARRAY_BUFFER, controlPoints.size() * sizeof(glm::vec3), &controlPoints[0], GL_STATIC_DRAW);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+            glEnableVertexAttribArray(0);
+        }
+        state.bindVertexArray(patchVAO);
+
+        // default material, the patch has no textures of its own
+        MaterialLibrary::instance().get(0).bind();
+        glVertexAttribI1ui(MATERIAL_ATTRIBUTE, 0);
 
-        glBindVertexArray(vao);
         glPatchParameteri(GL_PATCH_VERTICES, 16); // 16 control points
         glDrawArrays(GL_PATCHES, 0, 16);
-        glBindVertexArray(0);
 
-		glDeleteVertexArrays(1, &vao);
-		glDeleteBuffers(1, &vbo);
+        if (cacheSurfaces)
+            return;
+
+        // loaded surfaces, the regular shader is the fallback without storage buffers
+        tessellationShader.setVec3("waveOffset", glm::vec3(0.0f));
+        tessellationShader.setBool("backfaceCulling", patchBackfaceCulling);
+        if (patchShader)
+        {
+            setupTessellationUniforms(*patchShader);
+            patchShader->setBool("backfaceCulling", patchBackfaceCulling);
+        }
+        patches.draw(patchShader, tessellationShader);
+    }
+
+    // shader is the regular object shader with its per frame uniforms set
+    void drawCpuTessellated(Shader& shader)
+    {
+        cpuTessellator.clear();
+        // same wave as tessControl.tcs, 16 points are not worth a compute pass
+        const glm::mat4 model = bezierTransform.getModelMatrix();
+        const glm::vec3 waveOffset = getWaveOffset();
+        glm::vec3 points[16];
+        for (int k = 0; k < 16; k++)
+            points[k] = glm::vec3(model * glm::vec4(controlPoints[k], 1.0f)) + waveOffset * std::sin(time + k * 0.5f);
+        cpuTessellator.addPatch(points, 0);
+        for (const PatchRenderer::PatchObject& object : patches.objects)
+            cpuTessellator.addSurface(patches.getSurface(object.surface), object.transform.getModelMatrix(), object.material);
+
+        cpuTessellator.draw(shader, getCullingFrustum(), (int)std::ceil(tessLevel));
     }
-};
+
+    // picks the isolation level of every object using the cage from its largest on screen cage edge
+    void updateSubdivision()
+    {
+        if (subdivisionObjects.empty())
+            return;
+
+        if (adaptiveIsolation && cageEdgeLength == 0.0f)
+            cageEdgeLength = subdivisionCage.getAverageEdgeLength();
+        const float pixelsPerUnit = (float)screenHeight / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f));
+        int finest = 1;
+        for (unsigned int index : subdivisionObjects)
+        {
+            int level = isolationLevel;
+            if (adaptiveIsolation)
+            {
+                const Transform& transform = patches.objects[index].transform;
+                const glm::vec3 scale = transform.getScale();
+                const float distance = glm::max(glm::length(transform.getPosition() - camera.Position), 0.1f);
+                const float size = cageEdgeLength * glm::max(scale.x, glm::max(scale.y, scale.z));
+                // every level halves the faces left around the extraordinary vertices
+                level = (int)std::ceil(std::log2(glm::max(size * pixelsPerUnit / distance / isolationPixels, 1.0f)));
+                level = glm::clamp(level, 1, maxIsolationLevel);
+            }
+            patches.setObjectSurface(index, getSubdivisionSurface(level));
+            finest = glm::max(finest, level);
+        }
+        if (adaptiveIsolation)
+            isolationLevel = finest;
+        subdivisionStats = subdivisionLevelStats[finest];
+    }
+
+    unsigned int getSubdivisionSurface(int level)
+    {
+        auto found = subdivisionSurfaces.find(level);
+        if (found == subdivisionSurfaces.end())
+        {
+            const BezierSurface surface = subdivisionCage.buildPatches(level, &subdivisionLevelStats[level]);
+            found = subdivisionSurfaces.emplace(level, patches.addSurface(surface)).first;
+        }
+        return found->second;
+    }
+};
\ No newline at end of file
@@ -2,11 +2,15 @@
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "GLState.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
 
 // https://learnopengl.com/code_viewer_gh.php?code=includes/learnopengl/shader_m.h
 // https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/shader_t.h
@@ -15,8 +19,10 @@ class Shader
 public:
     unsigned int ID;
 
+    // header is added to every stage right after the #version line (variant defines, extensions),
+    // if the header starts with its own #version line it replaces the one from the file
     Shader(const char* vertexPath, const char* fragmentPath,
-        const char* tessControlPath = nullptr, const char* tessEvalPath = nullptr)
+        const char* tessControlPath = nullptr, const char* tessEvalPath = nullptr, const char* header = nullptr)
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -68,6 +74,13 @@ public:
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: "
                 << e.what() << std::endl;
         }
+        if (header != nullptr)
+        {
+            vertexCode = addHeader(vertexCode, header);
+            fragmentCode = addHeader(fragmentCode, header);
+            tessControlCode = addHeader(tessControlCode, header);
+            tessEvalCode = addHeader(tessEvalCode, header);
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -116,10 +129,18 @@ public:
         glDeleteShader(fragment);
     }
 
+    // ------------------------------------------------------------------------
+    // transform feedback outputs have to be known when linking, so this relinks the attached stages
+    void setFeedbackVaryings(const std::vector<const char*>& varyings)
+    {
+        glTransformFeedbackVaryings(ID, (GLsizei)varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+    }
     // ------------------------------------------------------------------------
     void use() const
     {
-        glUseProgram(ID);
+        GLState::instance().useProgram(ID);
     }
     // ------------------------------------------------------------------------
     void setBool(const std::string& name, bool value) const
@@ -132,6 +153,16 @@ public:
         glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
     }
     // ------------------------------------------------------------------------
+    void setUint(const std::string& name, unsigned int value) const
+    {
+        glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+    }
+    // the first count elements of a uniform array in one call, name without the brackets
+    void setUintArray(const std::string& name, const unsigned int* values, GLsizei count) const
+    {
+        glUniform1uiv(glGetUniformLocation(ID, name.c_str()), count, values);
+    }
+    // ------------------------------------------------------------------------
     void setFloat(const std::string& name, float value) const
     {
         glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
@@ -145,6 +176,10 @@ public:
     {
         glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
     }
+    void setVec2Array(const std::string& name, const glm::vec2* values, GLsizei count) const
+    {
+        glUniform2fv(glGetUniformLocation(ID, name.c_str()), count, &values[0][0]);
+    }
     // ------------------------------------------------------------------------
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
@@ -163,6 +198,10 @@ public:
     {
         glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
     }
+    void setVec4Array(const std::string& name, const glm::vec4* values, GLsizei count) const
+    {
+        glUniform4fv(glGetUniformLocation(ID, name.c_str()), count, &values[0][0]);
+    }
     // ------------------------------------------------------------------------
     void setMat2(const std::string& name, const glm::mat2& mat) const
     {
@@ -177,14 +216,54 @@ public:
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
         glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    }
+    // ------------------------------------------------------------------------
+    // model matrix with its normal matrix, computed here once per object instead of per vertex.
+    // Rotation with a uniform scale keeps normal directions, the shader then uses mat3(model) and
+    // the normal matrix is neither computed nor uploaded
+    void setModelMatrix(const glm::mat4& model) const
+    {
+        setMat4("model", model);
+        const bool uniform = hasUniformScale(glm::mat3(model));
+        setBool("uniformScale", uniform);
+        if (!uniform)
+            setMat3("normalMatrix", glm::inverseTranspose(glm::mat3(model)));
+    }
+
+    // columns orthogonal and of equal length
+    static bool hasUniformScale(const glm::mat3& m, float tolerance = 1e-4f)
+    {
+        const float xx = glm::dot(m[0], m[0]);
+        const float yy = glm::dot(m[1], m[1]);
+        const float zz = glm::dot(m[2], m[2]);
+        const float limit = tolerance * glm::max(xx, glm::max(yy, zz));
+        return glm::abs(xx - yy) <= limit && glm::abs(xx - zz) <= limit
+            && glm::abs(glm::dot(m[0], m[1])) <= limit
+            && glm::abs(glm::dot(m[0], m[2])) <= limit
+            && glm::abs(glm::dot(m[1], m[2])) <= limit;
     }
 	// ------------------------------------------------------------------------
 	~Shader()
 	{
-		glDeleteProgram(ID);
+		GLState::instance().deleteProgram(ID);
 	}
 
-private:
+protected:
+    // for programs built by derived classes (ComputeShader)
+    Shader() : ID(0) {}
+
+    static std::string addHeader(const std::string& code, const std::string& header)
+    {
+        if (code.empty())
+            return code;
+        size_t lineEnd = code.find('\n');
+        if (lineEnd == std::string::npos)
+            lineEnd = code.size();
+        if (header.compare(0, 8, "#version") == 0)
+            return header + "\n" + code.substr(lineEnd);
+        return code.substr(0, lineEnd) + "\n" + header + "\n" + code.substr(lineEnd);
+    }
+
     void checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+// translation, rotation and scale of a skeleton node relative to its parent
+struct NodePose
+{
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+
+    glm::mat4 toMat4() const
+    {
+        glm::mat4 matrix = glm::mat4_cast(rotation);
+        matrix[0] *= scale.x;
+        matrix[1] *= scale.y;
+        matrix[2] *= scale.z;
+        matrix[3] = glm::vec4(position, 1.0f);
+        return matrix;
+    }
+
+    // the node transforms of the files are translation * rotation * scale without shear
+    static NodePose fromMat4(const glm::mat4& matrix)
+    {
+        NodePose pose;
+        pose.position = glm::vec3(matrix[3]);
+        pose.scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+        glm::mat3 rotation;
+        for (int i = 0; i < 3; i++)
+            rotation[i] = pose.scale[i] > 0.0f ? glm::vec3(matrix[i]) / pose.scale[i] : glm::vec3(0.0f);
+        pose.rotation = glm::normalize(glm::quat_cast(rotation));
+        return pose;
+    }
+};
+
+// Node hierarchy of a rigged model, flattened so that every parent comes before its children
+struct Skeleton
+{
+    struct Node
+    {
+        std::string name;
+        int parent = -1;
+        int bone = -1;      // index into boneOffsets, -1 for nodes without vertices attached
+        NodePose bindPose;  // used while no clip animates the node
+    };
+
+    std::vector<Node> nodes;
+    // bone name -> index, the vertices store these indices
+    std::map<std::string, int> boneIndices;
+    // mesh space -> bone space in the bind pose
+    std::vector<glm::mat4> boneOffsets;
+    // inverse of the root node's transform, the skinned vertices stay in mesh space
+    glm::mat4 globalInverse = glm::mat4(1.0f);
+
+    size_t getBoneCount() const
+    {
+        return boneOffsets.size();
+    }
+
+    int findNode(const std::string& name) const
+    {
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].name == name)
+                return (int)i;
+        }
+        return -1;
+    }
+};
+
+// Keyframes of one node, times in seconds
+struct NodeChannel
+{
+    std::vector<float> positionTimes, rotationTimes, scaleTimes;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+};
+
+struct AnimationClip
+{
+    std::string name;
+    float duration = 0.0f; // seconds
+    // channel of every skeleton node, -1 keeps its bind pose
+    std::vector<int> nodeChannels;
+    std::vector<NodeChannel> channels;
+};
+
+// Keyframe sampling and pose blending, pure functions of their inputs so they can run on any worker
+namespace SkeletalAnimation
+{
+    // index of the last key at or before time, keys are sorted
+    inline size_t findKey(const std::vector<float>& times, float time)
+    {
+        const size_t upper = (size_t)(std::upper_bound(times.begin(), times.end(), time) - times.begin());
+        return upper == 0 ? 0 : upper - 1;
+    }
+
+    inline float keyFactor(const std::vector<float>& times, size_t key, float time)
+    {
+        if (key + 1 >= times.size())
+            return 0.0f;
+        const float span = times[key + 1] - times[key];
+        return span > 0.0f ? glm::clamp((time - times[key]) / span, 0.0f, 1.0f) : 0.0f;
+    }
+
+    // local pose of every node at a time of the clip, which loops
+    inline void samplePose(const Skeleton& skeleton, const AnimationClip& clip, float time, NodePose* pose)
+    {
+        if (clip.duration > 0.0f)
+        {
+            time = std::fmod(time, clip.duration);
+            if (time < 0.0f)
+                time += clip.duration;
+        }
+        for (size_t i = 0; i < skeleton.nodes.size(); i++)
+        {
+            const int channelIndex = i < clip.nodeChannels.size() ? clip.nodeChannels[i] : -1;
+            pose[i] = skeleton.nodes[i].bindPose;
+            if (channelIndex < 0)
+                continue;
+
+            const NodeChannel& channel = clip.channels[channelIndex];
+            if (!channel.positions.empty())
+            {
+                const size_t key = findKey(channel.positionTimes, time);
+                const size_t next = glm::min(key + 1, channel.positions.size() - 1);
+                pose[i].position = glm::mix(channel.positions[key], channel.positions[next], keyFactor(channel.positionTimes, key, time));
+            }
+            if (!channel.rotations.empty())
+            {
+                const size_t key = findKey(channel.rotationTimes, time);
+                const size_t next = glm::min(key + 1, channel.rotations.size() - 1);
+                pose[i].rotation = glm::normalize(glm::slerp(channel.rotations[key], channel.rotations[next], keyFactor(channel.rotationTimes, key, time)));
+            }
+            if (!channel.scales.empty())
+            {
+                const size_t key = findKey(channel.scaleTimes, time);
+                const size_t next = glm::min(key + 1, channel.scales.size() - 1);
+                pose[i].scale = glm::mix(channel.scales[key], channel.scales[next], keyFactor(channel.scaleTimes, key, time));
+            }
+        }
+    }
+
+    // target = mix(target, other, weight) per node
+    inline void blendPoses(NodePose* target, const NodePose* other, float weight, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            target[i].position = glm::mix(target[i].position, other[i].position, weight);
+            target[i].rotation = glm::normalize(glm::slerp(target[i].rotation, other[i].rotation, weight));
+            target[i].scale = glm::mix(target[i].scale, other[i].scale, weight);
+        }
+    }
+
+    // skinning matrices of all bones, globals is scratch space for one matrix per node
+    inline void computePalette(const Skeleton& skeleton, const NodePose* pose, glm::mat4* globals, glm::mat4* palette)
+    {
+        for (size_t i = 0; i < skeleton.nodes.size(); i++)
+        {
+            const Skeleton::Node& node = skeleton.nodes[i];
+            const glm::mat4 local = pose[i].toMat4();
+            globals[i] = node.parent < 0 ? local : globals[node.parent] * local;
+            if (node.bone >= 0)
+                palette[node.bone] = skeleton.globalInverse * globals[i] * skeleton.boneOffsets[node.bone];
+        }
+    }
+}
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "ComputeShader.h"
+#include "EntityWorld.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Shader.h"
+#include "Skeleton.h"
+
+#include <chrono>
+#include <vector>
+
+#define SKIN_SOURCE_BINDING 7
+#define SKIN_PALETTE_BINDING 8
+#define SKIN_OUTPUT_BINDING 9
+
+static_assert(sizeof(Vertex) == 22 * sizeof(float), "skinning.cs reads a Vertex as 22 floats");
+
+// Skeletal animation of entities with rigged models. Every frame the clips of all instances are sampled,
+// crossfaded and turned into skinning matrices on the JobSystem workers. After culling, skinning.cs writes
+// the skinned vertices of every visible instance into the instance's own vertex buffer, once per frame,
+// and every pass drawing the entity (per pixel or per vertex lit) reuses them through Model::Draw.
+// Without compute shaders the workers skin into the same buffers, like the cloth's CPU solver.
+class SkinningSystem
+{
+public:
+    struct Instance
+    {
+        Model* model = nullptr;
+        Entity entity = INVALID_ENTITY;
+        int clip = 0;
+        float time = 0.0f;
+        float speed = 1.0f;
+        // crossfade from the previous clip, blend runs from 0 to 1 over blendDuration seconds
+        int previousClip = -1;
+        float previousTime = 0.0f;
+        float blend = 1.0f;
+        float blendDuration = 0.0f;
+        // first skinning matrix in palettes
+        size_t paletteOffset = 0;
+        GLuint vertexBuffer = 0, VAO = 0;
+    };
+
+    std::vector<Instance> instances;
+    bool useGpu = true;
+    float playbackSpeed = 1.0f;
+    // instances sampled per worker chunk, vertices per chunk of the CPU skinning
+    size_t chunkSize = 16;
+    size_t vertexChunkSize = 4096;
+
+    float lastSampleMs = 0.0f;
+    // CPU skinning including the upload, or GPU time of the compute passes from a previous frame
+    float lastSkinMs = 0.0f;
+    float lastGpuMs = 0.0f;
+    size_t lastSkinned = 0;
+
+    static bool supportsGpu()
+    {
+        const GLCaps& caps = GLCaps::instance();
+        return caps.computeShader && caps.shaderStorage;
+    }
+
+    static void setupShader(const Shader& shader)
+    {
+        if (!supportsGpu())
+            return;
+        GLuint source = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "SkinSource");
+        if (source != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(shader.ID, source, SKIN_SOURCE_BINDING);
+        GLuint palette = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "SkinPalette");
+        if (palette != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(shader.ID, palette, SKIN_PALETTE_BINDING);
+        GLuint output = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, "SkinOutput");
+        if (output != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(shader.ID, output, SKIN_OUTPUT_BINDING);
+    }
+
+    // The entity is drawn from its skinned vertices from now on, so this has to happen before the HLOD build.
+    // Returns the instance, or ~0 when the entity's model has no skeleton.
+    size_t add(EntityWorld& world, Entity entity, int clip = 0)
+    {
+        Model* model = world.render.model[entity];
+        if (!model || !model->hasSkeleton())
+            return ~(size_t)0;
+
+        Instance instance;
+        instance.model = model;
+        instance.entity = entity;
+        instance.clip = clip;
+        instance.paletteOffset = palettes.size();
+        palettes.resize(palettes.size() + model->skeleton.getBoneCount(), glm::mat4(1.0f));
+        world.render.skinned[entity] = 1;
+        world.render.instanced[entity] = 0;
+        // the poses can reach past the bind pose's sphere, like the baked crowds in VertexAnimationBaker
+        world.bounds.local[entity].w *= 1.5f;
+
+        if (entity >= instanceOf.size())
+            instanceOf.resize((size_t)entity + 1, ~(size_t)0);
+        instanceOf[entity] = instances.size();
+        instances.push_back(instance);
+        return instances.size() - 1;
+    }
+
+    // crossfades the instance to another clip of its model
+    void play(size_t index, int clip, float blendDuration)
+    {
+        Instance& instance = instances[index];
+        if (clip == instance.clip || clip < 0 || clip >= (int)instance.model->animations.size())
+            return;
+        instance.previousClip = instance.clip;
+        instance.previousTime = instance.time;
+        instance.clip = clip;
+        instance.time = 0.0f;
+        instance.blend = blendDuration > 0.0f ? 0.0f : 1.0f;
+        instance.blendDuration = blendDuration;
+    }
+
+    // Samples and blends the clips of all instances into their skinning matrices on the workers
+    void update(float deltaTime)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        JobSystem::instance().parallelFor(instances.size(), chunkSize, [&](size_t begin, size_t end)
+            {
+                // scratch poses of the chunk
+                std::vector<NodePose> pose, previous;
+                std::vector<glm::mat4> globals;
+                for (size_t i = begin; i < end; i++)
+                    animate(instances[i], deltaTime * playbackSpeed, pose, previous, globals);
+            });
+        lastSampleMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Skins the visible instances, once per frame after culling and before the first pass.
+    // skinningShader is the skinning.cs program, null without compute shaders
+    void skin(ComputeShader* skinningShader, const EntityWorld& world)
+    {
+        visibleInstances.clear();
+        for (size_t i = 0; i < instances.size(); i++)
+        {
+            if (!world.isVisible(instances[i].entity))
+                continue;
+            if (instances[i].VAO == 0)
+                createBuffers(instances[i]);
+            visibleInstances.push_back(i);
+        }
+        lastSkinned = visibleInstances.size();
+        if (visibleInstances.empty())
+            return;
+
+        if (useGpu && skinningShader && supportsGpu())
+            skinGpu(*skinningShader);
+        else
+            skinCpu();
+    }
+
+    // skinned vertices of the entity for Model::Draw, 0 when it is not skinned
+    GLuint getVertexArray(Entity entity) const
+    {
+        if (entity >= instanceOf.size() || instanceOf[entity] == ~(size_t)0)
+            return 0;
+        return instances[instanceOf[entity]].VAO;
+    }
+
+    // mirrors skinning.cs, also used to bake vertex animations
+    static Vertex skinVertex(const Vertex& source, const glm::mat4* palette, int boneCount)
+    {
+        glm::mat4 skin(0.0f);
+        float total = 0.0f;
+        for (int k = 0; k < MAX_BONE_INFLUENCE; k++)
+        {
+            const int bone = source.m_BoneIDs[k];
+            if (bone < 0 || bone >= boneCount)
+                continue;
+            skin = skin + palette[bone] * source.m_Weights[k];
+            total += source.m_Weights[k];
+        }
+        if (total <= 0.0f)
+            return source;
+        skin = skin * (1.0f / total);
+        const glm::mat3 linear(skin);
+
+        Vertex vertex = source;
+        vertex.Position = glm::vec3(skin * glm::vec4(source.Position, 1.0f));
+        vertex.Normal = glm::normalize(linear * source.Normal);
+        vertex.Tangent = linear * source.Tangent;
+        vertex.Bitangent = linear * source.Bitangent;
+        return vertex;
+    }
+
+private:
+    // skinning matrices of all instances, each owns getBoneCount() of them from its paletteOffset
+    std::vector<glm::mat4> palettes;
+    // entity -> instance, ~0 for entities without one
+    std::vector<size_t> instanceOf;
+    std::vector<size_t> visibleInstances;
+    GLuint paletteBuffer = 0;
+    GLuint timerQuery = 0;
+    bool timerPending = false;
+    // CPU skinning output of one instance
+    std::vector<Vertex> skinned;
+
+    void animate(Instance& instance, float deltaTime, std::vector<NodePose>& pose, std::vector<NodePose>& previous,
+        std::vector<glm::mat4>& globals)
+    {
+        const Model& model = *instance.model;
+        const Skeleton& skeleton = model.skeleton;
+        const size_t nodeCount = skeleton.nodes.size();
+        pose.resize(nodeCount);
+        globals.resize(nodeCount);
+
+        instance.time += deltaTime * instance.speed;
+        samplePose(model, instance.clip, instance.time, pose);
+        if (instance.blend < 1.0f && instance.previousClip >= 0)
+        {
+            instance.previousTime += deltaTime * instance.speed;
+            instance.blend = instance.blendDuration > 0.0f ? glm::min(instance.blend + deltaTime / instance.blendDuration, 1.0f) : 1.0f;
+            previous.resize(nodeCount);
+            samplePose(model, instance.previousClip, instance.previousTime, previous);
+            SkeletalAnimation::blendPoses(previous.data(), pose.data(), instance.blend, nodeCount);
+            pose.swap(previous);
+        }
+        SkeletalAnimation::computePalette(skeleton, pose.data(), globals.data(), &palettes[instance.paletteOffset]);
+    }
+
+    // bind pose for models without clips
+    static void samplePose(const Model& model, int clip, float time, std::vector<NodePose>& pose)
+    {
+        if (clip >= 0 && clip < (int)model.animations.size())
+        {
+            SkeletalAnimation::samplePose(model.skeleton, model.animations[clip], time, pose.data());
+            return;
+        }
+        for (size_t i = 0; i < model.skeleton.nodes.size(); i++)
+            pose[i] = model.skeleton.nodes[i].bindPose;
+    }
+
+    // output buffer starting in the bind pose and a vertex array drawing the model from it
+    void createBuffers(Instance& instance)
+    {
+        Model& model = *instance.model;
+        model.getVertexBuffer();
+        const std::vector<Vertex>& bindPose = model.getBindPoseVertices();
+
+        glGenBuffers(1, &instance.vertexBuffer);
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, instance.vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, bindPose.size() * sizeof(Vertex), bindPose.data(), GL_DYNAMIC_COPY);
+        instance.VAO = model.createVertexArray(instance.vertexBuffer);
+    }
+
+    void skinGpu(ComputeShader& skinningShader)
+    {
+        // the result of the previous frame's query, never waits
+        if (timerQuery == 0)
+            glGenQueries(1, &timerQuery);
+        if (timerPending)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(timerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &nanoseconds);
+                lastGpuMs = (float)((double)nanoseconds / 1e6);
+                timerPending = false;
+            }
+        }
+        const bool timed = !timerPending;
+        if (timed)
+            glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+
+        // all palettes in one upload, orphaned as last frame's dispatches may still read them
+        GLState& state = GLState::instance();
+        if (paletteBuffer == 0)
+            glGenBuffers(1, &paletteBuffer);
+        state.bindBuffer(GL_SHADER_STORAGE_BUFFER, paletteBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, palettes.size() * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, palettes.size() * sizeof(glm::mat4), palettes.data());
+
+        skinningShader.use();
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, SKIN_PALETTE_BINDING, paletteBuffer);
+        for (size_t index : visibleInstances)
+        {
+            const Instance& instance = instances[index];
+            const GLsizei vertexCount = instance.model->getVertexCount();
+            skinningShader.setInt("vertexCount", vertexCount);
+            skinningShader.setInt("paletteOffset", (int)instance.paletteOffset);
+            skinningShader.setInt("boneCount", (int)instance.model->skeleton.getBoneCount());
+            state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, SKIN_SOURCE_BINDING, instance.model->getVertexBuffer());
+            state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, SKIN_OUTPUT_BINDING, instance.vertexBuffer);
+            skinningShader.dispatch((GLuint)(vertexCount + 63) / 64);
+        }
+        // the draws of all passes read the outputs as vertices
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+        if (timed)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            timerPending = true;
+        }
+    }
+
+    void skinCpu()
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        GLState& state = GLState::instance();
+        for (size_t index : visibleInstances)
+        {
+            const Instance& instance = instances[index];
+            const std::vector<Vertex>& bindPose = instance.model->getBindPoseVertices();
+            const glm::mat4* palette = &palettes[instance.paletteOffset];
+            const int boneCount = (int)instance.model->skeleton.getBoneCount();
+            skinned.resize(bindPose.size());
+            JobSystem::instance().parallelFor(bindPose.size(), vertexChunkSize, [&](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i < end; i++)
+                        skinned[i] = skinVertex(bindPose[i], palette, boneCount);
+                });
+            state.bindBuffer(GL_ARRAY_BUFFER, instance.vertexBuffer);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, skinned.size() * sizeof(Vertex), skinned.data());
+        }
+        lastSkinMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+};
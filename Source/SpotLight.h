@@ -3,6 +3,7 @@
 #include <glm/vec3.hpp>
 
 #include "Shader.h"
+#include "Transform.h"
 
 class SpotLight
 {
@@ -20,6 +21,10 @@ public:
 	glm::vec3 diffuse;
 	glm::vec3 specular;
 
+	// Attachment to a parent transform (e.g. train headlight), position and direction follow it
+	Transform node;
+	glm::vec3 localDirection = glm::vec3(0.0f, 0.0f, -1.0f);
+
 	SpotLight(const glm::vec3& position, const glm::vec3& direction, float cut_off, float outer_cut_off, float constant,
 		float linear, float quadratic, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular)
 		: position(position),
@@ -33,6 +38,22 @@ public:
 		  diffuse(diffuse),
 		  specular(specular) {}
 
+	void attachTo(Transform* parent, const glm::vec3& localOffset, const glm::vec3& direction)
+	{
+		node.setPosition(localOffset);
+		node.setParent(parent);
+		localDirection = direction;
+	}
+
+	// Reads the parent's cached world matrix, nothing is recomputed while the parent stays still
+	void updateFromNode()
+	{
+		if (!node.getParent())
+			return;
+		position = node.getWorldPosition();
+		direction = glm::normalize(node.transformDirection(localDirection));
+	}
+
 	// TODO: In future, allow for multiple spotlights
 	void SetUniforms(const Shader& shader) const
 	{
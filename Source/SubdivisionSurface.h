@@ -0,0 +1,606 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "PatchRenderer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Catmull-Clark subdivision surface of a polygon cage, turned into bicubic patches for PatchRenderer.
+// Feature adaptive: a quad whose 1-ring is a regular grid (valence 4 everywhere, no boundary) is exactly a
+// uniform bicubic B-spline patch, so it becomes one Bezier patch without any refinement. Only the faces
+// touching extraordinary vertices, boundaries or non-quads are subdivided on the CPU, level by level,
+// and at every level their children with a regular 1-ring become patches as well. The irregular region
+// shrinks by half per level, so the cost grows with the number of extraordinary vertices and the level,
+// not with the final triangle count. Faces still irregular at the last level become end caps: bicubic
+// patches whose boundaries are the limit curves of their edges, built from the limit positions and
+// limit tangents of the corners. For an edge between regular vertices that curve is the B-spline patch
+// edge, and every patch of a level takes the boundary curves from one cache per edge, so the patches on
+// either side of an edge share the same control points and the surface has no cracks at the end caps.
+class SubdivisionSurface
+{
+public:
+    struct Stats
+    {
+        size_t regularPatches = 0;
+        size_t endCapPatches = 0;
+    };
+
+    std::vector<glm::vec3> points;
+    std::vector<std::vector<int>> faces;
+
+    size_t getVertexCount() const { return points.size(); }
+    size_t getFaceCount() const { return faces.size(); }
+
+    // positions (v) and polygons (f, only the position index of every corner is used)
+    bool loadObj(const std::string& path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cout << "ERROR::SUBDIVISION_SURFACE::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream stream(line);
+            std::string type;
+            stream >> type;
+            if (type == "v")
+            {
+                glm::vec3 point;
+                stream >> point.x >> point.y >> point.z;
+                points.push_back(point);
+            }
+            else if (type == "f")
+            {
+                std::vector<int> face;
+                std::string corner;
+                while (stream >> corner)
+                {
+                    int index = std::stoi(corner.substr(0, corner.find('/')));
+                    face.push_back(index < 0 ? (int)points.size() + index : index - 1);
+                }
+                if (face.size() >= 3)
+                    faces.push_back(face);
+            }
+        }
+        if (faces.empty())
+        {
+            std::cout << "ERROR::SUBDIVISION_SURFACE::NO_FACES: " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    float getAverageEdgeLength() const
+    {
+        float length = 0.0f;
+        size_t count = 0;
+        for (const std::vector<int>& face : faces)
+        {
+            for (size_t i = 0; i < face.size(); i++)
+            {
+                length += glm::length(points[face[(i + 1) % face.size()]] - points[face[i]]);
+                count++;
+            }
+        }
+        return count > 0 ? length / (float)count : 0.0f;
+    }
+
+    // patches of the surface with the irregular faces refined isolationLevel times (at least once)
+    BezierSurface buildPatches(int isolationLevel, Stats* stats = nullptr) const
+    {
+        isolationLevel = std::max(isolationLevel, 1);
+        BezierSurface surface;
+        Stats counts;
+
+        Mesh mesh;
+        mesh.points = points;
+        mesh.faces = faces;
+        std::vector<int> pending(faces.size());
+        for (size_t i = 0; i < pending.size(); i++)
+            pending[i] = (int)i;
+
+        for (int level = 0; !pending.empty(); level++)
+        {
+            Topology topology(mesh);
+            EdgeCurves curves(mesh, topology);
+            std::vector<int> irregular;
+            glm::vec3 grid[4][4];
+            for (int face : pending)
+            {
+                if (extractGrid(mesh, topology, face, grid))
+                {
+                    addBSplinePatch(surface, grid, mesh.faces[face], curves);
+                    counts.regularPatches++;
+                }
+                else
+                    irregular.push_back(face);
+            }
+            if (irregular.empty())
+                break;
+
+            if (level == isolationLevel)
+            {
+                for (int face : irregular)
+                    addEndCap(surface, mesh.faces[face], curves);
+                counts.endCapPatches += irregular.size();
+                break;
+            }
+
+            // children of the irregular faces need their 1-ring at the next level, which are the children
+            // of the faces around them, and those need the 1-ring of their own vertices here
+            std::set<int> region(irregular.begin(), irregular.end());
+            for (int face : irregular)
+            {
+                for (int vertex : mesh.faces[face])
+                    region.insert(topology.vertexFaces[vertex].begin(), topology.vertexFaces[vertex].end());
+            }
+            mesh = subdivide(mesh, topology, region, irregular, pending);
+        }
+
+        if (stats)
+            *stats = counts;
+        return surface;
+    }
+
+private:
+    struct Mesh
+    {
+        std::vector<glm::vec3> points;
+        std::vector<std::vector<int>> faces;
+    };
+
+    typedef std::pair<int, int> EdgeKey;
+
+    static EdgeKey edgeKey(int a, int b)
+    {
+        return a < b ? EdgeKey(a, b) : EdgeKey(b, a);
+    }
+
+    struct Topology
+    {
+        std::map<EdgeKey, std::vector<int>> edgeFaces;
+        std::vector<std::vector<int>> vertexFaces;
+        std::vector<std::vector<int>> vertexNeighbours;
+
+        explicit Topology(const Mesh& mesh)
+        {
+            vertexFaces.resize(mesh.points.size());
+            vertexNeighbours.resize(mesh.points.size());
+            for (int f = 0; f < (int)mesh.faces.size(); f++)
+            {
+                const std::vector<int>& face = mesh.faces[f];
+                for (size_t i = 0; i < face.size(); i++)
+                {
+                    const int a = face[i], b = face[(i + 1) % face.size()];
+                    vertexFaces[a].push_back(f);
+                    std::vector<int>& faceList = edgeFaces[edgeKey(a, b)];
+                    faceList.push_back(f);
+                    // every edge is seen once per face, the first time adds the neighbours
+                    if (faceList.size() == 1)
+                    {
+                        vertexNeighbours[a].push_back(b);
+                        vertexNeighbours[b].push_back(a);
+                    }
+                }
+            }
+        }
+
+        bool isBoundaryEdge(int a, int b) const
+        {
+            auto found = edgeFaces.find(edgeKey(a, b));
+            return found == edgeFaces.end() || found->second.size() != 2;
+        }
+
+        bool isBoundaryVertex(int vertex) const
+        {
+            for (int neighbour : vertexNeighbours[vertex])
+            {
+                if (isBoundaryEdge(vertex, neighbour))
+                    return true;
+            }
+            return false;
+        }
+    };
+
+    // Bezier control points of the limit curve of every edge of a level, computed once so that the patches
+    // on both sides of an edge get exactly the same points
+    class EdgeCurves
+    {
+    public:
+        EdgeCurves(const Mesh& mesh, const Topology& topology) : mesh(mesh), topology(topology) {}
+
+        // from a to b
+        void get(int a, int b, glm::vec3 curve[4])
+        {
+            const EdgeKey key = edgeKey(a, b);
+            auto found = curves.find(key);
+            if (found == curves.end())
+            {
+                const glm::vec3 first = getLimit(key.first), last = getLimit(key.second);
+                const std::array<glm::vec3, 4> points = { first, tangentPoint(mesh, topology, key.first, key.second, first),
+                    tangentPoint(mesh, topology, key.second, key.first, last), last };
+                found = curves.emplace(key, points).first;
+            }
+            for (int i = 0; i < 4; i++)
+                curve[i] = found->second[a == key.first ? i : 3 - i];
+        }
+
+    private:
+        const Mesh& mesh;
+        const Topology& topology;
+        std::map<EdgeKey, std::array<glm::vec3, 4>> curves;
+        std::map<int, glm::vec3> limits;
+
+        const glm::vec3& getLimit(int vertex)
+        {
+            auto found = limits.find(vertex);
+            if (found == limits.end())
+                found = limits.emplace(vertex, limitPosition(mesh, topology, vertex)).first;
+            return found->second;
+        }
+    };
+
+    static glm::vec3 centroid(const Mesh& mesh, int face)
+    {
+        glm::vec3 sum(0.0f);
+        for (int vertex : mesh.faces[face])
+            sum += mesh.points[vertex];
+        return sum / (float)mesh.faces[face].size();
+    }
+
+    // the other quad across edge a -> b of face, which walks it as b -> a: (b, a, c, d)
+    static bool across(const Mesh& mesh, const Topology& topology, int face, int a, int b, int& c, int& d)
+    {
+        auto found = topology.edgeFaces.find(edgeKey(a, b));
+        if (found == topology.edgeFaces.end() || found->second.size() != 2)
+            return false;
+        const int other = found->second[0] == face ? found->second[1] : found->second[0];
+        const std::vector<int>& quad = mesh.faces[other];
+        if (quad.size() != 4)
+            return false;
+        const int position = (int)(std::find(quad.begin(), quad.end(), b) - quad.begin());
+        if (quad[(position + 1) % 4] != a)
+            return false;
+        c = quad[(position + 2) % 4];
+        d = quad[(position + 3) % 4];
+        return true;
+    }
+
+    // fourth corner of the quad around vertex that contains both of its neighbours first and second
+    static bool opposite(const Mesh& mesh, const Topology& topology, int vertex, int first, int second, int& corner)
+    {
+        for (int face : topology.vertexFaces[vertex])
+        {
+            const std::vector<int>& quad = mesh.faces[face];
+            if (quad.size() != 4 || std::find(quad.begin(), quad.end(), first) == quad.end()
+                || std::find(quad.begin(), quad.end(), second) == quad.end())
+                continue;
+            for (int candidate : quad)
+            {
+                if (candidate != vertex && candidate != first && candidate != second)
+                {
+                    corner = candidate;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    static bool isRegularVertex(const Mesh& mesh, const Topology& topology, int vertex)
+    {
+        if (topology.vertexFaces[vertex].size() != 4 || topology.vertexNeighbours[vertex].size() != 4)
+            return false;
+        for (int face : topology.vertexFaces[vertex])
+        {
+            if (mesh.faces[face].size() != 4)
+                return false;
+        }
+        return !topology.isBoundaryVertex(vertex);
+    }
+
+    // 4x4 B-spline control points of a regular quad, grid[a][b] with the face at [1..2][1..2],
+    // a runs along the first edge so that cross(du, dv) points out of a counter clockwise face
+    static bool extractGrid(const Mesh& mesh, const Topology& topology, int face, glm::vec3 grid[4][4])
+    {
+        const std::vector<int>& quad = mesh.faces[face];
+        if (quad.size() != 4)
+            return false;
+        for (int vertex : quad)
+        {
+            if (!isRegularVertex(mesh, topology, vertex))
+                return false;
+        }
+
+        int index[4][4];
+        index[1][1] = quad[0];
+        index[2][1] = quad[1];
+        index[2][2] = quad[2];
+        index[1][2] = quad[3];
+        if (!across(mesh, topology, face, quad[0], quad[1], index[1][0], index[2][0])
+            || !across(mesh, topology, face, quad[1], quad[2], index[3][1], index[3][2])
+            || !across(mesh, topology, face, quad[2], quad[3], index[2][3], index[1][3])
+            || !across(mesh, topology, face, quad[3], quad[0], index[0][2], index[0][1])
+            || !opposite(mesh, topology, index[1][1], index[1][0], index[0][1], index[0][0])
+            || !opposite(mesh, topology, index[2][1], index[2][0], index[3][1], index[3][0])
+            || !opposite(mesh, topology, index[2][2], index[3][2], index[2][3], index[3][3])
+            || !opposite(mesh, topology, index[1][2], index[1][3], index[0][2], index[0][3]))
+            return false;
+
+        for (int a = 0; a < 4; a++)
+        {
+            for (int b = 0; b < 4; b++)
+                grid[a][b] = mesh.points[index[a][b]];
+        }
+        return true;
+    }
+
+    // uniform cubic B-spline to Bezier control points, in both directions. The boundary rows are the same
+    // curves up to rounding, they are replaced by the shared ones of the edges
+    static void addBSplinePatch(BezierSurface& surface, const glm::vec3 grid[4][4], const std::vector<int>& quad, EdgeCurves& curves)
+    {
+        auto convert = [](const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, glm::vec3* out)
+            {
+                out[0] = (p0 + 4.0f * p1 + p2) / 6.0f;
+                out[1] = (4.0f * p1 + 2.0f * p2) / 6.0f;
+                out[2] = (2.0f * p1 + 4.0f * p2) / 6.0f;
+                out[3] = (p1 + 4.0f * p2 + p3) / 6.0f;
+            };
+
+        glm::vec3 rows[4][4], column[4], bezier[4][4];
+        for (int b = 0; b < 4; b++)
+        {
+            convert(grid[0][b], grid[1][b], grid[2][b], grid[3][b], column);
+            for (int a = 0; a < 4; a++)
+                rows[a][b] = column[a];
+        }
+        for (int a = 0; a < 4; a++)
+            convert(rows[a][0], rows[a][1], rows[a][2], rows[a][3], bezier[a]);
+        setBoundary(bezier, quad, curves);
+        addPatch(surface, bezier);
+    }
+
+    // limit position of a vertex, the meshes past the first level only have quads
+    static glm::vec3 limitPosition(const Mesh& mesh, const Topology& topology, int vertex)
+    {
+        const glm::vec3& point = mesh.points[vertex];
+        if (topology.isBoundaryVertex(vertex))
+        {
+            std::vector<int> ends;
+            for (int neighbour : topology.vertexNeighbours[vertex])
+            {
+                if (topology.isBoundaryEdge(vertex, neighbour))
+                    ends.push_back(neighbour);
+            }
+            if (ends.size() != 2)
+                return point;
+            return (mesh.points[ends[0]] + 4.0f * point + mesh.points[ends[1]]) / 6.0f;
+        }
+
+        const float valence = (float)topology.vertexNeighbours[vertex].size();
+        glm::vec3 edges(0.0f), diagonals(0.0f);
+        for (int neighbour : topology.vertexNeighbours[vertex])
+            edges += mesh.points[neighbour];
+        for (int face : topology.vertexFaces[vertex])
+        {
+            const std::vector<int>& quad = mesh.faces[face];
+            const int position = (int)(std::find(quad.begin(), quad.end(), vertex) - quad.begin());
+            diagonals += mesh.points[quad[(position + 2) % 4]];
+        }
+        return (valence * valence * point + 4.0f * edges + diagonals) / (valence * (valence + 5.0f));
+    }
+
+    // edge neighbours and the opposite corners of the quads around an interior vertex, in order from first.
+    // diagonals[k] lies between edges[k] and edges[k + 1]
+    static bool getRing(const Mesh& mesh, const Topology& topology, int vertex, int first, std::vector<int>& edges, std::vector<int>& diagonals)
+    {
+        edges.clear();
+        diagonals.clear();
+        int current = first;
+        for (size_t k = 0; k < topology.vertexNeighbours[vertex].size(); k++)
+        {
+            bool found = false;
+            for (int face : topology.vertexFaces[vertex])
+            {
+                const std::vector<int>& quad = mesh.faces[face];
+                if (quad.size() != 4)
+                    return false;
+                const int position = (int)(std::find(quad.begin(), quad.end(), vertex) - quad.begin());
+                if (quad[(position + 1) % 4] != current)
+                    continue;
+                edges.push_back(current);
+                diagonals.push_back(quad[(position + 2) % 4]);
+                current = quad[(position + 3) % 4];
+                found = true;
+                break;
+            }
+            if (!found)
+                return false;
+        }
+        return current == first;
+    }
+
+    // second control point of the limit curve of edge a -> b, along the limit tangent at a. The tangent mask
+    // is the Catmull-Clark one for valence n, scaled so that at valence 4 it gives the B-spline patch edge
+    static glm::vec3 tangentPoint(const Mesh& mesh, const Topology& topology, int a, int b, const glm::vec3& limit)
+    {
+        const glm::vec3& point = mesh.points[a];
+        if (topology.isBoundaryVertex(a))
+        {
+            // boundary curves are cubic B-splines of the boundary vertices
+            if (topology.isBoundaryEdge(a, b))
+                return (2.0f * point + mesh.points[b]) / 3.0f;
+            return limit + (mesh.points[b] - point) / 3.0f;
+        }
+
+        std::vector<int> edges, diagonals;
+        if (!getRing(mesh, topology, a, b, edges, diagonals))
+            return limit + (mesh.points[b] - point) / 3.0f;
+        const float n = (float)edges.size();
+        const float pi = 3.14159265358979f;
+        const float c = std::cos(2.0f * pi / n);
+        const float edgeWeight = 1.0f + c + std::cos(pi / n) * std::sqrt(2.0f * (9.0f + c));
+        glm::vec3 tangent(0.0f);
+        for (size_t k = 0; k < edges.size(); k++)
+        {
+            const float angle = 2.0f * pi / n;
+            const float current = std::cos(angle * (float)k), next = std::cos(angle * (float)(k + 1));
+            tangent += edgeWeight * current * mesh.points[edges[k]] + (current + next) * mesh.points[diagonals[k]];
+        }
+        return limit + tangent * (4.0f / (9.0f * n * edgeWeight));
+    }
+
+    // boundary rows of a patch over a quad, in the orientation of extractGrid
+    static void setBoundary(glm::vec3 bezier[4][4], const std::vector<int>& quad, EdgeCurves& curves)
+    {
+        glm::vec3 curve[4];
+        curves.get(quad[0], quad[1], curve);
+        for (int i = 0; i < 4; i++)
+            bezier[i][0] = curve[i];
+        curves.get(quad[1], quad[2], curve);
+        for (int i = 0; i < 4; i++)
+            bezier[3][i] = curve[i];
+        curves.get(quad[3], quad[2], curve);
+        for (int i = 0; i < 4; i++)
+            bezier[i][3] = curve[i];
+        curves.get(quad[0], quad[3], curve);
+        for (int i = 0; i < 4; i++)
+            bezier[0][i] = curve[i];
+    }
+
+    // patch of a face still irregular at the last level: the edge curves as boundary, the inner points
+    // blended from them as in a Coons patch
+    static void addEndCap(BezierSurface& surface, const std::vector<int>& quad, EdgeCurves& curves)
+    {
+        glm::vec3 bezier[4][4];
+        setBoundary(bezier, quad, curves);
+        for (int a = 1; a < 3; a++)
+        {
+            for (int b = 1; b < 3; b++)
+            {
+                const float u = a / 3.0f, v = b / 3.0f;
+                const glm::vec3 ruled = (1.0f - v) * bezier[a][0] + v * bezier[a][3] + (1.0f - u) * bezier[0][b] + u * bezier[3][b];
+                const glm::vec3 corners = glm::mix(glm::mix(bezier[0][0], bezier[3][0], u), glm::mix(bezier[0][3], bezier[3][3], u), v);
+                bezier[a][b] = ruled - corners;
+            }
+        }
+        addPatch(surface, bezier);
+    }
+
+    static void addPatch(BezierSurface& surface, const glm::vec3 bezier[4][4])
+    {
+        for (int a = 0; a < 4; a++)
+        {
+            for (int b = 0; b < 4; b++)
+            {
+                surface.indices.push_back((GLuint)surface.controlPoints.size());
+                surface.controlPoints.push_back(bezier[a][b]);
+            }
+        }
+    }
+
+    // one Catmull-Clark step over the region, children keeps the children of the irregular faces
+    static Mesh subdivide(const Mesh& mesh, const Topology& topology, const std::set<int>& region,
+        const std::vector<int>& irregular, std::vector<int>& children)
+    {
+        Mesh refined;
+        std::map<int, int> facePoints, vertexPoints;
+        std::map<EdgeKey, int> edgePoints;
+
+        auto facePoint = [&](int face)
+            {
+                auto found = facePoints.find(face);
+                if (found != facePoints.end())
+                    return found->second;
+                refined.points.push_back(centroid(mesh, face));
+                return facePoints[face] = (int)refined.points.size() - 1;
+            };
+
+        auto edgePoint = [&](int a, int b)
+            {
+                const EdgeKey key = edgeKey(a, b);
+                auto found = edgePoints.find(key);
+                if (found != edgePoints.end())
+                    return found->second;
+                glm::vec3 point = mesh.points[a] + mesh.points[b];
+                const std::vector<int>& adjacent = topology.edgeFaces.at(key);
+                if (adjacent.size() == 2)
+                    point = (point + centroid(mesh, adjacent[0]) + centroid(mesh, adjacent[1])) / 4.0f;
+                else
+                    point /= 2.0f;
+                refined.points.push_back(point);
+                return edgePoints[key] = (int)refined.points.size() - 1;
+            };
+
+        auto vertexPoint = [&](int vertex)
+            {
+                auto found = vertexPoints.find(vertex);
+                if (found != vertexPoints.end())
+                    return found->second;
+                const glm::vec3& point = mesh.points[vertex];
+                glm::vec3 result = point;
+                if (topology.isBoundaryVertex(vertex))
+                {
+                    // boundary curves are cubic B-splines, corners stay where they are
+                    std::vector<int> ends;
+                    for (int neighbour : topology.vertexNeighbours[vertex])
+                    {
+                        if (topology.isBoundaryEdge(vertex, neighbour))
+                            ends.push_back(neighbour);
+                    }
+                    if (ends.size() == 2)
+                        result = (mesh.points[ends[0]] + 6.0f * point + mesh.points[ends[1]]) / 8.0f;
+                }
+                else
+                {
+                    const float valence = (float)topology.vertexNeighbours[vertex].size();
+                    glm::vec3 faceAverage(0.0f), edgeAverage(0.0f);
+                    for (int face : topology.vertexFaces[vertex])
+                        faceAverage += centroid(mesh, face);
+                    faceAverage /= (float)topology.vertexFaces[vertex].size();
+                    for (int neighbour : topology.vertexNeighbours[vertex])
+                        edgeAverage += (point + mesh.points[neighbour]) * 0.5f;
+                    edgeAverage /= valence;
+                    result = (faceAverage + 2.0f * edgeAverage + (valence - 3.0f) * point) / valence;
+                }
+                refined.points.push_back(result);
+                return vertexPoints[vertex] = (int)refined.points.size() - 1;
+            };
+
+        std::map<int, size_t> firstChild;
+        for (int face : region)
+        {
+            const std::vector<int>& polygon = mesh.faces[face];
+            const size_t n = polygon.size();
+            firstChild[face] = refined.faces.size();
+            for (size_t i = 0; i < n; i++)
+            {
+                const int vertex = polygon[i], next = polygon[(i + 1) % n], previous = polygon[(i + n - 1) % n];
+                refined.faces.push_back({ vertexPoint(vertex), edgePoint(vertex, next), facePoint(face), edgePoint(previous, vertex) });
+            }
+        }
+
+        children.clear();
+        for (int face : irregular)
+        {
+            for (size_t i = 0; i < mesh.faces[face].size(); i++)
+                children.push_back((int)(firstChild[face] + i));
+        }
+        return refined;
+    }
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "EntityWorld.h"
+#include "JobSystem.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Rail network of piecewise cubic splines and the vehicles running on it.
+// A track is a Catmull-Rom spline through its control points, stored as one polynomial per segment, plus a
+// table of the spline parameter at equally spaced arc lengths, so a vehicle moves at a constant speed with
+// one lookup and one cubic evaluation. Vehicles are structure of arrays, advanced in chunks on the JobSystem,
+// and write the transforms of their entities (not moved by the EntityWorld motion system), hidden ones only on
+// the ticks of the EntityWorld animation LOD.
+class TrackNetwork
+{
+public:
+    struct Track
+    {
+        // p(t) = ((a * t + b) * t + c) * t + d, t in [0, 1] of every segment
+        std::vector<glm::vec3> a, b, c, d;
+        // spline parameter (segment + t) at the arc lengths k * spacing
+        std::vector<float> parameters;
+        float length = 0.0f;
+        float spacing = 0.0f;
+        bool closed = false;
+        // tracks continuing at the end of an open track, a vehicle takes them in turn
+        std::vector<uint32_t> successors;
+    };
+
+    struct VehicleComponents
+    {
+        std::vector<uint32_t> track;
+        std::vector<float> distance;    // arc length along the track
+        std::vector<float> speed;       // units per second
+        std::vector<uint8_t> moving;
+        std::vector<uint32_t> junctions; // junctions passed, picks the next successor
+        std::vector<Entity> entity;
+        // headlight in the vehicle's space, the scene's spot light uses the one of the followed vehicle
+        std::vector<glm::vec3> lightOffset;
+        std::vector<glm::vec3> lightDirection;
+        // chase camera socket in the vehicle's space
+        std::vector<uint8_t> hasCameraSocket;
+        std::vector<glm::vec3> cameraOffset;
+    };
+
+    std::vector<Track> tracks;
+    VehicleComponents vehicles;
+    // arc length between two entries of a track's lookup table
+    float tableSpacing = 0.25f;
+    size_t chunkSize = 1024;
+    float lastUpdateMs = 0.0f;
+
+    uint32_t addTrack(const std::vector<glm::vec3>& points, bool closed)
+    {
+        Track track;
+        track.closed = closed;
+        const size_t count = points.size();
+        const size_t segments = closed ? count : count - 1;
+        // Catmull-Rom tangents, open ends use the direction to their neighbour
+        auto tangent = [&](size_t i)
+            {
+                if (closed)
+                    return (points[(i + 1) % count] - points[(i + count - 1) % count]) * 0.5f;
+                if (i == 0)
+                    return points[1] - points[0];
+                if (i == count - 1)
+                    return points[count - 1] - points[count - 2];
+                return (points[i + 1] - points[i - 1]) * 0.5f;
+            };
+        for (size_t i = 0; i < segments; i++)
+        {
+            const glm::vec3& p0 = points[i];
+            const glm::vec3& p1 = points[(i + 1) % count];
+            const glm::vec3 m0 = tangent(i);
+            const glm::vec3 m1 = tangent((i + 1) % count);
+            track.a.push_back(2.0f * (p0 - p1) + m0 + m1);
+            track.b.push_back(3.0f * (p1 - p0) - 2.0f * m0 - m1);
+            track.c.push_back(m0);
+            track.d.push_back(p0);
+        }
+        buildLengthTable(track);
+        tracks.push_back(track);
+        return (uint32_t)tracks.size() - 1;
+    }
+
+    void connect(uint32_t from, uint32_t to)
+    {
+        tracks[from].successors.push_back(to);
+    }
+
+    // the entity is flagged as driven, so nothing treats it as static geometry
+    size_t addVehicle(uint32_t track, float distance, float speed, Entity entity, EntityWorld& world)
+    {
+        world.motion.driven[entity] = 1;
+        vehicles.track.push_back(track);
+        vehicles.distance.push_back(distance);
+        vehicles.speed.push_back(speed);
+        vehicles.moving.push_back(1);
+        vehicles.junctions.push_back(0);
+        vehicles.entity.push_back(entity);
+        vehicles.lightOffset.push_back(glm::vec3(-9.0f, 3.5f, 0.0f));
+        vehicles.lightDirection.push_back(glm::vec3(-1.0f, -0.25f, 0.0f));
+        vehicles.hasCameraSocket.push_back(1);
+        vehicles.cameraOffset.push_back(glm::vec3(11.0f, 11.0f, 0.0f));
+        return vehicles.track.size() - 1;
+    }
+
+    size_t getVehicleCount() const
+    {
+        return vehicles.track.size();
+    }
+
+    // Advances the vehicles and writes their entities' position and heading, before EntityWorld::update
+    void update(float deltaTime, EntityWorld& world)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        JobSystem::instance().parallelFor(getVehicleCount(), chunkSize, [&](size_t begin, size_t end)
+            {
+                advance(begin, end, deltaTime, world);
+            });
+        lastUpdateMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // position and unit direction of travel at an arc length of a track
+    void sample(const Track& track, float distance, glm::vec3& position, glm::vec3& forward) const
+    {
+        const float k = glm::clamp(track.spacing > 0.0f ? distance / track.spacing : 0.0f, 0.0f, (float)(track.parameters.size() - 1));
+        const size_t index = glm::min((size_t)k, track.parameters.size() - 2);
+        const float u = glm::mix(track.parameters[index], track.parameters[index + 1], k - (float)index);
+        const size_t segment = glm::min((size_t)u, track.a.size() - 1);
+        const float t = u - (float)segment;
+        position = ((track.a[segment] * t + track.b[segment]) * t + track.c[segment]) * t + track.d[segment];
+        const glm::vec3 derivative = (3.0f * track.a[segment] * t + 2.0f * track.b[segment]) * t + track.c[segment];
+        const float speed = glm::length(derivative);
+        forward = speed > 1e-6f ? derivative / speed : glm::vec3(-1.0f, 0.0f, 0.0f);
+    }
+
+private:
+    // cumulative chord lengths of a fine sampling, inverted at equal arc length steps
+    void buildLengthTable(Track& track) const
+    {
+        const int steps = 32;
+        std::vector<float> lengths(1, 0.0f);
+        std::vector<float> parameters(1, 0.0f);
+        glm::vec3 previous = track.d[0];
+        for (size_t segment = 0; segment < track.a.size(); segment++)
+        {
+            for (int step = 1; step <= steps; step++)
+            {
+                const float t = (float)step / (float)steps;
+                const glm::vec3 point = ((track.a[segment] * t + track.b[segment]) * t + track.c[segment]) * t + track.d[segment];
+                lengths.push_back(lengths.back() + glm::length(point - previous));
+                parameters.push_back((float)segment + t);
+                previous = point;
+            }
+        }
+
+        track.length = lengths.back();
+        const size_t entries = glm::max((size_t)2, (size_t)std::ceil(track.length / tableSpacing) + 1);
+        track.spacing = track.length / (float)(entries - 1);
+        track.parameters.resize(entries);
+        size_t j = 0;
+        for (size_t k = 0; k < entries; k++)
+        {
+            const float target = glm::min((float)k * track.spacing, track.length);
+            while (j + 2 < lengths.size() && lengths[j + 1] < target)
+                j++;
+            const float span = lengths[j + 1] - lengths[j];
+            const float f = span > 0.0f ? glm::clamp((target - lengths[j]) / span, 0.0f, 1.0f) : 0.0f;
+            track.parameters[k] = glm::mix(parameters[j], parameters[j + 1], f);
+        }
+    }
+
+    void advance(size_t begin, size_t end, float deltaTime, EntityWorld& world)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            if (!vehicles.moving[i])
+                continue;
+
+            uint32_t track = vehicles.track[i];
+            float distance = vehicles.distance[i] + vehicles.speed[i] * deltaTime;
+            // short tracks can be passed in a single step
+            while (tracks[track].length > 0.0f && distance >= tracks[track].length)
+            {
+                const Track& current = tracks[track];
+                if (current.closed)
+                {
+                    distance -= current.length;
+                }
+                else if (!current.successors.empty())
+                {
+                    distance -= current.length;
+                    track = current.successors[vehicles.junctions[i]++ % current.successors.size()];
+                }
+                else
+                {
+                    // dead end
+                    distance = current.length;
+                    vehicles.moving[i] = 0;
+                    break;
+                }
+            }
+            vehicles.track[i] = track;
+            vehicles.distance[i] = distance;
+
+            // a vehicle stopping at a dead end writes its last transform right away
+            const Entity entity = vehicles.entity[i];
+            world.motion.lag[entity] += glm::abs(vehicles.speed[i]) * deltaTime;
+            if (vehicles.moving[i] && !world.isTransformDue(entity))
+                continue;
+            world.motion.lag[entity] = 0.0f;
+
+            glm::vec3 position, forward;
+            sample(tracks[track], distance, position, forward);
+            // the models face -x, the heading is a rotation about y
+            world.setPosition(entity, position);
+            world.setRotation(entity, glm::vec3(0.0f, glm::degrees(std::atan2(forward.z, -forward.x)), 0.0f));
+        }
+    }
+};
@@ -2,21 +2,166 @@
 
 #include <glm/ext/matrix_transform.hpp>
 
+#include <algorithm>
+#include <vector>
+
+// Node of the transform hierarchy. Local and world matrices are cached and only rebuilt after a change,
+// changing a node marks its whole subtree dirty, so static objects cost nothing per frame.
+// Copying a transform copies its local position/rotation/scale, not its place in the hierarchy.
 class Transform
 {
 public:
+    Transform() = default;
+
+    Transform(const Transform& other)
+        : position(other.position), rotation(other.rotation), scale(other.scale) {}
+
+    Transform& operator=(const Transform& other)
+    {
+        position = other.position;
+        rotation = other.rotation;
+        scale = other.scale;
+        markLocalDirty();
+        return *this;
+    }
+
+    ~Transform()
+    {
+        setParent(nullptr);
+        for (Transform* child : children)
+        {
+            child->parent = nullptr;
+            child->markWorldDirty();
+        }
+    }
+
+    const glm::vec3& getPosition() const { return position; }
+    // Euler angles in degrees, applied in X, Y, Z order
+    const glm::vec3& getRotation() const { return rotation; }
+    const glm::vec3& getScale() const { return scale; }
+
+    void setPosition(const glm::vec3& value)
+    {
+        position = value;
+        markLocalDirty();
+    }
+
+    void setRotation(const glm::vec3& value)
+    {
+        rotation = value;
+        markLocalDirty();
+    }
+
+    void setScale(const glm::vec3& value)
+    {
+        scale = value;
+        markLocalDirty();
+    }
+
+    // For nodes driven from outside the hierarchy (e.g. mirroring an entity), position/rotation/scale
+    // no longer describe the node until one of them is set again
+    void setLocalMatrix(const glm::mat4& matrix)
+    {
+        localMatrix = matrix;
+        localDirty = false;
+        markWorldDirty();
+    }
+
+    // Keeps the local values, the node just follows the new parent from now on
+    void setParent(Transform* newParent)
+    {
+        if (parent == newParent)
+            return;
+        if (parent)
+            parent->children.erase(std::remove(parent->children.begin(), parent->children.end(), this), parent->children.end());
+        parent = newParent;
+        if (parent)
+            parent->children.push_back(this);
+        markWorldDirty();
+    }
+
+    Transform* getParent() const { return parent; }
+
+    const glm::mat4& getLocalMatrix() const
+    {
+        if (localDirty)
+        {
+            localMatrix = composeMatrix(position, rotation, scale);
+            localDirty = false;
+        }
+        return localMatrix;
+    }
+
+    static glm::mat4 composeMatrix(const glm::vec3& position, const glm::vec3& rotation, const glm::vec3& scale)
+    {
+        glm::mat4 matrix = glm::translate(glm::mat4(1.0f), position);
+        matrix = glm::rotate(matrix, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+        matrix = glm::rotate(matrix, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+        matrix = glm::rotate(matrix, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+        return glm::scale(matrix, scale);
+    }
+
+    const glm::mat4& getWorldMatrix() const
+    {
+        if (worldDirty)
+        {
+            worldMatrix = parent ? parent->getWorldMatrix() * getLocalMatrix() : getLocalMatrix();
+            worldDirty = false;
+            version++;
+        }
+        return worldMatrix;
+    }
+
+    const glm::mat4& getModelMatrix() const
+    {
+        return getWorldMatrix();
+    }
+
+    glm::vec3 getWorldPosition() const
+    {
+        return glm::vec3(getWorldMatrix()[3]);
+    }
+
+    // Local direction to world space, not normalized
+    glm::vec3 transformDirection(const glm::vec3& direction) const
+    {
+        return glm::vec3(getWorldMatrix() * glm::vec4(direction, 0.0f));
+    }
+
+    // Changes every time the world matrix is rebuilt, for caches depending on it
+    unsigned int getVersion() const
+    {
+        getWorldMatrix();
+        return version;
+    }
+
+private:
     glm::vec3 position{ 0.0f };
     glm::vec3 rotation{ 0.0f };
     glm::vec3 scale{ 1.0f };
 
-    glm::mat4 getModelMatrix() const
+    Transform* parent = nullptr;
+    std::vector<Transform*> children;
+
+    mutable glm::mat4 localMatrix{ 1.0f };
+    mutable glm::mat4 worldMatrix{ 1.0f };
+    mutable bool localDirty = true;
+    mutable bool worldDirty = true;
+    mutable unsigned int version = 0;
+
+    void markLocalDirty()
+    {
+        localDirty = true;
+        markWorldDirty();
+    }
+
+    // A clean node always has a clean parent chain, so a dirty node already has a dirty subtree
+    void markWorldDirty()
     {
-        glm::mat4 modelMatrix(1.0f);
-        modelMatrix = glm::translate(modelMatrix, position);
-        modelMatrix = glm::rotate(modelMatrix, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-        modelMatrix = glm::rotate(modelMatrix, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-        modelMatrix = glm::rotate(modelMatrix, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-        modelMatrix = glm::scale(modelMatrix, scale);
-        return modelMatrix;
+        if (worldDirty)
+            return;
+        worldDirty = true;
+        for (Transform* child : children)
+            child->markWorldDirty();
     }
 };
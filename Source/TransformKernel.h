@@ -0,0 +1,128 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cstddef>
+
+// Upper 3x4 part of an affine matrix stored by rows, the implicit last row is (0, 0, 0, 1).
+// This is the instance record uploaded for instanced draws, 48 bytes instead of a full mat4.
+struct AffineRecord
+{
+    glm::vec4 rows[3];
+
+    static AffineRecord fromMat4(const glm::mat4& matrix)
+    {
+        AffineRecord record;
+        for (int row = 0; row < 3; row++)
+            record.rows[row] = glm::vec4(matrix[0][row], matrix[1][row], matrix[2][row], matrix[3][row]);
+        return record;
+    }
+
+    glm::mat4 toMat4() const
+    {
+        glm::mat4 matrix(1.0f);
+        for (int column = 0; column < 4; column++)
+            matrix[column] = glm::vec4(rows[0][column], rows[1][column], rows[2][column], column == 3 ? 1.0f : 0.0f);
+        return matrix;
+    }
+
+    glm::vec3 transformPoint(const glm::vec3& point) const
+    {
+        const glm::vec4 p(point, 1.0f);
+        return glm::vec3(glm::dot(rows[0], p), glm::dot(rows[1], p), glm::dot(rows[2], p));
+    }
+};
+static_assert(sizeof(AffineRecord) == 48, "AffineRecord is uploaded as three vec4 attributes");
+
+// Same rotation as Transform::composeMatrix, which applies the Euler angles in X, Y, Z order
+inline glm::quat quatFromEuler(const glm::vec3& degrees)
+{
+    return glm::angleAxis(glm::radians(degrees.x), glm::vec3(1.0f, 0.0f, 0.0f))
+        * glm::angleAxis(glm::radians(degrees.y), glm::vec3(0.0f, 1.0f, 0.0f))
+        * glm::angleAxis(glm::radians(degrees.z), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+// Batched translation * rotation * scale. Transforms are processed in blocks of 8: the block is loaded into
+// per-component lane arrays, all 12 matrix entries are computed by branch free loops over the lanes
+// (one AVX2 register, two NEON registers per component) and the results are written out as records.
+// Rotations have to be unit quaternions.
+namespace TransformKernel
+{
+    const size_t BLOCK_SIZE = 8;
+
+    // world[i] = T * R * S. When normals is given, normals[i] gets the matching normal matrix
+    // inverse(transpose(R * S)) = R * inverse(S) with a zero translation column.
+    inline void compose(const glm::vec3* position, const glm::quat* rotation, const glm::vec3* scale, size_t count,
+        AffineRecord* world, AffineRecord* normals = nullptr)
+    {
+        alignas(32) float px[BLOCK_SIZE], py[BLOCK_SIZE], pz[BLOCK_SIZE];
+        alignas(32) float qx[BLOCK_SIZE], qy[BLOCK_SIZE], qz[BLOCK_SIZE], qw[BLOCK_SIZE];
+        alignas(32) float sx[BLOCK_SIZE], sy[BLOCK_SIZE], sz[BLOCK_SIZE];
+        alignas(32) float m[12][BLOCK_SIZE];
+        alignas(32) float n[9][BLOCK_SIZE];
+
+        for (size_t base = 0; base < count; base += BLOCK_SIZE)
+        {
+            const size_t lanes = std::min(BLOCK_SIZE, count - base);
+
+            // gather, unused lanes of the last block get an identity transform
+            for (size_t l = 0; l < BLOCK_SIZE; l++)
+            {
+                const size_t i = base + (l < lanes ? l : 0);
+                const bool used = l < lanes;
+                px[l] = used ? position[i].x : 0.0f;
+                py[l] = used ? position[i].y : 0.0f;
+                pz[l] = used ? position[i].z : 0.0f;
+                qx[l] = used ? rotation[i].x : 0.0f;
+                qy[l] = used ? rotation[i].y : 0.0f;
+                qz[l] = used ? rotation[i].z : 0.0f;
+                qw[l] = used ? rotation[i].w : 1.0f;
+                sx[l] = used ? scale[i].x : 1.0f;
+                sy[l] = used ? scale[i].y : 1.0f;
+                sz[l] = used ? scale[i].z : 1.0f;
+            }
+
+            for (size_t l = 0; l < BLOCK_SIZE; l++)
+            {
+                const float x2 = qx[l] + qx[l], y2 = qy[l] + qy[l], z2 = qz[l] + qz[l];
+                const float xx = qx[l] * x2, yy = qy[l] * y2, zz = qz[l] * z2;
+                const float xy = qx[l] * y2, xz = qx[l] * z2, yz = qy[l] * z2;
+                const float wx = qw[l] * x2, wy = qw[l] * y2, wz = qw[l] * z2;
+
+                const float r00 = 1.0f - (yy + zz), r01 = xy - wz, r02 = xz + wy;
+                const float r10 = xy + wz, r11 = 1.0f - (xx + zz), r12 = yz - wx;
+                const float r20 = xz - wy, r21 = yz + wx, r22 = 1.0f - (xx + yy);
+
+                m[0][l] = r00 * sx[l]; m[1][l] = r01 * sy[l]; m[2][l] = r02 * sz[l]; m[3][l] = px[l];
+                m[4][l] = r10 * sx[l]; m[5][l] = r11 * sy[l]; m[6][l] = r12 * sz[l]; m[7][l] = py[l];
+                m[8][l] = r20 * sx[l]; m[9][l] = r21 * sy[l]; m[10][l] = r22 * sz[l]; m[11][l] = pz[l];
+
+                const float ix = 1.0f / sx[l], iy = 1.0f / sy[l], iz = 1.0f / sz[l];
+                n[0][l] = r00 * ix; n[1][l] = r01 * iy; n[2][l] = r02 * iz;
+                n[3][l] = r10 * ix; n[4][l] = r11 * iy; n[5][l] = r12 * iz;
+                n[6][l] = r20 * ix; n[7][l] = r21 * iy; n[8][l] = r22 * iz;
+            }
+
+            for (size_t l = 0; l < lanes; l++)
+            {
+                AffineRecord& record = world[base + l];
+                record.rows[0] = glm::vec4(m[0][l], m[1][l], m[2][l], m[3][l]);
+                record.rows[1] = glm::vec4(m[4][l], m[5][l], m[6][l], m[7][l]);
+                record.rows[2] = glm::vec4(m[8][l], m[9][l], m[10][l], m[11][l]);
+            }
+
+            if (normals)
+            {
+                for (size_t l = 0; l < lanes; l++)
+                {
+                    AffineRecord& record = normals[base + l];
+                    record.rows[0] = glm::vec4(n[0][l], n[1][l], n[2][l], 0.0f);
+                    record.rows[1] = glm::vec4(n[3][l], n[4][l], n[5][l], 0.0f);
+                    record.rows[2] = glm::vec4(n[6][l], n[7][l], n[8][l], 0.0f);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "ComputeShader.h"
+#include "Frustum.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Shader.h"
+
+#include <cmath>
+#include <vector>
+
+#define VEGETATION_INSTANCES_BINDING 15
+#define VEGETATION_COMMANDS_BINDING 16
+
+// Grass and rocks on the floor, placed on the GPU. Every frame vegetation.cs walks the tiles of the area around the
+// camera, generates each tile's plants from a hash (so they stay put), culls the tiles and then the plants against
+// the frustum and the layer's distance, and appends the survivors to an instance buffer. The same pass counts them
+// into the indirect draw commands, so a layer is drawn with the regular instanced program without the CPU ever
+// knowing how many plants there are. Needs compute shaders and shader storage buffers.
+class VegetationScatter
+{
+public:
+    struct Layer
+    {
+        Model* model = nullptr;
+        int instancesPerTile = 256;
+        float maxDistance = 60.0f;
+        float fadeStart = 0.6f;      // fraction of maxDistance where the plants start thinning out
+        glm::vec2 scaleRange = glm::vec2(0.5f, 1.0f);
+        glm::vec2 heightRange = glm::vec2(0.8f, 1.2f); // y scale relative to the uniform scale
+        float maxTilt = 0.15f;       // radians
+        bool twoSided = false;       // single sheet blades, the back faces flip their normal
+        unsigned int maxInstances = 0;
+        bool enabled = true;
+        // instance buffer (AffineRecord, INSTANCE_ATTRIBUTE), command per mesh
+        GLuint instanceBuffer = 0, commandBuffer = 0, VAO = 0;
+        GLsizei commandCount = 0;
+    };
+
+    std::vector<Layer> layers;
+    // scattered rectangle on the ground plane
+    glm::vec2 areaMin = glm::vec2(-100.0f);
+    glm::vec2 areaMax = glm::vec2(100.0f);
+    float groundHeight = 0.0f;
+    float tileSize = 4.0f;
+    bool enabled = true;
+    float lastGpuMs = 0.0f;
+    // tiles dispatched last frame over all layers
+    size_t lastTiles = 0;
+
+    static bool supportsGpu()
+    {
+        const GLCaps& caps = GLCaps::instance();
+        return caps.computeShader && caps.shaderStorage;
+    }
+
+    static void setupShader(const Shader& shader)
+    {
+        if (!supportsGpu())
+            return;
+        const char* blocks[] = { "VegetationInstances", "VegetationCommands" };
+        const GLuint bindings[] = { VEGETATION_INSTANCES_BINDING, VEGETATION_COMMANDS_BINDING };
+        for (int i = 0; i < 2; i++)
+        {
+            GLuint block = glGetProgramResourceIndex(shader.ID, GL_SHADER_STORAGE_BLOCK, blocks[i]);
+            if (block != GL_INVALID_INDEX)
+                glShaderStorageBlockBinding(shader.ID, block, bindings[i]);
+        }
+    }
+
+    // the layer keeps up to maxInstances plants in view, the materials have to be built already
+    size_t addLayer(const Layer& settings, unsigned int maxInstances)
+    {
+        if (!supportsGpu() || !settings.model)
+            return ~(size_t)0;
+
+        Layer layer = settings;
+        layer.maxInstances = maxInstances;
+        const std::vector<DrawElementsIndirectCommand> commands = layer.model->getDrawCommands();
+        layer.commandCount = (GLsizei)commands.size();
+
+        GLState& state = GLState::instance();
+        glGenBuffers(1, &layer.instanceBuffer);
+        state.bindBuffer(GL_SHADER_STORAGE_BUFFER, layer.instanceBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)maxInstances * sizeof(AffineRecord), nullptr, GL_DYNAMIC_COPY);
+        glGenBuffers(1, &layer.commandBuffer);
+        state.bindBuffer(GL_SHADER_STORAGE_BUFFER, layer.commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_COPY);
+
+        layer.VAO = layer.model->createVertexArray(layer.model->getVertexBuffer(), true);
+        state.bindVertexArray(layer.VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, layer.instanceBuffer);
+        Mesh::setupInstanceAttributes();
+        state.bindVertexArray(0);
+
+        if (timerQuery == 0)
+            glGenQueries(1, &timerQuery);
+        layers.push_back(layer);
+        return layers.size() - 1;
+    }
+
+    // fills the instance buffers and draw commands of every layer for this frame's view
+    void scatter(ComputeShader& computeShader, const Frustum& frustum, const glm::vec3& viewPos)
+    {
+        lastTiles = 0;
+        if (!enabled || layers.empty())
+            return;
+        readTimer();
+        const bool timed = !timerPending;
+        if (timed)
+            glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+
+        computeShader.use();
+        computeShader.setVec4Array("frustumPlanes", frustum.planes, 6);
+        computeShader.setVec3("viewPos", viewPos);
+        computeShader.setVec2("areaMin", areaMin);
+        computeShader.setVec2("areaMax", areaMax);
+        computeShader.setFloat("tileSize", tileSize);
+        computeShader.setFloat("groundHeight", groundHeight);
+
+        GLState& state = GLState::instance();
+        for (size_t l = 0; l < layers.size(); l++)
+        {
+            const Layer& layer = layers[l];
+            if (!layer.enabled)
+                continue;
+            // the range of the fog culls too
+            float range = layer.maxDistance;
+            if (frustum.range.w >= 0.0f)
+                range = glm::min(range, frustum.range.w);
+
+            // tiles within range of the camera, clamped to the area. Without any the commands are still reset
+            const glm::vec2 low = glm::max(glm::vec2(viewPos.x, viewPos.z) - range, areaMin);
+            const glm::vec2 high = glm::min(glm::vec2(viewPos.x, viewPos.z) + range, areaMax);
+            const glm::ivec2 firstTile((int)std::floor(low.x / tileSize), (int)std::floor(low.y / tileSize));
+            glm::ivec2 tiles(0);
+            if (low.x < high.x && low.y < high.y)
+                tiles = glm::ivec2((int)std::ceil(high.x / tileSize), (int)std::ceil(high.y / tileSize)) - firstTile;
+
+            state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, VEGETATION_INSTANCES_BINDING, layer.instanceBuffer);
+            state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, VEGETATION_COMMANDS_BINDING, layer.commandBuffer);
+            computeShader.setInt("commandCount", layer.commandCount);
+            computeShader.setUint("maxInstances", layer.maxInstances);
+            computeShader.setUint("seed", (unsigned int)(l * 0x9e3779b9u));
+            computeShader.setInt("firstTileX", firstTile.x);
+            computeShader.setInt("firstTileZ", firstTile.y);
+            computeShader.setInt("tilesX", tiles.x);
+            computeShader.setInt("instancesPerTile", layer.instancesPerTile);
+            computeShader.setFloat("maxDistance", range);
+            computeShader.setFloat("fadeStart", layer.fadeStart);
+            computeShader.setVec2("scaleRange", layer.scaleRange);
+            computeShader.setVec2("heightRange", layer.heightRange);
+            computeShader.setFloat("maxTilt", layer.maxTilt);
+            computeShader.setVec4("bounds", layer.model->getBoundingSphere());
+
+            const GLuint commandGroups = (GLuint)(layer.commandCount + GROUP_SIZE - 1) / GROUP_SIZE;
+            computeShader.setInt("pass", PASS_RESET);
+            computeShader.dispatch(commandGroups);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            if (tiles.x * tiles.y > 0)
+            {
+                computeShader.setInt("pass", PASS_SCATTER);
+                computeShader.dispatch((GLuint)(tiles.x * tiles.y));
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+            computeShader.setInt("pass", PASS_FINISH);
+            computeShader.dispatch(commandGroups);
+            lastTiles += (size_t)(tiles.x * tiles.y);
+        }
+        // the draws read the commands and the instance attributes
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+        if (timed)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            timerPending = true;
+        }
+    }
+
+    // shader is the instanced program with its per frame uniforms set
+    void draw(Shader& shader)
+    {
+        if (!enabled)
+            return;
+        shader.use();
+        for (const Layer& layer : layers)
+        {
+            if (!layer.enabled)
+                continue;
+            shader.setBool("twoSided", layer.twoSided);
+            layer.model->DrawIndirect(shader, layer.VAO, layer.commandBuffer);
+        }
+        shader.setBool("twoSided", false);
+    }
+
+private:
+    enum Pass { PASS_RESET = 0, PASS_SCATTER = 1, PASS_FINISH = 2 };
+    // local size of vegetation.cs
+    static const int GROUP_SIZE = 64;
+
+    GLuint timerQuery = 0;
+    bool timerPending = false;
+
+    // the result of an earlier frame's query, never waits
+    void readTimer()
+    {
+        if (!timerPending)
+            return;
+        GLint available = 0;
+        glGetQueryObjectiv(timerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &nanoseconds);
+        lastGpuMs = (float)((double)nanoseconds / 1e6);
+        timerPending = false;
+    }
+};
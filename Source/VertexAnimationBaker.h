@@ -0,0 +1,254 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "GLState.h"
+#include "JobSystem.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Shader.h"
+#include "Skeleton.h"
+#include "SkinningSystem.h"
+#include "TransformKernel.h"
+
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+
+// units of the vertex animation textures, after the impostor atlases
+#define VAT_POSITION_UNIT 4
+#define VAT_NORMAL_UNIT 5
+// per-instance time offset and playback speed, after the AffineRecord rows
+#define VAT_INSTANCE_ATTRIBUTE 11
+
+// Crowds of animated models without per instance skinning. A clip of a rigged model is skinned once, at load,
+// into a position and a normal texture holding every vertex of every frame. A crowd is then a static instance
+// buffer drawn with vat.vs, which fetches the two frames around each instance's own time and blends them,
+// so thousands of independently animated instances are one instanced draw per mesh and no CPU work per frame.
+class VertexAnimationBaker
+{
+public:
+    struct Animation
+    {
+        GLuint positions = 0; // xyz - mesh space position
+        GLuint normals = 0;   // xyz - mesh space normal
+        // a frame is rowsPerFrame rows of width vertices, so large meshes fit the texture size limit
+        int width = 0;
+        int rowsPerFrame = 0;
+        int frames = 0;
+        float frameRate = 0.0f;
+    };
+
+    // instance record of a crowd, the matrix rows go to INSTANCE_ATTRIBUTE like AffineRecord
+    struct CrowdInstance
+    {
+        AffineRecord transform;
+        float timeOffset; // seconds
+        float speed;
+        float padding[2];
+    };
+
+    struct Crowd
+    {
+        Model* model = nullptr;
+        int clip = 0;
+        GLuint instanceBuffer = 0, VAO = 0;
+        GLsizei count = 0;
+        glm::vec4 bounds = glm::vec4(0.0f); // world space sphere of all instances
+    };
+
+    std::vector<Crowd> crowds;
+    float frameRate = 30.0f;
+    int maxFrames = 512;
+    // seconds, advanced by update
+    float time = 0.0f;
+    float lastBakeMs = 0.0f;
+    size_t lastDrawn = 0;
+
+    // Connects the animation samplers of a VAT program to their units, once per program
+    static void setupShader(const Shader& shader)
+    {
+        shader.use();
+        shader.setInt("vatPositions", VAT_POSITION_UNIT);
+        shader.setInt("vatNormals", VAT_NORMAL_UNIT);
+    }
+
+    bool has(Model* model, int clip) const
+    {
+        return animations.count(std::make_pair(model, clip)) != 0;
+    }
+
+    // samples the clip at frameRate and skins every frame on the workers, the materials have to be built already
+    bool bake(Model* model, int clip)
+    {
+        if (has(model, clip))
+            return true;
+        if (!model->hasSkeleton() || clip < 0 || clip >= (int)model->animations.size())
+            return false;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        model->getVertexBuffer();
+        const std::vector<Vertex>& bindPose = model->getBindPoseVertices();
+        const Skeleton& skeleton = model->skeleton;
+        const AnimationClip& source = model->animations[clip];
+        const int vertexCount = (int)bindPose.size();
+
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        Animation animation;
+        animation.frames = glm::clamp((int)std::ceil(source.duration * frameRate), 1, maxFrames);
+        // the frames span the whole clip, so the last one blends back into the first
+        animation.frameRate = source.duration > 0.0f ? (float)animation.frames / source.duration : frameRate;
+        animation.width = glm::min(vertexCount, (int)maxSize);
+        animation.rowsPerFrame = (vertexCount + animation.width - 1) / animation.width;
+        const int height = animation.frames * animation.rowsPerFrame;
+        if (vertexCount == 0 || height > maxSize)
+        {
+            std::cout << "ERROR::VAT::TOO_MANY_VERTICES_OR_FRAMES" << std::endl;
+            return false;
+        }
+
+        std::vector<glm::vec4> positions((size_t)animation.width * height, glm::vec4(0.0f));
+        std::vector<glm::vec4> normals(positions.size(), glm::vec4(0.0f));
+        JobSystem::instance().parallelFor((size_t)animation.frames, 1, [&](size_t begin, size_t end)
+            {
+                std::vector<NodePose> pose(skeleton.nodes.size());
+                std::vector<glm::mat4> globals(skeleton.nodes.size());
+                std::vector<glm::mat4> palette(skeleton.getBoneCount(), glm::mat4(1.0f));
+                for (size_t frame = begin; frame < end; frame++)
+                {
+                    SkeletalAnimation::samplePose(skeleton, source, (float)frame / animation.frameRate, pose.data());
+                    SkeletalAnimation::computePalette(skeleton, pose.data(), globals.data(), palette.data());
+                    for (int v = 0; v < vertexCount; v++)
+                    {
+                        const Vertex skinned = SkinningSystem::skinVertex(bindPose[v], palette.data(), (int)palette.size());
+                        const size_t texel = ((size_t)frame * animation.rowsPerFrame + v / animation.width) * animation.width + v % animation.width;
+                        positions[texel] = glm::vec4(skinned.Position, 1.0f);
+                        normals[texel] = glm::vec4(skinned.Normal, 0.0f);
+                    }
+                }
+            });
+
+        animation.positions = createTexture(GL_RGBA32F, animation.width, height, positions);
+        animation.normals = createTexture(GL_RGBA16F, animation.width, height, normals);
+        animations[std::make_pair(model, clip)] = animation;
+        lastBakeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return true;
+    }
+
+    // uploads a crowd of a baked clip, the instances never change afterwards
+    size_t addCrowd(Model* model, int clip, const std::vector<CrowdInstance>& instances)
+    {
+        if (!has(model, clip) || instances.empty())
+            return ~(size_t)0;
+
+        Crowd crowd;
+        crowd.model = model;
+        crowd.clip = clip;
+        crowd.count = (GLsizei)instances.size();
+
+        // sphere around the instances' bounding spheres
+        const glm::vec4 sphere = model->getBoundingSphere();
+        glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+        for (const CrowdInstance& instance : instances)
+        {
+            const glm::vec3 center = instance.transform.transformPoint(glm::vec3(sphere));
+            low = glm::min(low, center);
+            high = glm::max(high, center);
+        }
+        float scale = 0.0f;
+        for (const CrowdInstance& instance : instances)
+        {
+            for (int row = 0; row < 3; row++)
+                scale = glm::max(scale, glm::length(glm::vec3(instance.transform.rows[row])));
+        }
+        // the poses can reach past the bind pose's sphere
+        const glm::vec3 center = (low + high) * 0.5f;
+        crowd.bounds = glm::vec4(center, glm::length(high - center) + 1.5f * sphere.w * scale);
+
+        GLState& state = GLState::instance();
+        glGenBuffers(1, &crowd.instanceBuffer);
+        state.bindBuffer(GL_ARRAY_BUFFER, crowd.instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(CrowdInstance), instances.data(), GL_STATIC_DRAW);
+
+        crowd.VAO = model->createVertexArray(model->getVertexBuffer(), true);
+        state.bindVertexArray(crowd.VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, crowd.instanceBuffer);
+        for (int row = 0; row < 3; row++)
+        {
+            glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + row);
+            glVertexAttribPointer(INSTANCE_ATTRIBUTE + row, 4, GL_FLOAT, GL_FALSE, sizeof(CrowdInstance), (void*)(row * sizeof(glm::vec4)));
+            glVertexAttribDivisor(INSTANCE_ATTRIBUTE + row, 1);
+        }
+        glEnableVertexAttribArray(VAT_INSTANCE_ATTRIBUTE);
+        glVertexAttribPointer(VAT_INSTANCE_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, sizeof(CrowdInstance), (void*)offsetof(CrowdInstance, timeOffset));
+        glVertexAttribDivisor(VAT_INSTANCE_ATTRIBUTE, 1);
+        state.bindVertexArray(0);
+
+        crowds.push_back(crowd);
+        return crowds.size() - 1;
+    }
+
+    size_t getInstanceCount() const
+    {
+        size_t count = 0;
+        for (const Crowd& crowd : crowds)
+            count += crowd.count;
+        return count;
+    }
+
+    void update(float deltaTime)
+    {
+        time += deltaTime;
+    }
+
+    // shader is the vat.vs program with its per frame uniforms set, whole crowds are culled
+    void draw(Shader& shader, const Frustum& frustum)
+    {
+        lastDrawn = 0;
+        if (crowds.empty())
+            return;
+
+        GLState& state = GLState::instance();
+        shader.use();
+        shader.setFloat("animationTime", time);
+        for (const Crowd& crowd : crowds)
+        {
+            if (!frustum.intersectsSphere(glm::vec3(crowd.bounds), crowd.bounds.w))
+                continue;
+            const Animation& animation = animations.at(std::make_pair(crowd.model, crowd.clip));
+            shader.setInt("vatWidth", animation.width);
+            shader.setInt("vatRowsPerFrame", animation.rowsPerFrame);
+            shader.setInt("vatFrames", animation.frames);
+            shader.setFloat("vatFrameRate", animation.frameRate);
+            state.bindTexture(VAT_POSITION_UNIT, GL_TEXTURE_2D, animation.positions);
+            state.bindTexture(VAT_NORMAL_UNIT, GL_TEXTURE_2D, animation.normals);
+            crowd.model->DrawInstanced(shader, crowd.VAO, crowd.count);
+            lastDrawn += crowd.count;
+        }
+    }
+
+private:
+    std::map<std::pair<Model*, int>, Animation> animations;
+
+    // fetched with texelFetch, frames are blended in the shader
+    static GLuint createTexture(GLenum format, int width, int height, const std::vector<glm::vec4>& texels)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::instance().bindTextureForUpload(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_FLOAT, texels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+};
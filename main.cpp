@@ -14,8 +14,11 @@
 
 #include "Source/Model.h"
 #include "Source/Camera.h"
+#include "Source/GLExtensions.h"
+#include "Source/GLState.h"
+#include "Source/Material.h"
 #include "Source/Shader.h"
-#include "Source/GameObject.h"
+#include "Source/EntityWorld.h"
 #include "Source/Scene.h"
 #include "Source/Transform.h"
 
@@ -24,14 +27,15 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos);
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
-void updateWireFrame();
 void drawImGui();
+void drawTransformSliders(Transform& transform, const std::string& idSuffix = "");
+void drawEntitySliders(EntityWorld& world, Entity entity);
 void setupScene(Scene& scene);
+void setupTracks(TrackNetwork& tracks);
 
 float deltaTime = 0.0f;
 double lastFrame = 0.0;
 
-bool wireFrame = false;
 bool captureMouse = false;
 
 Scene scene;
@@ -39,11 +43,19 @@ Scene scene;
 int main()
 {
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    
-    GLFWwindow* window = glfwCreateWindow(scene.screenWidth, scene.screenHeight, "3DRenderer", NULL, NULL);
+
+    // Ask for the newest context first, optional features (see GLExtensions.h) need 4.3+, 4.0 is the minimum
+    const int contextVersions[][2] = { { 4, 6 }, { 4, 3 }, { 4, 0 } };
+    GLFWwindow* window = NULL;
+    for (const auto& version : contextVersions)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+        window = glfwCreateWindow(scene.screenWidth, scene.screenHeight, "3DRenderer", NULL, NULL);
+        if (window != NULL)
+            break;
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -64,8 +76,7 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
-
-    glEnable(GL_DEPTH_TEST);
+    GLCaps::instance().load((GLADloadproc)glfwGetProcAddress);
 
     // Initialize ImGui
     IMGUI_CHECKVERSION();
@@ -76,11 +87,113 @@ int main()
 
     stbi_set_flip_vertically_on_load(true);
 
-    Shader shader("Assets/Shaders/vertex.vs", "Assets/Shaders/fragment.fs");
-    Shader lightShader("Assets/Shaders/vertex.vs", "Assets/Shaders/lightFragment.fs");
-	Shader tessShader("Assets/Shaders/vertex.vs", "Assets/Shaders/fragment.fs", "Assets/Shaders/tessControl.tcs", "Assets/Shaders/tessEval.tes");
+    // with bindless textures the material shaders read texture handles from a storage buffer
+    const char* materialHeader = MaterialLibrary::supportsBindless() ? BINDLESS_SHADER_HEADER : nullptr;
+    Shader shader("Assets/Shaders/vertex.vs", "Assets/Shaders/fragment.fs", nullptr, nullptr, materialHeader);
+    // same shaders with the world matrix taken from per-instance attributes
+    const std::string instancedHeader = materialHeader ? std::string(materialHeader) + "\n#define INSTANCED" : "#define INSTANCED";
+    Shader instancedShader("Assets/Shaders/vertex.vs", "Assets/Shaders/fragment.fs", nullptr, nullptr, instancedHeader.c_str());
+    // crowds animated from vertex animation textures
+    Shader crowdShader("Assets/Shaders/vat.vs", "Assets/Shaders/fragment.fs", nullptr, nullptr, instancedHeader.c_str());
+    // baked far field impostors: the object shader writing the atlases, and the quads drawing them
+    const std::string bakeHeader = materialHeader ? std::string(materialHeader) + "\n#define IMPOSTOR_BAKE" : "#define IMPOSTOR_BAKE";
+    Shader impostorBakeShader("Assets/Shaders/vertex.vs", "Assets/Shaders/fragment.fs", nullptr, nullptr, bakeHeader.c_str());
+    const std::string impostorHeader = materialHeader ? std::string(materialHeader) + "\n#define IMPOSTOR" : "#define IMPOSTOR";
+    Shader impostorShader("Assets/Shaders/impostor.vs", "Assets/Shaders/fragment.fs", nullptr, nullptr, impostorHeader.c_str());
+    // shading LOD, the light loop per vertex for objects small on screen
+    const std::string gouraudHeader = materialHeader ? std::string(materialHeader) + "\n#define GOURAUD" : "#define GOURAUD";
+    Shader gouraudShader("Assets/Shaders/gouraud.vs", "Assets/Shaders/fragment.fs", nullptr, nullptr, gouraudHeader.c_str());
+    const std::string gouraudInstancedHeader = gouraudHeader + "\n#define INSTANCED";
+    Shader gouraudInstancedShader("Assets/Shaders/gouraud.vs", "Assets/Shaders/fragment.fs", nullptr, nullptr, gouraudInstancedHeader.c_str());
+    // point light gizmos, ray traced spheres on instanced quads
+    Shader lightShader("Assets/Shaders/lightImpostor.vs", "Assets/Shaders/lightFragment.fs");
+	Shader tessShader("Assets/Shaders/vertex.vs", "Assets/Shaders/fragment.fs", "Assets/Shaders/tessControl.tcs", "Assets/Shaders/tessEval.tes", materialHeader);
+
+    // loaded Bezier surfaces, one draw for all patches with storage buffers
+    std::unique_ptr<Shader> patchShader;
+    if (PatchRenderer::supportsStorage())
+    {
+        const std::string patchHeader = PatchRenderer::makeShaderHeader(materialHeader);
+        patchShader = std::make_unique<Shader>("Assets/Shaders/patch.vs", "Assets/Shaders/fragment.fs",
+            "Assets/Shaders/tessControl.tcs", "Assets/Shaders/tessEval.tes", patchHeader.c_str());
+    }
+
+    // captures the tessellated surfaces for PatchCache
+    Shader captureShader("Assets/Shaders/vertex.vs", "Assets/Shaders/fragment.fs", "Assets/Shaders/tessControl.tcs", "Assets/Shaders/tessEval.tes", materialHeader);
+    captureShader.setFeedbackVaryings(PatchCache::getFeedbackVaryings());
+
+    // cloth solver, the CPU one is used without compute shaders
+    std::unique_ptr<ComputeShader> clothShader;
+    if (Cloth::supportsGpu())
+    {
+        clothShader = std::make_unique<ComputeShader>("Assets/Shaders/cloth.cs");
+        Cloth::setupShader(*clothShader);
+    }
+    // skinning of the animated entities, the workers skin them without compute shaders
+    std::unique_ptr<ComputeShader> skinningShader;
+    if (SkinningSystem::supportsGpu())
+    {
+        skinningShader = std::make_unique<ComputeShader>("Assets/Shaders/skinning.cs");
+        SkinningSystem::setupShader(*skinningShader);
+    }
+    // particles only exist on the GPU, there are none without compute shaders
+    std::unique_ptr<ComputeShader> particleComputeShader;
+    std::unique_ptr<Shader> particleShader;
+    if (ParticleSystem::supportsGpu())
+    {
+        particleComputeShader = std::make_unique<ComputeShader>("Assets/Shaders/particles.cs");
+        particleShader = std::make_unique<Shader>("Assets/Shaders/particle.vs", "Assets/Shaders/particleFragment.fs");
+        ParticleSystem::setupShader(*particleComputeShader);
+        ParticleSystem::setupShader(*particleShader);
+        scene.particles.create(1u << 20, *particleComputeShader);
+    }
+    // grass and rocks are only scattered with compute shaders
+    std::unique_ptr<ComputeShader> vegetationShader;
+    if (VegetationScatter::supportsGpu())
+    {
+        vegetationShader = std::make_unique<ComputeShader>("Assets/Shaders/vegetation.cs");
+        VegetationScatter::setupShader(*vegetationShader);
+    }
 
 	setupScene(scene);
+    scene.buildHlod();
+
+	// all models are loaded, pack their textures and upload the material parameters
+	MaterialLibrary::instance().build();
+	MaterialLibrary::setupShader(shader);
+	MaterialLibrary::setupShader(instancedShader);
+    MaterialLibrary::setupShader(crowdShader);
+    VertexAnimationBaker::setupShader(crowdShader);
+	MaterialLibrary::setupShader(tessShader);
+	MaterialLibrary::setupShader(captureShader);
+    if (patchShader)
+    {
+        MaterialLibrary::setupShader(*patchShader);
+        PatchRenderer::setupShader(*patchShader);
+    }
+    MaterialLibrary::setupShader(impostorBakeShader);
+    MaterialLibrary::setupShader(gouraudShader);
+    MaterialLibrary::setupShader(gouraudInstancedShader);
+    ImpostorBaker::setupShader(impostorShader);
+    scene.bakeImpostors(impostorBakeShader);
+    scene.setupVegetation();
+
+    // the programs outlive the loop, the scene only keeps pointers
+    scene.programs.shader = &shader;
+    scene.programs.instanced = &instancedShader;
+    scene.programs.crowd = &crowdShader;
+    scene.programs.impostor = &impostorShader;
+    scene.programs.gouraud = &gouraudShader;
+    scene.programs.gouraudInstanced = &gouraudInstancedShader;
+    scene.programs.light = &lightShader;
+    scene.programs.tessellation = &tessShader;
+    scene.programs.patch = patchShader.get();
+    scene.programs.capture = &captureShader;
+    scene.programs.particle = particleShader.get();
+    scene.programs.cloth = clothShader.get();
+    scene.programs.skinning = skinningShader.get();
+    scene.programs.particles = particleComputeShader.get();
+    scene.programs.vegetation = vegetationShader.get();
 
     while (!glfwWindowShouldClose(window))
     {
@@ -89,9 +202,10 @@ int main()
 		lastFrame = currentFrame;
 
         processInput(window);
+		GLState::instance().beginFrame();
 
 		scene.update(deltaTime);
-		scene.draw(shader, lightShader, tessShader);
+		scene.draw();
                
 		drawImGui();
 
@@ -170,8 +284,7 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 {
 	if (key == GLFW_KEY_F && action == GLFW_PRESS)
 	{
-        wireFrame = !wireFrame;
-		updateWireFrame();
+        scene.wireFrame = !scene.wireFrame;
 	}
 	if (key == GLFW_KEY_B && action == GLFW_PRESS)
 	{
@@ -204,49 +317,142 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		scene.camera.setMode(FREE);
 }
 
-void updateWireFrame()
-{
-	if (wireFrame)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	else
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-}
-
 void setupScene(Scene& scene)
 {
     Model* trainModel = new Model("Assets/Objects/GEVO/Gevo.obj", false);
     Model* sphereModel = new Model("Assets/Objects/basics/sphere.obj");
     Model* floorModel = new Model("Assets/Objects/basics/floor.obj");
     Model* trexModel = new Model("Assets/Objects/trex/trex.obj");
+    Model* grassModel = new Model("Assets/Objects/vegetation/grass.obj");
 
 	scene.sphereModel = sphereModel;
+    scene.grassModel = grassModel;
+    scene.vehicleModel = trainModel;
 
+    setupTracks(scene.tracks);
     Transform trainTransform;
-    trainTransform.scale = glm::vec3(1.0f);
-    auto train = std::make_unique<GameObject>(trainModel, trainTransform, "Train");
-    train->isMoving = true;
-    scene.gameObjects.push_back(std::move(train));
-    scene.camera.TargetTransform = &scene.gameObjects[0]->transform;
+    trainTransform.setScale(glm::vec3(1.0f));
+    Entity train = scene.world.create(trainModel, trainTransform, "Train");
+    scene.tracks.addVehicle(0, 0.0f, 7.5f, train, scene.world);
+    scene.followVehicle(0);
 
     Transform floorTransform;
-    floorTransform.scale = glm::vec3(100, 0.0001f, 100);
-    scene.gameObjects.push_back(std::make_unique<GameObject>(floorModel, floorTransform, "Floor"));
+    floorTransform.setScale(glm::vec3(100, 0.0001f, 100));
+    Entity floor = scene.world.create(floorModel, floorTransform, "Floor");
+    // the floor quad spans -1..1 before scaling
+    scene.vegetation.areaMin = -glm::vec2(floorTransform.getScale().x, floorTransform.getScale().z);
+    scene.vegetation.areaMax = glm::vec2(floorTransform.getScale().x, floorTransform.getScale().z);
 
     Transform sphereTransform;
-	sphereTransform.position = glm::vec3(0.0f, 1.0f, 0.0f);
-    scene.gameObjects.push_back(std::make_unique<GameObject>(sphereModel, sphereTransform, "Sphere"));
+	sphereTransform.setPosition(glm::vec3(0.0f, 1.0f, 0.0f));
+    Entity sphere = scene.world.create(sphereModel, sphereTransform, "Sphere");
 
     Transform trexTransform;
-    trexTransform.position = glm::vec3(0.0f, -0.05f, 7.0f);
-    scene.gameObjects.push_back(std::make_unique<GameObject>(trexModel, trexTransform, "T-rex"));
+    trexTransform.setPosition(glm::vec3(0.0f, -0.05f, 7.0f));
+    Entity trex = scene.world.create(trexModel, trexTransform, "T-rex");
 
     Transform trex2Transform;
-    trex2Transform.position = glm::vec3(20.0f, -0.05f, -7.0f);
-    scene.gameObjects.push_back(std::make_unique<GameObject>(trexModel, trex2Transform, "T-rex2"));
+    trex2Transform.setPosition(glm::vec3(20.0f, -0.05f, -7.0f));
+    Entity trex2 = scene.world.create(trexModel, trex2Transform, "T-rex2");
 
     Transform trex3Transform;
-    trex3Transform.position = glm::vec3(-40.0f, -0.05f, 7.0f);
-    scene.gameObjects.push_back(std::make_unique<GameObject>(trexModel, trex3Transform, "T-rex3"));
+    trex3Transform.setPosition(glm::vec3(-40.0f, -0.05f, 7.0f));
+    Entity trex3 = scene.world.create(trexModel, trex3Transform, "T-rex3");
+
+    scene.sceneEntities = { train, floor, sphere, trex, trex2, trex3 };
+    // rigged models play their first clip, instances of a model start at different times
+    for (Entity entity : scene.sceneEntities)
+    {
+        size_t instance = scene.skinning.add(scene.world, entity);
+        if (instance == ~(size_t)0)
+            continue;
+        scene.skinning.instances[instance].time = 0.37f * (float)instance;
+        // the first one with a clip can also be spawned as a crowd
+        Model* model = scene.world.render.model[entity];
+        if (!scene.crowdModel && !model->animations.empty())
+            scene.crowdModel = model;
+    }
+
+    // grid of Bezier tori sharing one surface, with a few solid colour materials
+    BezierSurface torus;
+    if (torus.loadBpt("Assets/Objects/patches/torus.bpt"))
+    {
+        unsigned int surface = scene.patches.addSurface(torus);
+        const unsigned char colors[][4] = { { 200, 60, 50, 255 }, { 60, 160, 80, 255 }, { 70, 90, 200, 255 }, { 220, 190, 60, 255 } };
+        std::vector<unsigned int> materials;
+        for (const auto& color : colors)
+        {
+            int texture = TextureArrayPool::instance().addPixels(std::vector<unsigned char>(color, color + 4), 1, 1);
+            materials.push_back(MaterialLibrary::instance().add(texture, -1, 64.0f));
+        }
+
+        const int gridSize = 10;
+        for (int x = 0; x < gridSize; x++)
+        {
+            for (int z = 0; z < gridSize; z++)
+            {
+                Transform transform;
+                transform.setPosition(glm::vec3(-30.0f + x * 3.0f, 1.0f, -45.0f + z * 3.0f));
+                transform.setRotation(glm::vec3(x * 17.0f, z * 23.0f, 0.0f));
+                scene.patches.addObject(surface, transform, materials[(x + z) % materials.size()]);
+            }
+        }
+    }
+    // subdivision cage, Scene::updateSubdivision refines each object to the level its size on screen needs
+    if (scene.subdivisionCage.loadObj("Assets/Objects/cages/box.obj"))
+    {
+        const unsigned char color[] = { 180, 120, 200, 255 };
+        int texture = TextureArrayPool::instance().addPixels(std::vector<unsigned char>(color, color + 4), 1, 1);
+        unsigned int material = MaterialLibrary::instance().add(texture, -1, 32.0f);
+        Transform transform;
+        transform.setPosition(glm::vec3(7.0f, 1.5f, 6.0f));
+        scene.addSubdivisionObject(transform, material);
+        transform.setPosition(glm::vec3(-12.0f, 3.0f, -6.0f));
+        transform.setScale(glm::vec3(2.5f));
+        scene.addSubdivisionObject(transform, material);
+    }
+
+    // flag pinned to an invisible pole, the full resolution needs the compute shader solver
+    const unsigned char flagColor[] = { 225, 225, 235, 255 };
+    int flagTexture = TextureArrayPool::instance().addPixels(std::vector<unsigned char>(flagColor, flagColor + 4), 1, 1);
+    unsigned int flagMaterial = MaterialLibrary::instance().add(flagTexture, -1, 16.0f);
+    scene.cloth.create(Cloth::supportsGpu() ? 128 : 48, 3.0f, glm::vec3(-7.0f, 2.0f, 9.0f), flagMaterial);
+}
+
+// Main loop where the train used to circle, a yard of ovals, and a junction where the vehicles
+// leaving the upper track alternate between the two tracks back
+void setupTracks(TrackNetwork& tracks)
+{
+    std::vector<glm::vec3> loop;
+    for (int i = 0; i < 12; i++)
+    {
+        const float angle = glm::radians(30.0f * i);
+        loop.push_back(glm::vec3(15.0f * std::sin(angle), 0.0f, 15.0f * std::cos(angle)));
+    }
+    tracks.addTrack(loop, true);
+
+    for (int k = 0; k < 4; k++)
+    {
+        std::vector<glm::vec3> oval;
+        for (int i = 0; i < 16; i++)
+        {
+            const float angle = glm::radians(22.5f * i);
+            oval.push_back(glm::vec3(70.0f + (20.0f + 6.0f * k) * std::cos(angle), 0.0f, -30.0f + (10.0f + 6.0f * k) * std::sin(angle)));
+        }
+        tracks.addTrack(oval, true);
+    }
+
+    // the points next to the junctions keep the direction across them
+    const uint32_t upper = tracks.addTrack({ { -70.0f, 0.0f, -40.0f }, { -70.0f, 0.0f, -48.0f }, { -50.0f, 0.0f, -62.0f },
+        { -30.0f, 0.0f, -48.0f }, { -30.0f, 0.0f, -40.0f } }, false);
+    const uint32_t lower = tracks.addTrack({ { -30.0f, 0.0f, -40.0f }, { -30.0f, 0.0f, -32.0f }, { -50.0f, 0.0f, -20.0f },
+        { -70.0f, 0.0f, -32.0f }, { -70.0f, 0.0f, -40.0f } }, false);
+    const uint32_t siding = tracks.addTrack({ { -30.0f, 0.0f, -40.0f }, { -30.0f, 0.0f, -32.0f }, { -50.0f, 0.0f, -5.0f },
+        { -70.0f, 0.0f, -32.0f }, { -70.0f, 0.0f, -40.0f } }, false);
+    tracks.connect(upper, lower);
+    tracks.connect(upper, siding);
+    tracks.connect(lower, upper);
+    tracks.connect(siding, upper);
 }
 
 void drawImGui()
@@ -256,10 +462,7 @@ void drawImGui()
     ImGui::NewFrame();
 
     ImGui::Begin("Settings");
-    if (ImGui::Checkbox("Wireframe (F)", &wireFrame))
-    {
-        updateWireFrame();
-    }
+    ImGui::Checkbox("Wireframe (F)", &scene.wireFrame);
     ImGui::Checkbox("Blinn (B)", &scene.useBlinn);
     if (ImGui::Checkbox("Day/Night (N)", &scene.isDayLight))
     {
@@ -267,8 +470,11 @@ void drawImGui()
     }
 
     ImGui::SliderFloat("Fog Distance", &scene.fogDistance, 0.0f, 100.0f);
+    ImGui::Checkbox("Fog Culling", &scene.fogCulling);
     ImGui::ColorEdit3("Sky Color", &scene.skyColor.x);
     ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
+    const GLState::FrameStats& glStats = GLState::instance().getLastFrameStats();
+    ImGui::Text("GL calls: %u issued, %u elided", glStats.issued, glStats.elided);
 
     // Point Lights
     if (ImGui::CollapsingHeader("Point Lights"))
@@ -312,35 +518,198 @@ void drawImGui()
 
     if (ImGui::CollapsingHeader("Objects"))
     {
-        for (auto& obj : scene.gameObjects)
+        for (Entity entity : scene.sceneEntities)
         {
-            if (ImGui::TreeNode(obj->name.c_str()))
+            if (ImGui::TreeNode(scene.world.render.name[entity].c_str()))
             {
-                ImGui::SliderFloat3("Position", &obj->transform.position.x, -20.0f, 20.0f);
-                ImGui::SliderFloat3("Rotation", &obj->transform.rotation.x, 0.0f, 360.0f);
-                ImGui::SliderFloat3("Scale", &obj->transform.scale.x, 0.1f, 20.0f);
+                drawEntitySliders(scene.world, entity);
                 ImGui::TreePop();
             }
         }
     }
 
-    // Train movement
-    if (!scene.gameObjects.empty())
+    // Followed vehicle movement
+    if (scene.followedVehicle < scene.tracks.getVehicleCount())
     {
         ImGui::Text("Train Movement");
-        ImGui::Checkbox("Enable Movement", &scene.gameObjects[0]->isMoving);
-        ImGui::SliderFloat("Movement Radius", &scene.gameObjects[0]->radius, 1.0f, 50.0f);
-        ImGui::SliderFloat("Movement Speed", &scene.gameObjects[0]->speed, 0.1f, 2.0f);
+        bool trainMoving = scene.tracks.vehicles.moving[scene.followedVehicle] != 0;
+        if (ImGui::Checkbox("Enable Movement", &trainMoving))
+            scene.tracks.vehicles.moving[scene.followedVehicle] = trainMoving ? 1 : 0;
+        ImGui::SliderFloat("Movement Speed", &scene.tracks.vehicles.speed[scene.followedVehicle], 0.0f, 30.0f);
+    }
+
+    if (ImGui::CollapsingHeader("Tracks"))
+    {
+        ImGui::Text("Tracks: %zu, vehicles: %zu, update: %.2f ms", scene.tracks.tracks.size(),
+            scene.tracks.getVehicleCount(), scene.tracks.lastUpdateMs);
+        int followed = (int)scene.followedVehicle;
+        if (ImGui::InputInt("Follow Vehicle", &followed) && followed >= 0)
+            scene.followVehicle((size_t)followed);
+        static int vehicleCount = 1000;
+        ImGui::InputInt("Count##Vehicles", &vehicleCount, 100, 1000);
+        if (ImGui::Button("Spawn vehicles") && vehicleCount > 0)
+            scene.spawnVehicles((size_t)vehicleCount);
+    }
+
+    if (ImGui::CollapsingHeader("Entities"))
+    {
+        ImGui::Text("Entities: %zu, visible: %zu", scene.world.size(), scene.world.visible.size());
+        ImGui::Text("Update: %.2f ms, cull: %.2f ms (%zu threads)", scene.world.lastUpdateMs, scene.world.lastCullMs,
+            JobSystem::instance().getThreadCount());
+        ImGui::Checkbox("Frustum Culling", &scene.frustumCulling);
+        ImGui::Checkbox("Animation LOD", &scene.world.animationLod);
+        ImGui::SliderFloat("Full Rate Distance", &scene.world.animationLodDistance, 5.0f, 200.0f);
+        ImGui::Text("Animated this frame: %zu", scene.world.lastAnimated);
+        static int stressCount = 100000;
+        ImGui::InputInt("Count##Stress", &stressCount, 10000, 100000);
+        if (ImGui::Button("Spawn moving entities") && stressCount > 0)
+            scene.spawnStressEntities((size_t)stressCount);
+        ImGui::Checkbox("Far Field Impostors", &scene.useImpostors);
+        ImGui::SliderFloat("Impostor Distance", &scene.impostorDistance, 5.0f, 200.0f);
+        ImGui::Checkbox("Per Vertex Lighting When Small", &scene.shadingLod);
+        ImGui::SliderFloat("Gouraud Below Coverage", &scene.gouraudCoverage, 0.0f, 1.0f);
+        ImGui::Checkbox("HLOD Proxies", &scene.useHlod);
+        ImGui::SliderFloat("HLOD Distance", &scene.hlod.switchDistance, 5.0f, 200.0f);
+        ImGui::Text("HLOD nodes: %d, triangles: %d -> %d, built in %.1f ms", scene.hlod.stats.nodes,
+            scene.hlod.stats.sourceTriangles, scene.hlod.stats.proxyTriangles, scene.hlod.stats.buildMs);
+        ImGui::Text("Proxies drawn: %zu, replacing %zu entities", scene.hlod.selectedProxies, scene.hlod.coveredEntities);
     }
 
     if (ImGui::CollapsingHeader("Bezier Patch"))
     {
-        ImGui::SliderFloat3("Position##Bezier", &scene.bezierTransform.position.x, -20.0f, 20.0f);
-        ImGui::SliderFloat3("Rotation##Bezier", &scene.bezierTransform.rotation.x, 0.0f, 360.0f);
-        ImGui::SliderFloat3("Scale##Bezier", &scene.bezierTransform.scale.x, 0.1f, 20.0f);
+        drawTransformSliders(scene.bezierTransform, "##Bezier");
+        ImGui::SliderFloat("Wave Speed", &scene.animationSpeed, 0.0f, 10.0f);
+        ImGui::SliderFloat("Wave Amplitude", &scene.animationAmplitude, 0.0f, 0.5f);
+    }
+
+    if (ImGui::CollapsingHeader("Subdivision Surface"))
+    {
+        ImGui::Text("Cage: %zu vertices, %zu faces", scene.subdivisionCage.getVertexCount(), scene.subdivisionCage.getFaceCount());
+        ImGui::Text("Finest level: %zu regular patches, %zu end caps", scene.subdivisionStats.regularPatches,
+            scene.subdivisionStats.endCapPatches);
+        ImGui::Checkbox("Isolation Level from Screen Size", &scene.adaptiveIsolation);
+        if (scene.adaptiveIsolation)
+        {
+            ImGui::Text("Finest isolation level: %d", scene.isolationLevel);
+            ImGui::SliderInt("Max Isolation Level", &scene.maxIsolationLevel, 1, 8);
+            ImGui::SliderFloat("Pixels per End Cap", &scene.isolationPixels, 4.0f, 128.0f);
+        }
+        else
+            ImGui::SliderInt("Isolation Level", &scene.isolationLevel, 1, 8);
+    }
+
+    if (ImGui::CollapsingHeader("Cloth"))
+    {
+        Cloth& cloth = scene.cloth;
+        ImGui::Checkbox("Simulate", &scene.simulateCloth);
+        if (Cloth::supportsGpu())
+            ImGui::Checkbox("Compute Shader Solver", &cloth.useGpu);
+        if (cloth.useGpu && Cloth::supportsGpu())
+            ImGui::Text("%dx%d particles, %.3f ms on the GPU", cloth.getResolution(), cloth.getResolution(), cloth.lastGpuMs);
+        else
+            ImGui::Text("%dx%d particles, %.3f ms on the CPU", cloth.getResolution(), cloth.getResolution(), cloth.lastSimulateMs);
+        ImGui::SliderFloat3("Wind", &cloth.settings.wind.x, -20.0f, 20.0f);
+        ImGui::SliderFloat("Turbulence", &cloth.settings.turbulence, 0.0f, 2.0f);
+        ImGui::SliderFloat("Drag", &cloth.settings.drag, 0.0f, 4.0f);
+        ImGui::SliderInt("Substeps", &cloth.settings.substeps, 1, 16);
+        ImGui::SliderInt("Iterations", &cloth.settings.iterations, 1, 32);
+        ImGui::SliderFloat("Bending", &cloth.settings.bendStiffness, 0.0f, 1.0f);
+        if (ImGui::Button("Reset Cloth"))
+            cloth.reset();
+    }
+
+    if (ImGui::CollapsingHeader("Skinning"))
+    {
+        SkinningSystem& skinning = scene.skinning;
+        ImGui::Text("Animated entities: %zu, skinned this frame: %zu", skinning.instances.size(), skinning.lastSkinned);
+        ImGui::Text("Sampling: %.3f ms on %zu threads", skinning.lastSampleMs, JobSystem::instance().getThreadCount());
+        if (SkinningSystem::supportsGpu())
+            ImGui::Checkbox("Compute Shader Skinning", &skinning.useGpu);
+        if (skinning.useGpu && SkinningSystem::supportsGpu())
+            ImGui::Text("Skinning: %.3f ms on the GPU", skinning.lastGpuMs);
+        else
+            ImGui::Text("Skinning: %.3f ms on the CPU", skinning.lastSkinMs);
+        ImGui::SliderFloat("Playback Speed", &skinning.playbackSpeed, 0.0f, 3.0f);
+        // every instance crossfades to its model's next clip
+        if (ImGui::Button("Next Clip"))
+        {
+            for (size_t i = 0; i < skinning.instances.size(); i++)
+            {
+                const size_t clips = skinning.instances[i].model->animations.size();
+                if (clips > 1)
+                    skinning.play(i, (skinning.instances[i].clip + 1) % (int)clips, 0.3f);
+            }
+        }
+
+        VertexAnimationBaker& crowds = scene.crowdAnimations;
+        ImGui::Text("Crowd instances: %zu, drawn: %zu", crowds.getInstanceCount(), crowds.lastDrawn);
+        if (scene.crowdModel)
+        {
+            if (ImGui::Button("Spawn Crowd of 10000"))
+                scene.spawnCrowd(10000);
+            ImGui::Text("Last bake: %.1f ms", crowds.lastBakeMs);
+        }
+        else
+            ImGui::Text("No rigged model with animations to spawn crowds of");
+    }
+
+    if (ImGui::CollapsingHeader("Particles"))
+    {
+        ParticleSystem& particles = scene.particles;
+        if (particles.isCreated())
+        {
+            ImGui::Checkbox("Simulate Particles", &scene.simulateParticles);
+            ImGui::Text("Pool: %u particles, emitting %u per frame from %zu emitters", particles.getCapacity(), particles.lastEmitted, particles.emitters.size());
+            ImGui::Text("%.3f ms on the GPU%s", particles.lastGpuMs, particles.lastSorted ? ", sorted" : "");
+            ImGui::Checkbox("Sort Blended Particles", &particles.sortBlended);
+            ImGui::SliderInt("Sparking Vehicles", &scene.sparkingVehicles, 0, MAX_PARTICLE_EMITTERS - 1);
+            ImGui::SliderFloat3("Particle Wind", &particles.wind.x, -10.0f, 10.0f);
+        }
+        else
+            ImGui::Text("Particles need compute shaders");
+    }
+
+    if (ImGui::CollapsingHeader("Vegetation"))
+    {
+        VegetationScatter& vegetation = scene.vegetation;
+        if (VegetationScatter::supportsGpu())
+        {
+            ImGui::Checkbox("Scatter Vegetation", &vegetation.enabled);
+            ImGui::Text("%zu tiles, %.3f ms on the GPU", vegetation.lastTiles, vegetation.lastGpuMs);
+            const char* names[] = { "Grass", "Rocks" };
+            for (size_t i = 0; i < vegetation.layers.size() && i < 2; i++)
+            {
+                VegetationScatter::Layer& layer = vegetation.layers[i];
+                ImGui::Checkbox(names[i], &layer.enabled);
+                ImGui::SliderInt(("Per Tile##" + std::to_string(i)).c_str(), &layer.instancesPerTile, 0, 1024);
+                ImGui::SliderFloat(("Distance##" + std::to_string(i)).c_str(), &layer.maxDistance, 5.0f, 200.0f);
+                ImGui::Text("Up to %u in view", layer.maxInstances);
+            }
+        }
+        else
+            ImGui::Text("Vegetation needs compute shaders");
     }
 
-    ImGui::SliderFloat("Tessellation Level", &scene.tessLevel, 1.0f, 64.0f);
+    ImGui::SliderFloat(scene.adaptiveTessellation ? "Max Tessellation Level" : "Tessellation Level", &scene.tessLevel, 1.0f, 64.0f);
+    ImGui::Checkbox("Adaptive Tessellation", &scene.adaptiveTessellation);
+    if (scene.adaptiveTessellation)
+        ImGui::SliderFloat("Pixels per Triangle Edge", &scene.tessPixelsPerEdge, 2.0f, 64.0f);
+    ImGui::Checkbox("Surface Backface Culling", &scene.patchBackfaceCulling);
+    ImGui::Checkbox("CPU Tessellation", &scene.cpuTessellation);
+    if (scene.cpuTessellation)
+    {
+        ImGui::Text("Patches: %zu of %zu visible, %.2f ms on %zu threads", scene.cpuTessellator.getVisiblePatchCount(),
+            scene.cpuTessellator.getPatchCount(), scene.cpuTessellator.lastTessellateMs, JobSystem::instance().getThreadCount());
+    }
+    else
+    {
+        ImGui::Checkbox("Cache Static Surfaces", &scene.cacheSurfaces);
+        if (scene.cacheSurfaces)
+            ImGui::Text("Cached vertices: %zu, at the fixed tessellation level", scene.patchCache.getVertexCount());
+        else
+            ImGui::Text("Surface patches: %zu in %s", scene.patches.getPatchCount(),
+                PatchRenderer::supportsStorage() ? "one draw" : "one draw per object");
+    }
 
     ImGui::End();
 
@@ -362,4 +731,32 @@ void drawImGui()
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+}
+
+// Edits a copy, so the transform is only marked dirty when a slider actually moved
+void drawTransformSliders(Transform& transform, const std::string& idSuffix)
+{
+    glm::vec3 position = transform.getPosition();
+    glm::vec3 rotation = transform.getRotation();
+    glm::vec3 scale = transform.getScale();
+    if (ImGui::SliderFloat3(("Position" + idSuffix).c_str(), &position.x, -20.0f, 20.0f))
+        transform.setPosition(position);
+    if (ImGui::SliderFloat3(("Rotation" + idSuffix).c_str(), &rotation.x, 0.0f, 360.0f))
+        transform.setRotation(rotation);
+    if (ImGui::SliderFloat3(("Scale" + idSuffix).c_str(), &scale.x, 0.1f, 20.0f))
+        transform.setScale(scale);
+}
+
+void drawEntitySliders(EntityWorld& world, Entity entity)
+{
+    const std::string idSuffix = "##" + std::to_string(entity);
+    glm::vec3 position = world.transforms.position[entity];
+    glm::vec3 rotation = world.transforms.rotation[entity];
+    glm::vec3 scale = world.transforms.scale[entity];
+    if (ImGui::SliderFloat3(("Position" + idSuffix).c_str(), &position.x, -20.0f, 20.0f))
+        world.setPosition(entity, position);
+    if (ImGui::SliderFloat3(("Rotation" + idSuffix).c_str(), &rotation.x, 0.0f, 360.0f))
+        world.setRotation(entity, rotation);
+    if (ImGui::SliderFloat3(("Scale" + idSuffix).c_str(), &scale.x, 0.1f, 20.0f))
+        world.setScale(entity, scale);
 }
\ No newline at end of file